@@ -19,20 +19,51 @@
 #pragma once
 
 #include <nori/mesh.h>
+#include <tbb/concurrent_vector.h>
+#include <cstring>
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Counters that describe the cost of BVH traversals
+ *
+ * These are only gathered by the instrumented variant of
+ * \ref Accel::rayIntersect(), the regular one does not pay for them.
+ */
+struct TraversalStatistics
+{
+	/// Number of BVH nodes whose bounding box was tested
+	uint64_t nodesVisited = 0;
+
+	/// Number of ray-triangle intersection tests
+	uint64_t trianglesTested = 0;
+};
+
 /**
  * \brief Acceleration data structure for ray intersection queries
  *
- * The current implementation falls back to a brute force loop
- * through the geometry.
+ * A binary BVH is built first (see \ref EBuilder for the available
+ * algorithms) and then collapsed into a 4-wide BVH with quantized child
+ * bounding boxes (see \ref WideBVHNode), which is used for all queries.
  */
 class Accel
 {
 	friend class BVHBuildTask;
 
 public:
+	/// Algorithms for building the binary BVH
+	enum EBuilder
+	{
+		/// Top-down binned SAH build (slower, best trees)
+		ESAH = 0,
+
+		/// Linear BVH from sorted Morton codes (near-instant, worse trees)
+		ELBVH,
+
+		/// Linear BVH whose top levels are rebuilt by agglomerative clustering
+		EHLBVH
+	};
+
 	/// Create a new and empty BVH
 	Accel() { m_meshOffset.push_back(0u); }
 
@@ -52,6 +83,41 @@ public:
 	/// Build the BVH
 	void build();
 
+	/**
+	 * \brief Place a copy of the BVH nodes and triangle indices in the
+	 * local memory of every NUMA node of \c executor
+	 *
+	 * Subsequent queries read the copy of the node that the calling
+	 * thread works on (see \ref NumaExecutor::getCurrentNode()). With a
+	 * single node, any existing copies are released. The copies are
+	 * discarded by the next call to \ref build().
+	 */
+	void distribute(NumaExecutor &executor);
+
+	/// Select the algorithm used by subsequent calls to \ref build() (default: \ref ESAH)
+	void setBuilder(EBuilder builder) { m_builder = builder; }
+
+	/// Return the algorithm used to build the BVH
+	EBuilder getBuilder() const { return m_builder; }
+
+	/// Return the name of a builder ("sah", "lbvh" or "hlbvh")
+	static std::string getBuilderName(EBuilder builder);
+
+	/// Convert a builder name to the corresponding \ref EBuilder value (throws if unknown)
+	static EBuilder parseBuilder(const std::string &name);
+
+	/// Return the SAH cost of the binary BVH built by the last call to \ref build()
+	float getSAHCost() const { return m_sahCost; }
+
+	/**
+	 * \brief Measure the traversal performance of the compressed and the
+	 * binary node format after each build and report it (default: off)
+	 *
+	 * This traces a small set of random rays through both formats,
+	 * which can be turned off when the build time itself is measured.
+	 */
+	void setCompareFormats(bool compare) { m_compareFormats = compare; }
+
 	/**
 	 * \brief Intersect a ray against all triangle meshes registered
 	 * with the BVH
@@ -70,12 +136,44 @@ public:
 	bool rayIntersect(const Ray3f &ray, Intersection &its,
 					  bool shadowRay = false) const;
 
+	/**
+	 * \brief Instrumented version of \ref rayIntersect()
+	 *
+	 * Behaves exactly like the function above, but additionally adds the
+	 * number of visited nodes and tested triangles to \c stats.
+	 */
+	bool rayIntersect(const Ray3f &ray, Intersection &its,
+					  bool shadowRay, TraversalStatistics &stats) const;
+
+	/**
+	 * \brief Accumulate the traversal costs of all subsequent queries
+	 * made by the calling thread into \c stats
+	 *
+	 * This is used to attribute BVH traversal costs to individual pixels.
+	 * Pass \c nullptr to stop recording.
+	 */
+	static void setThreadStatistics(TraversalStatistics *stats) { s_threadStatistics = stats; }
+
+	/**
+	 * \brief Store the result of the next closest-hit query made by the
+	 * calling thread in \c its
+	 *
+	 * This is used to obtain the primary intersection that an integrator
+	 * computes for a camera ray, without having to trace the ray again.
+	 * On a miss, \c its.mesh is set to \c nullptr. Only a single query is
+	 * captured; afterwards, the hook disarms itself.
+	 */
+	static void captureNextHit(Intersection *its) { s_capturedHit = its; }
+
 	/// Return the total number of meshes registered with the BVH
 	n_UINT getMeshCount() const { return (n_UINT)m_meshes.size(); }
 
 	/// Return the total number of internally represented triangles
 	n_UINT getTriangleCount() const { return m_meshOffset.back(); }
 
+	/// Return the number of (4-wide) nodes of the BVH
+	n_UINT getNodeCount() const { return (n_UINT)m_wideNodes.size(); }
+
 	/// Return one of the registered meshes
 	Mesh *getMesh(n_UINT idx) { return m_meshes[idx]; }
 
@@ -89,6 +187,31 @@ public:
 	}
 
 protected:
+	/// Heuristic costs used by the SAH
+	enum
+	{
+		/// Heuristic cost value for traversal operations
+		TRAVERSAL_COST = 1,
+
+		/// Heuristic cost value for intersection operations
+		INTERSECTION_COST = 1
+	};
+
+	/// Number of entries of the traversal stack of the 4-wide BVH
+	enum
+	{
+		STACK_SIZE = 192
+	};
+
+	/// Bounding box of a triangle, precomputed once per build
+	struct BVHPrimitive
+	{
+		BoundingBox3f bbox;
+
+		/// Center of the bounding box, which stands in for the triangle centroid
+		float centroid(int axis) const { return 0.5f * (bbox.min[axis] + bbox.max[axis]); }
+	};
+
 	/**
 	 * \brief Compute the mesh and triangle indices corresponding to
 	 * a primitive index used by the underlying generic BVH implementation.
@@ -100,23 +223,51 @@ protected:
 		return (n_UINT)(it - m_meshOffset.begin());
 	}
 
-	//// Return an axis-aligned bounding box containing the given triangle
-	BoundingBox3f getBoundingBox(n_UINT index) const
-	{
-		n_UINT meshIdx = findMesh(index);
-		return m_meshes[meshIdx]->getBoundingBox(index);
-	}
-
-	//// Return the centroid of the given triangle
-	Point3f getCentroid(n_UINT index) const
-	{
-		n_UINT meshIdx = findMesh(index);
-		return m_meshes[meshIdx]->getCentroid(index);
-	}
-
 	/// Compute internal tree statistics
 	std::pair<float, n_UINT> statistics(n_UINT index = 0) const;
 
+	/// Per-thread destination of traversal costs, see \ref setThreadStatistics()
+	static thread_local TraversalStatistics *s_threadStatistics;
+
+	/// Per-thread destination of the next closest hit, see \ref captureNextHit()
+	static thread_local Intersection *s_capturedHit;
+
+	/// Closest-hit query without the \ref captureNextHit() hook
+	bool rayIntersectUncaptured(const Ray3f &ray, Intersection &its, bool shadowRay) const;
+
+	/// Shared traversal code, \c Instrumented selects whether \c stats is updated
+	template <bool Instrumented>
+	bool traverse(const Ray3f &ray, Intersection &its, bool shadowRay,
+				  TraversalStatistics *stats) const;
+
+	/// Traversal of the binary BVH, only used to compare the node formats
+	bool traverseBinary(const Ray3f &ray, Intersection &its, bool shadowRay) const;
+
+	/// Fill in the details of a hit with triangle \c f (\c its.mesh, \c its.uv and \c its.t are set)
+	void finalizeIntersection(Intersection &its, n_UINT f) const;
+
+	/**
+	 * \brief Build the binary BVH from Morton codes (see lbvh.cpp)
+	 *
+	 * \param prims
+	 *    Bounding boxes of all triangles
+	 * \param refine
+	 *    Rebuild the top levels by agglomerative clustering (\ref EHLBVH)?
+	 */
+	void buildLBVH(const std::vector<BVHPrimitive> &prims, bool refine);
+
+	/**
+	 * \brief Convert the binary subtree below an inner node into 4-wide
+	 * nodes, and return the index of its root
+	 *
+	 * \c stackSize is set to the number of traversal stack entries that
+	 * the subtree needs in the worst case.
+	 */
+	n_UINT collapse(n_UINT node_idx, int &stackSize);
+
+	/// Trace random rays through one of the node formats, and return the number of rays per second
+	double measureRayRate(bool binary) const;
+
 	/* BVH node in 32 bytes */
 	struct BVHNode
 	{
@@ -133,7 +284,7 @@ protected:
 			{
 				unsigned flag : 1;
 				uint32_t axis : 31;
-				n_UINT rightChild;
+				n_UINT children; ///< Index of the left child, the right one follows it
 			} inner;
 
 			uint64_t data;
@@ -150,11 +301,6 @@ protected:
 			return leaf.flag == 0;
 		}
 
-		bool isUnused() const
-		{
-			return data == 0;
-		}
-
 		n_UINT start() const
 		{
 			return leaf.start;
@@ -166,11 +312,58 @@ protected:
 		}
 	};
 
+	/**
+	 * \brief Compressed 4-wide BVH node in 64 bytes
+	 *
+	 * The bounding boxes of the (up to four) children are quantized to
+	 * 8 bits per coordinate on a local grid that spans the node: the value
+	 * \c q along axis \c a decodes to <tt>origin[a] + q * 2^exponent[a]</tt>.
+	 * The grid spacing is a power of two, and the quantized boxes are
+	 * rounded outwards during the build such that the decoded boxes always
+	 * contain the exact ones. Hence no intersections are missed.
+	 */
+	struct WideBVHNode
+	{
+		float origin[3];
+		int8_t exponent[3];
+		uint8_t childCount;
+
+		/// Quantized child bounding boxes (per axis and child)
+		uint8_t lower[3][4], upper[3][4];
+
+		/// Index of the child node, or of the first triangle of a leaf
+		n_UINT child[4];
+
+		/// Number of triangles of a leaf child (0: inner node)
+		uint16_t leafSize[4];
+
+		/// Size of a grid cell along the given axis (assembled from the exponent bits)
+		float scale(int axis) const
+		{
+			uint32_t bits = (uint32_t)(exponent[axis] + 127) << 23;
+			float result;
+			memcpy(&result, &bits, sizeof(float));
+			return result;
+		}
+
+		/// Decode a quantized coordinate
+		float decode(int axis, uint8_t value, float scale) const
+		{
+			return origin[axis] + value * scale;
+		}
+	};
+
 private:
 	std::vector<Mesh *> m_meshes;	  ///< List of meshes registered with the BVH
 	std::vector<n_UINT> m_meshOffset; ///< Index of the first triangle for each shape
-	std::vector<BVHNode> m_nodes;	  ///< BVH nodes
+	tbb::concurrent_vector<BVHNode> m_nodes; ///< Binary BVH nodes (only used during the build)
+	std::vector<WideBVHNode> m_wideNodes; ///< Compressed BVH nodes
+	bool m_compareFormats = false;	  ///< Compare the node formats after building?
+	EBuilder m_builder = ESAH;		  ///< Algorithm used to build the binary BVH
+	float m_sahCost = 0;			  ///< SAH cost of the last build
 	std::vector<n_UINT> m_indices;	  ///< Index references by BVH nodes
+	std::vector<std::pair<std::vector<WideBVHNode>, std::vector<n_UINT>>>
+		m_replicas;					  ///< Per NUMA node copies of the nodes and indices
 	BoundingBox3f m_bbox;			  ///< Bounding box of the entire BVH
 };
 
@@ -25,11 +25,36 @@
 #include <nori/color.h>
 #include <nori/vector.h>
 #include <tbb/mutex.h>
+#include <atomic>
+#include <memory>
 
 #define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
 
 NORI_NAMESPACE_BEGIN
 
+/**
+ * \brief Description of an additional channel of an \ref ImageBlock
+ *
+ * In contrast to the color channels, these are not convolved with
+ * the reconstruction filter: every sample only contributes to the pixel
+ * that contains it.
+ */
+struct ImageChannel
+{
+    /// Name of the channel in the output EXR file (e.g. "albedo.R")
+    std::string name;
+
+    /**
+     * \brief Keep the maximum rather than the average of the samples
+     *
+     * This is useful for channels that must not be blended (e.g. IDs)
+     */
+    bool maximum;
+
+    ImageChannel(const std::string &name, bool maximum = false)
+        : name(name), maximum(maximum) {}
+};
+
 /**
  * \brief Weighted pixel storage for a rectangular subregion of an image
  *
@@ -43,6 +68,9 @@ NORI_NAMESPACE_BEGIN
  * this region. For that reason, this class also stores information about
  * a small border region around the rectangle, whose size depends on the
  * properties of the reconstruction filter.
+ *
+ * Optionally, the block stores a set of additional channels (e.g. for
+ * arbitrary output variables such as albedo or depth), see \ref ImageChannel.
  */
 class ImageBlock : public Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
 {
@@ -54,8 +82,11 @@ public:
      * \param filter
      *     Samples will be convolved with the image reconstruction
      *     filter provided here.
+     * \param channels
+     *     Additional channels that should be stored for each pixel
      */
-    ImageBlock(const Vector2i &size, const ReconstructionFilter *filter);
+    ImageBlock(const Vector2i &size, const ReconstructionFilter *filter,
+               const std::vector<ImageChannel> &channels = std::vector<ImageChannel>());
 
     /// Release all memory
     ~ImageBlock();
@@ -87,11 +118,64 @@ public:
     void fromBitmap(const Bitmap &bitmap);
 
     /// Clear all contents
-    void clear() { setConstant(Color4f()); }
+    void clear();
+
+    /// Clear the rows <tt>firstRow, .., lastRow-1</tt> (including the border region)
+    void clearRows(int firstRow, int lastRow);
 
     /// Record a sample with the given position and radiance value
     void put(const Point2f &pos, const Color3f &value);
 
+    /// Return the additional channels stored by this block
+    const std::vector<ImageChannel> &getChannels() const { return m_channels; }
+
+    /**
+     * \brief Record the additional channel values of a sample
+     *
+     * \c values must contain one entry per channel. The sample count
+     * of the pixel containing \c pos is incremented as well.
+     */
+    void putChannels(const Point2f &pos, const float *values);
+
+    /**
+     * \brief Write the normalized image along with all additional
+     * channels and the per-pixel sample count to an OpenEXR file
+     */
+    void saveEXR(const std::string &filename) const;
+
+    /**
+     * \brief Write the raw (unnormalized) contents of the block,
+     * including the filter weights and all additional channels
+     */
+    void serialize(std::ostream &os) const;
+
+    /**
+     * \brief Restore the contents written by \ref serialize()
+     *
+     * Throws a \ref NoriException if the stored data was produced by a
+     * block with a different size, border or set of channels.
+     */
+    void unserialize(std::istream &is);
+
+    /**
+     * \brief Write the unnormalized contents of the block to an OpenEXR file
+     *
+     * In contrast to \ref saveEXR(), the file stores the weighted sums of
+     * the samples along with the accumulated filter weights (channel "W")
+     * and the raw additional channels. The partial results of several
+     * processes can then be combined using \ref putPartialEXR().
+     */
+    void savePartialEXR(const std::string &filename) const;
+
+    /**
+     * \brief Create an empty block with the size and channels of a file
+     * written by \ref savePartialEXR()
+     */
+    static ImageBlock *fromPartialEXR(const std::string &filename);
+
+    /// Accumulate the contents of a file written by \ref savePartialEXR()
+    void putPartialEXR(const std::string &filename);
+
     /**
      * \brief Merge another image block into this one
      *
@@ -100,6 +184,15 @@ public:
      */
     void put(ImageBlock &b);
 
+    /**
+     * \brief Copy the size, the additional channels and the raw contents
+     * of another block, but not its reconstruction filter
+     *
+     * The copy can be serialized, but cannot record samples. It reuses
+     * its memory when the layout of the other block does not change.
+     */
+    void copyFrom(const ImageBlock &b);
+
     /// Lock the image block (using an internal mutex)
     inline void lock() const { m_mutex.lock(); }
 
@@ -119,6 +212,10 @@ protected:
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
     mutable tbb::mutex m_mutex;
+
+    /* Additional channels, followed by the sample count of each pixel */
+    std::vector<ImageChannel> m_channels;
+    std::vector<float> m_channelData;
 };
 
 /**
@@ -128,6 +225,12 @@ protected:
  * rectangular blocks suitable for parallel rendering. The blocks
  * are ordered in spiraling pattern so that the center is
  * rendered first.
+ *
+ * Optionally, only a subset of the blocks is generated: either a range
+ * of blocks in the order above, or the parts of the blocks that overlap
+ * a crop window (or both). The blocks always lie on the same grid as
+ * those of the full image, which makes it possible to split the
+ * rendering of a frame over several processes.
  */
 class BlockGenerator
 {
@@ -141,6 +244,12 @@ public:
      */
     BlockGenerator(const Vector2i &size, int blockSize);
 
+    /// Only generate the parts of the blocks that overlap the given window
+    void setCropWindow(const Point2i &offset, const Vector2i &size);
+
+    /// Only generate the blocks with index <tt>first, .., last-1</tt>
+    void setBlockRange(int first, int last);
+
     /**
      * \brief Return the next block to be rendered
      *
@@ -150,10 +259,47 @@ public:
      */
     bool next(ImageBlock &block);
 
-    /// Return the total number of blocks
-    int getBlockCount() const { return m_blocksLeft; }
+    /// Return the number of blocks that will be generated
+    int getBlockCount() const { return m_blockCount; }
+
+    /// Return the number of blocks of the full image
+    int getTotalBlockCount() const { return (int)m_blocks.size(); }
+
+    /**
+     * \brief Split the blocks into \c count partitions
+     *
+     * Block row \c i belongs to partition <tt>i % count</tt>. Every
+     * partition has its own queue (see \ref next(ImageBlock &, int)),
+     * so that e.g. each NUMA node can render its own region of the image.
+     */
+    void setPartitionCount(int count);
+
+    /// Return the number of partitions
+    int getPartitionCount() const { return (int)m_partitions.size(); }
+
+    /// Return the partition that the given row of pixels belongs to
+    int getPartition(int y) const { return (y / m_blockSize) % getPartitionCount(); }
+
+    /// Return the number of blocks of a partition that will be generated
+    int getBlockCount(int partition) const { return (int)m_partitions[partition].size(); }
+
+    /**
+     * \brief Return the next block of the given partition
+     *
+     * This function is thread-safe and does not interfere with the
+     * queues of the other partitions.
+     *
+     * \return \c false if there were no more blocks in this partition
+     */
+    bool next(ImageBlock &block, int partition);
+
+    /// Restart at the first block (e.g. for another progressive pass)
+    void reset();
 
 protected:
+    /// Compute the region of the block with the given index (\c false if empty)
+    bool getRegion(int index, Point2i &offset, Vector2i &size) const;
+
     enum EDirection
     {
         ERight = 0,
@@ -162,15 +308,20 @@ protected:
         EUp
     };
 
-    Point2i m_block;
+    std::vector<Point2i> m_blocks;
     Vector2i m_numBlocks;
     Vector2i m_size;
     int m_blockSize;
-    int m_numSteps;
-    int m_blocksLeft;
-    int m_stepsLeft;
-    int m_direction;
+    Point2i m_cropOffset;
+    Vector2i m_cropSize;
+    int m_first, m_last;
+    int m_next;
+    int m_blockCount;
     tbb::mutex m_mutex;
+
+    /* Indices of the blocks of each partition and the position of its queue */
+    std::vector<std::vector<int>> m_partitions;
+    std::unique_ptr<std::atomic<int>[]> m_partitionNext;
 };
 
 NORI_NAMESPACE_END
@@ -25,6 +25,38 @@
 
 NORI_NAMESPACE_BEGIN
 
+/// Components of a BSDF, used to describe which one produced a sample
+enum EBSDFLobe
+{
+    ENullLobe = 0x00,
+    EDiffuseReflection = 0x01,
+    EGlossyReflection = 0x02,
+    EGlossyTransmission = 0x04,
+    EDeltaReflection = 0x08,
+    EDeltaTransmission = 0x10,
+
+    /* Combinations */
+    ESmooth = EDiffuseReflection | EGlossyReflection | EGlossyTransmission,
+    EDelta = EDeltaReflection | EDeltaTransmission
+};
+
+/**
+ * \brief Texture inputs of a BSDF, evaluated once at a surface point
+ *
+ * Integrators that query a BSDF several times at the same intersection
+ * can create this closure using \ref BSDF::evalClosure() and pass it to
+ * the queries (see \ref BSDFQueryRecord::closure), which avoids repeated
+ * texture lookups.
+ */
+struct BSDFClosure
+{
+    /// Color input (e.g. the albedo of a diffuse BSDF, or R0 of a conductor)
+    Color3f color = Color3f(0.0f);
+
+    /// Roughness of microfacet BSDFs
+    float alpha = 0.0f;
+};
+
 /**
  * \brief Convenience data structure used to pass multiple
  * parameters to the evaluation and sampling routines in \ref BSDF
@@ -46,14 +78,27 @@ struct BSDFQueryRecord
     /// Measure associated with the sample
     EMeasure measure;
 
+    /// Density of the sampled direction, as returned by \ref BSDF::pdf() (set by \ref BSDF::sample())
+    float pdf;
+
+    /// Lobe that produced the sampled direction (set by \ref BSDF::sample())
+    EBSDFLobe lobe;
+
+    /// Texture inputs at \c uv (optional, otherwise the textures are looked up)
+    const BSDFClosure *closure;
+
     /// Create a new record for sampling the BSDF
-    BSDFQueryRecord(const Vector3f &wi, const Vector2f &uv = Vector2f())
-        : wi(wi), eta(1.f), uv(uv), measure(EUnknownMeasure) {}
+    BSDFQueryRecord(const Vector3f &wi, const Vector2f &uv = Vector2f(),
+                    const BSDFClosure *closure = nullptr)
+        : wi(wi), eta(1.f), uv(uv), measure(EUnknownMeasure), pdf(0.f), lobe(ENullLobe),
+          closure(closure) {}
 
     /// Create a new record for querying the BSDF
     BSDFQueryRecord(const Vector3f &wi,
-                    const Vector3f &wo, const Vector2f &uv, EMeasure measure)
-        : wi(wi), wo(wo), uv(uv), eta(1.f), measure(measure) {}
+                    const Vector3f &wo, const Vector2f &uv, EMeasure measure,
+                    const BSDFClosure *closure = nullptr)
+        : wi(wi), wo(wo), uv(uv), eta(1.f), measure(measure), pdf(0.f), lobe(ENullLobe),
+          closure(closure) {}
 };
 
 /**
@@ -67,6 +112,10 @@ public:
      * value of the BSDF * cos(theta_o) divided by the probability density
      * of the sample with respect to solid angles).
      *
+     * Besides the sampled direction, \c bRec receives the density of the
+     * sample (i.e. the value of \ref pdf() for it) and the sampled lobe,
+     * so that no further queries are needed to e.g. compute MIS weights.
+     *
      * \param bRec    A BSDF query record
      * \param sample  A uniformly distributed sample on \f$[0,1]^2\f$
      *
@@ -106,6 +155,27 @@ public:
 
     virtual float pdf(const BSDFQueryRecord &bRec) const = 0;
 
+    /**
+     * \brief Evaluate the BSDF and the density of sampling \c bRec.wo
+     * at the same time
+     *
+     * This is equivalent to calling \ref eval() and \ref pdf(), but
+     * shares the work that both have in common (texture lookups,
+     * half vectors, microfacet distributions, ..).
+     *
+     * \param bRec
+     *     A record with detailed information on the BSDF query
+     * \param pdf
+     *     Receives the value of \ref pdf()
+     * \return
+     *     The BSDF value, evaluated for each color channel
+     */
+    virtual Color3f evalWithPdf(const BSDFQueryRecord &bRec, float &pdf) const
+    {
+        pdf = this->pdf(bRec);
+        return eval(bRec);
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.)
      * provided by this instance
@@ -118,6 +188,29 @@ public:
      * or not to store photons on a surface
      */
     virtual bool isDiffuse() const { return false; }
+
+    /**
+     * \brief Return whether this is an ideal diffuse (Lambertian) BRDF,
+     * whose value is the color of its closure divided by pi. This is used
+     * by irradiance caching to shade surfaces with the cached irradiance
+     */
+    virtual bool isLambertian() const { return false; }
+
+    /**
+     * \brief Return the (approximate) albedo at the given UV coordinates
+     *
+     * This is used to create feature buffers for denoising. The default
+     * implementation is suitable for specular materials such as mirrors
+     * and glass, which reflect or transmit all incident light.
+     */
+    virtual Color3f getAlbedo(const Point2f &uv) const { return Color3f(1.0f); }
+
+    /**
+     * \brief Evaluate the texture inputs of the BSDF at the given UV
+     * coordinates (the default implementation does nothing, which suits
+     * BSDFs without textured parameters)
+     */
+    virtual void evalClosure(const Point2f &uv, BSDFClosure &closure) const {}
 };
 
 NORI_NAMESPACE_END
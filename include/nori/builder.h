@@ -0,0 +1,104 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/object.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Programmatic construction of scenes
+ *
+ * This class is the in-memory counterpart of the XML parser (see
+ * \ref loadFromXML()). Objects are instantiated by the name they were
+ * registered with (e.g. "diffuse", "perspective" or "path_mis") from a
+ * \ref PropertyList, and meshes can be created directly from vertex and
+ * index buffers. For instance:
+ *
+ * <pre>
+ * SceneBuilder builder;
+ * PropertyList camera;
+ * camera.setInteger("width", 640);
+ * camera.setInteger("height", 480);
+ * builder.add(SceneBuilder::create("perspective", camera));
+ * builder.add(SceneBuilder::create("path_mis"));
+ * builder.addMesh("floor", positions, 4, indices, 2);
+ * std::unique_ptr<Scene> scene(builder.build());
+ * renderImage(scene.get(), rgb);
+ * </pre>
+ */
+class SceneBuilder
+{
+public:
+    /// Release all objects that were not passed on to a scene
+    ~SceneBuilder();
+
+    /**
+     * \brief Instantiate and activate a registered class
+     *
+     * This is equivalent to an XML tag with the given \c type attribute,
+     * properties, and nested objects (e.g. the BSDF of a mesh). The
+     * children are owned by the new object afterwards.
+     */
+    static NoriObject *create(const std::string &type,
+                              const PropertyList &propList = PropertyList(),
+                              const std::vector<NoriObject *> &children = std::vector<NoriObject *>());
+
+    /**
+     * \brief Create a triangle mesh from memory and add it to the scene
+     *
+     * All buffers are copied.
+     *
+     * \param name
+     *     Name of the mesh (for diagnostic messages)
+     * \param positions
+     *     Vertex positions (<tt>3 * vertexCount</tt> values)
+     * \param indices
+     *     Vertex indices of each triangle (<tt>3 * triangleCount</tt> values)
+     * \param normals
+     *     Optional vertex normals (<tt>3 * vertexCount</tt> values)
+     * \param texcoords
+     *     Optional texture coordinates (<tt>2 * vertexCount</tt> values)
+     * \param bsdf
+     *     Optional material created using \ref create() (default: diffuse)
+     * \param emitter
+     *     Optional area emitter created using \ref create()
+     */
+    Mesh *addMesh(const std::string &name,
+                  const float *positions, uint32_t vertexCount,
+                  const uint32_t *indices, uint32_t triangleCount,
+                  const float *normals = nullptr, const float *texcoords = nullptr,
+                  NoriObject *bsdf = nullptr, NoriObject *emitter = nullptr);
+
+    /// Add an object (camera, integrator, sampler, emitter, mesh, ..) to the scene
+    void add(NoriObject *object);
+
+    /**
+     * \brief Create and activate the scene, which includes
+     * building the acceleration data structure
+     *
+     * The builder is empty afterwards and can be reused.
+     */
+    Scene *build();
+
+private:
+    std::vector<NoriObject *> m_objects;
+};
+
+NORI_NAMESPACE_END
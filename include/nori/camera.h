@@ -58,12 +58,61 @@ public:
                               const Point2f &samplePosition,
                               const Point2f &apertureSample) const = 0;
 
+    /**
+     * \brief Project a point onto the film, e.g. to connect the vertices
+     * of light paths to the camera
+     *
+     * \param p
+     *    A point in world space
+     *
+     * \param position
+     *    Receives the position of the (pinhole) camera
+     *
+     * \param pixel
+     *    Receives the fractional pixel coordinates at which \c p is seen
+     *
+     * \return
+     *    The density per unit solid angle of the direction towards \c p,
+     *    when \ref sampleRay() is called with sample positions that are
+     *    uniformly distributed over the entire film (zero if \c p is not
+     *    visible). This also equals the importance of the camera for the
+     *    direction times the cosine of its angle to the optical axis.
+     */
+    virtual float project(const Point3f &p, Point3f &position, Point2f &pixel) const
+    {
+        throw NoriException("Camera::project(): not implemented!");
+    }
+
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
     /// Return the camera's reconstruction filter in image space
     const ReconstructionFilter *getReconstructionFilter() const { return m_rfilter; }
 
+    /// Return the number of frames rendered by an animated camera (1 if static)
+    virtual int getFrameCount() const { return 1; }
+
+    /**
+     * \brief Create a static copy of an animated camera that is
+     * positioned at frame \c frame of its animation
+     *
+     * The copy shares the reconstruction filter of this camera.
+     */
+    virtual Camera *createFrame(int frame) const
+    {
+        throw NoriException("Camera::createFrame(): not implemented!");
+    }
+
+    /**
+     * \brief Create a static copy of the camera that is additionally
+     * transformed by \c trafo (in world space), e.g. to move it around
+     * in an interactive preview
+     */
+    virtual Camera *createTransformed(const Transform &trafo) const
+    {
+        throw NoriException("Camera::createTransformed(): not implemented!");
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/Camera/etc.)
      * provided by this instance
@@ -0,0 +1,127 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <nori/timer.h>
+#include <condition_variable>
+#include <mutex>
+#include <set>
+#include <thread>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Periodic snapshots of a render in progress
+ *
+ * All finished image blocks are merged into the output image through
+ * this class, which keeps track of which blocks are already done. At
+ * regular intervals, the raw (unnormalized) output image, including the
+ * filter weights and additional channels, is written to a side file
+ * together with the list of finished blocks. A render that was interrupted
+ * can then continue from the last snapshot by skipping those blocks.
+ *
+ * The samplers are reseeded from the pixel position in \ref Sampler::prepare(),
+ * hence their state at the start of every block is fully determined by
+ * its position, and a resumed render produces the same image as an
+ * uninterrupted one. The checkpoint only stores a description of the
+ * sampler to make sure that it was not reconfigured in the meantime.
+ *
+ * Snapshots are copied to memory while holding a lock, then serialized and
+ * written to disk by a separate thread, so rendering does not wait for them.
+ */
+class Checkpoint
+{
+public:
+    /**
+     * \brief Create a checkpoint for the output image \c result
+     *
+     * \param filename
+     *     Name of the side file
+     * \param result
+     *     Output image that the finished blocks are merged into
+     * \param description
+     *     Description of the render settings (e.g. the sampler); a
+     *     checkpoint is only resumed if it matches
+     * \param interval
+     *     Minimum time between two snapshots in seconds
+     */
+    Checkpoint(const std::string &filename, ImageBlock &result,
+               const std::string &description, float interval);
+
+    /// Wait for pending writes to finish
+    ~Checkpoint();
+
+    /**
+     * \brief Restore the output image and the list of finished blocks
+     * from the side file
+     *
+     * \return \c false if there is no side file
+     */
+    bool resume();
+
+    /// Return the number of blocks that were restored by \ref resume()
+    size_t getResumedBlockCount() const { return m_resumedBlocks; }
+
+    /// Was the block at the given offset already finished before?
+    bool isFinished(const Point2i &offset) const;
+
+    /**
+     * \brief Merge a finished block into the output image, and write
+     * a snapshot if the last one is older than the interval
+     *
+     * This function is thread-safe
+     */
+    void put(ImageBlock &block);
+
+    /// Wait for pending writes and delete the side file
+    void remove();
+
+private:
+    /// Copy the current state into \c m_snapshot (requires \c m_mutex)
+    void snapshot();
+
+    /// Serialize \c m_snapshot and write it to the side file
+    void write();
+
+    /// Body of the thread that writes the snapshots to disk
+    void writer();
+
+    std::string m_filename;
+    std::string m_description;
+    ImageBlock &m_result;
+    float m_interval;
+    size_t m_resumedBlocks = 0;
+
+    /* Offsets of the finished blocks, protected by m_mutex */
+    std::set<std::pair<int, int>> m_finished;
+    Timer m_timer;
+    mutable std::mutex m_mutex;
+
+    /* Copy of the state that is waiting to be written. It is only accessed
+       by the writer thread while m_pending is set (protected by m_writerMutex) */
+    ImageBlock m_snapshot;
+    std::set<std::pair<int, int>> m_snapshotFinished;
+    bool m_pending = false, m_shutdown = false;
+    std::mutex m_writerMutex;
+    std::condition_variable m_cond;
+    std::thread m_writer;
+};
+
+NORI_NAMESPACE_END
@@ -130,6 +130,7 @@ class Mesh;
 class NoriObject;
 class NoriObjectFactory;
 class NoriScreen;
+class NumaExecutor;
 class PhaseFunction;
 class ReconstructionFilter;
 class Sampler;
@@ -0,0 +1,122 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bitmap.h>
+#include <nori/mesh.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Per-pixel auxiliary information for denoising
+ *
+ * For every pixel, this class accumulates the albedo, shading normal and
+ * depth of the primary intersections of its samples, as well as the first
+ * two moments of the sample luminance (used to estimate the variance).
+ *
+ * All samples of a pixel are taken by the thread that renders the
+ * surrounding image block, hence no synchronization is needed.
+ */
+class FeatureBuffer
+{
+public:
+    /// Allocate an empty buffer for an image of the given size
+    FeatureBuffer(const Vector2i &size);
+
+    /// Return the size of the image
+    const Vector2i &getSize() const { return m_size; }
+
+    /**
+     * \brief Record a sample of pixel \c pixel
+     *
+     * \param value
+     *     Radiance estimate of the sample
+     * \param its
+     *     Primary intersection of the sample, or \c nullptr if
+     *     the camera ray escaped
+     */
+    void put(const Point2i &pixel, const Color3f &value, const Intersection *its);
+
+    /// Return the average albedo of a pixel
+    Color3f getAlbedo(int x, int y) const { return get(x, y).albedo / std::max(get(x, y).count, 1.f); }
+
+    /// Return the average shading normal of a pixel
+    Normal3f getNormal(int x, int y) const { return get(x, y).normal / std::max(get(x, y).count, 1.f); }
+
+    /// Return the average depth of a pixel
+    float getDepth(int x, int y) const { return get(x, y).depth / std::max(get(x, y).count, 1.f); }
+
+    /// Return the estimated variance of the pixel's mean luminance
+    float getVariance(int x, int y) const;
+
+private:
+    struct Pixel
+    {
+        Color3f albedo = Color3f(0.f);
+        Normal3f normal = Normal3f(0.f);
+        float depth = 0.f;
+        float lum = 0.f, lum2 = 0.f;
+        float count = 0.f;
+    };
+
+    const Pixel &get(int x, int y) const { return m_pixels[y * m_size.x() + x]; }
+
+    Vector2i m_size;
+    std::vector<Pixel> m_pixels;
+};
+
+/**
+ * \brief Feature-guided cross-bilateral denoiser
+ *
+ * The filter first removes the albedo from the image, so that texture
+ * detail is not blurred. Each pixel is then replaced by a weighted average
+ * of its neighbors, where the weights account for
+ *  - the spatial distance,
+ *  - the difference in (prefiltered) color relative to the estimated
+ *    variance, and
+ *  - differences in albedo, shading normal and depth.
+ *
+ * Finally, the albedo is multiplied back in.
+ */
+class Denoiser
+{
+public:
+    /// Half width of the filter window in pixels
+    int radius = 10;
+
+    /// Standard deviation of the spatial term in pixels
+    float sigmaSpatial = 6.0f;
+
+    /// Scale factor applied to the variance in the color term
+    float sigmaColor = 2.0f;
+
+    /// Standard deviation of the albedo term
+    float sigmaAlbedo = 0.1f;
+
+    /// Standard deviation of the normal term
+    float sigmaNormal = 0.2f;
+
+    /// Standard deviation of the depth term (relative to the depth)
+    float sigmaDepth = 0.02f;
+
+    /// Denoise \c image using the provided feature buffer (in parallel)
+    Bitmap *denoise(const Bitmap &image, const FeatureBuffer &features) const;
+};
+
+NORI_NAMESPACE_END
@@ -18,21 +18,55 @@
 
 #pragma once
 
-#include <nori/common.h>
+#include <nori/block.h>
 #include <nanogui/screen.h>
+#include <mutex>
 
 NORI_NAMESPACE_BEGIN
 
+class PreviewRenderer;
+
 class NoriScreen : public nanogui::Screen
 {
 public:
+    /// Create a window for images of the given size, which initially shows nothing
+    NoriScreen(const Vector2i &size);
+
+    /// Create a window that shows the given image block
     NoriScreen(const ImageBlock &block);
+
+    /**
+     * \brief Show an interactive preview
+     *
+     * Dragging with the left mouse button orbits the camera, the right
+     * button pans, and the mouse wheel moves the camera forward and back.
+     * The W/A/S/D/Q/E keys fly through the scene.
+     */
+    NoriScreen(PreviewRenderer &preview);
+
     virtual ~NoriScreen();
 
+    /**
+     * \brief Show a different image block (e.g. the next frame of an animation)
+     *
+     * This function is thread-safe. Passing \c nullptr keeps showing a copy
+     * of the current block, which may be destroyed afterwards.
+     */
+    void setBlock(const ImageBlock *block);
+
     void drawContents();
 
+    bool mouseMotionEvent(const nanogui::Vector2i &p, const nanogui::Vector2i &rel, int button, int modifiers);
+
+    bool scrollEvent(const nanogui::Vector2i &p, const nanogui::Vector2f &rel);
+
+    bool keyboardEvent(int key, int scancode, int action, int modifiers);
+
 private:
-    const ImageBlock &m_block;
+    const ImageBlock *m_block;
+    ImageBlock m_copy;
+    std::mutex m_mutex;
+    PreviewRenderer *m_preview = nullptr;
     nanogui::GLShader *m_shader = nullptr;
     nanogui::Slider *m_slider = nullptr;
     uint32_t m_texture = 0;
@@ -40,6 +40,36 @@ public:
     /// Perform an (optional) preprocess step
     virtual void preprocess(const Scene *scene) {}
 
+    /**
+     * \brief Prepare the next pass of a progressive render (optional)
+     *
+     * This is called before each pass except the first one, while no
+     * other thread uses the integrator. It can e.g. replace data that was
+     * created during \ref preprocess() with a new, independent set, or
+     * refine what was learned during the previous passes.
+     */
+    virtual void preparePass(const Scene *scene, uint32_t pass) {}
+
+    /**
+     * \brief Prepare the render of the view of \c camera (optional)
+     *
+     * This is called before the first pass, while no other thread uses
+     * the integrator. Integrators that contribute to other pixels than the
+     * one of the camera ray (e.g. by light tracing) obtain them from
+     * \c camera (see \ref Camera::project()).
+     */
+    virtual void beginRender(const Scene *scene, const Camera *camera) {}
+
+    /**
+     * \brief Finish the render of a view (optional)
+     *
+     * This is called after the last pass, while no other thread uses the
+     * integrator. It can add contributions that were not returned by
+     * \ref Li() (e.g. splatted by light tracing) to the pixels of
+     * \c result that were rendered, i.e. have a nonzero filter weight.
+     */
+    virtual void endRender(ImageBlock &result) {}
+
     /**
      * \brief Sample the incident radiance along a ray
      *
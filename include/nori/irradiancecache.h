@@ -0,0 +1,99 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <nori/color.h>
+#include <tbb/spin_rw_mutex.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Irradiance at a surface point together with its gradients
+struct IrradianceRecord
+{
+    /// Position of the record
+    Point3f p;
+    /// Surface normal at \c p
+    Normal3f n;
+    /// (Indirect) irradiance at \c p
+    Color3f E;
+    /// Validity radius (the clamped harmonic mean distance to the surrounding surfaces)
+    float R;
+    /// Rotational gradient (rows: color channels, columns: axes)
+    Eigen::Matrix3f rotGrad;
+    /// Translational gradient (rows: color channels, columns: axes)
+    Eigen::Matrix3f transGrad;
+};
+
+/**
+ * \brief Octree of irradiance records for irradiance caching
+ *
+ * A record is stored in the nodes that overlap its region of influence
+ * (i.e. the points where its error estimate is below the accuracy \c a),
+ * at the depth where the nodes are about as large as this region. A lookup
+ * thus visits the nodes along the path from the root to the point.
+ * Estimates are interpolated from the valid records using gradient-based
+ * extrapolation and the weights of Tabellion and Lamorlette (2004).
+ *
+ * Lookups and insertions may be performed by several threads at the same
+ * time (using a reader/writer lock).
+ *
+ * Reference: "Irradiance Gradients" by Greg Ward and Paul Heckbert (1992)
+ */
+class IrradianceCache
+{
+public:
+    /// Create an empty cache for (a cube around) \c bbox with the given accuracy
+    IrradianceCache(const BoundingBox3f &bbox, float accuracy);
+
+    /// Add a record (thread-safe)
+    void insert(const IrradianceRecord &record);
+
+    /**
+     * \brief Interpolate the irradiance at \c p with normal \c n from
+     * the cached records (thread-safe)
+     *
+     * \return \c false if there is no valid record, i.e. a new one must be created
+     */
+    bool interpolate(const Point3f &p, const Normal3f &n, Color3f &E) const;
+
+    /// Return the number of records
+    size_t size() const;
+
+private:
+    struct Node
+    {
+        /// Index of the child nodes (0: the child does not exist)
+        uint32_t child[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        /// Index of the records that are stored in this node
+        std::vector<uint32_t> records;
+    };
+
+    void insert(uint32_t node, const Point3f &min, float size, int depth,
+                uint32_t index, const BoundingBox3f &bounds);
+
+    float m_accuracy;
+    Point3f m_min;
+    float m_extent;
+    std::vector<Node> m_nodes;
+    std::vector<IrradianceRecord> m_records;
+    mutable tbb::spin_rw_mutex m_mutex;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,86 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <nori/common.h>
+#include <functional>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Runs parallel work separately on each NUMA node
+ *
+ * On machines with several NUMA nodes (e.g. multi-socket systems), this
+ * class creates one TBB task arena per node, whose worker threads are
+ * pinned to the CPUs of that node. Memory that is first written by the
+ * threads of an arena is then allocated in the node's local memory by
+ * the operating system, and work that is split up by node mostly
+ * accesses local memory.
+ *
+ * The topology is read from <tt>/sys/devices/system/node</tt> (Linux
+ * only). Otherwise, or when there is just a single node, a single
+ * arena without any thread pinning is used.
+ */
+class NumaExecutor
+{
+public:
+    /**
+     * \brief Create the arenas
+     *
+     * \param threadCount
+     *     Total number of threads (-1: one per CPU), which are
+     *     distributed over the nodes in proportion to their CPU count
+     * \param enable
+     *     Set to \c false to create a single arena regardless of the topology
+     */
+    NumaExecutor(int threadCount = -1, bool enable = true);
+
+    /// Release the arenas
+    ~NumaExecutor();
+
+    /// Return the number of NUMA nodes (i.e. arenas)
+    int getNodeCount() const { return (int)m_nodes.size(); }
+
+    /// Return the number of threads that work on the given node
+    int getThreadCount(int node) const;
+
+    /**
+     * \brief Call <tt>func(node)</tt> for every node within its arena
+     * and wait until all calls have finished
+     *
+     * The calls run concurrently. Parallel algorithms invoked by
+     * \c func only use the threads of the respective node.
+     */
+    void run(const std::function<void(int)> &func);
+
+    /// Return the node that the calling thread works on (0 outside of \ref run())
+    static int getCurrentNode() { return s_currentNode; }
+
+    /// Return the (usable) CPUs of every NUMA node of the machine
+    static std::vector<std::vector<int>> getTopology();
+
+private:
+    struct Node;
+    std::vector<std::unique_ptr<Node>> m_nodes;
+    static thread_local int s_currentNode;
+};
+
+NORI_NAMESPACE_END
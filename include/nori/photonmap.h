@@ -0,0 +1,122 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/color.h>
+#include <nori/vector.h>
+#include <algorithm>
+
+NORI_NAMESPACE_BEGIN
+
+/// A photon, i.e. flux that arrived at a surface point
+struct Photon
+{
+    /// Position of the photon
+    Point3f p;
+    /// Direction towards where the photon came from
+    Vector3f wi;
+    /// Flux carried by the photon
+    Color3f power;
+};
+
+/**
+ * \brief Spatial hash grid for fixed-radius photon lookups
+ *
+ * The photons are sorted by the hash of their grid cell, whose size is
+ * twice the lookup radius. The photons of a cell are thus stored next to
+ * each other, and a lookup visits the (at most 8) cells that overlap the
+ * query sphere. Building the grid is parallelized using TBB, and produces
+ * the same order of the photons regardless of the number of threads.
+ */
+class PhotonGrid
+{
+public:
+    /// Replace the contents of the grid for lookups with the given radius
+    void build(std::vector<Photon> &&photons, float radius);
+
+    /// Release all memory
+    void clear();
+
+    /// Return the number of photons
+    size_t size() const { return m_photons.size(); }
+
+    /// Return the lookup radius
+    float getRadius() const { return m_radius; }
+
+    /// Call \c func for every photon within the lookup radius of \c p
+    template <typename Func>
+    void query(const Point3f &p, const Func &func) const
+    {
+        if (m_photons.empty())
+            return;
+
+        /* The cells are twice as large as the radius, so the query covers at most two
+           of them along each axis (unless rounding in cell() claims otherwise) */
+        Point3i lo = cell(p - Vector3f(m_radius)), hi = cell(p + Vector3f(m_radius));
+        for (int i = 0; i < 3; ++i)
+            hi[i] = std::min(hi[i], lo[i] + 1);
+        uint32_t visited[8];
+        int visitedCount = 0;
+        float radius2 = m_radius * m_radius;
+
+        for (int z = lo.z(); z <= hi.z(); ++z)
+        {
+            for (int y = lo.y(); y <= hi.y(); ++y)
+            {
+                for (int x = lo.x(); x <= hi.x(); ++x)
+                {
+                    /* Different cells can share a bucket, which must be visited only once */
+                    uint32_t bucket = hash(Point3i(x, y, z));
+                    if (std::find(visited, visited + visitedCount, bucket) != visited + visitedCount)
+                        continue;
+                    visited[visitedCount++] = bucket;
+
+                    for (uint32_t i = m_bucketStart[bucket]; i < m_bucketStart[bucket + 1]; ++i)
+                    {
+                        const Photon &photon = m_photons[i];
+                        if ((photon.p - p).squaredNorm() <= radius2)
+                            func(photon);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    Point3i cell(const Point3f &p) const
+    {
+        return Point3i((int)std::floor(p.x() * m_invCellSize),
+                       (int)std::floor(p.y() * m_invCellSize),
+                       (int)std::floor(p.z() * m_invCellSize));
+    }
+
+    uint32_t hash(const Point3i &cell) const
+    {
+        return (((uint32_t)cell.x() * 73856093u) ^ ((uint32_t)cell.y() * 19349663u) ^
+                ((uint32_t)cell.z() * 83492791u)) & m_bucketMask;
+    }
+
+    float m_radius = 0.0f;
+    float m_invCellSize = 0.0f;
+    uint32_t m_bucketMask = 0;
+    std::vector<Photon> m_photons;
+    std::vector<uint32_t> m_bucketStart;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,138 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <nori/transform.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#define NORI_PREVIEW_BLOCK_SIZE 16 /* Small blocks, so that a restart does not wait long */
+#define NORI_PREVIEW_COARSE 8      /* Pixel size of the first low-resolution pass */
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Progressive renderer for interactive camera navigation
+ *
+ * A background thread renders the scene as seen by a movable copy of
+ * the camera: first a few quick low-resolution passes (one sample per
+ * 8x8, 4x4 and 2x2 pixels), followed by full-resolution passes of one
+ * sample per pixel that are accumulated until the sampler's sample count
+ * is reached. Each finished block immediately replaces the low-resolution
+ * preview in the displayed image.
+ *
+ * Moving the camera restarts this process right away: the blocks that
+ * have not been started yet are cancelled, and the ones in flight are
+ * discarded once they finish.
+ *
+ * The scene must be activated, and its integrator preprocessed.
+ */
+class PreviewRenderer
+{
+public:
+    /**
+     * \brief Start rendering the view of \c camera
+     *
+     * \param threadCount
+     *     Maximum number of threads (-1: use all cores)
+     */
+    PreviewRenderer(const Scene *scene, const Camera *camera, int threadCount = -1);
+
+    /// Stop the background thread
+    ~PreviewRenderer();
+
+    /// Return the image that is being rendered (normalized, without border)
+    const ImageBlock &getImage() const { return m_display; }
+
+    /// Rotate the camera around the point at the center of the view (offsets in pixels)
+    void orbit(const Vector2f &delta);
+
+    /// Move the camera parallel to the image plane (offsets in pixels)
+    void pan(const Vector2f &delta);
+
+    /// Move the camera towards the point at the center of the view (e.g. mouse wheel steps)
+    void dolly(float amount);
+
+    /// Move the camera along its right/up/forward axes (in steps of 2% of the scene size)
+    void fly(const Vector3f &direction);
+
+private:
+    /// World-space frame of the current view
+    struct View
+    {
+        Point3f origin;
+        Vector3f forward, right, down;
+        float pixelAngle;
+    };
+
+    /// Compute the frame of the current view by sampling rays from the camera
+    View getView() const;
+
+    /// Apply a world-space transformation to the camera and restart rendering
+    void move(const Transform &trafo);
+
+    /// Body of the background thread
+    void run();
+
+    /// Render the view of \c camera until it is finished or cancelled
+    void render(const Camera *camera, uint32_t generation);
+
+    /// Render one sample per <tt>factor x factor</tt> pixels (\c false if cancelled)
+    bool renderCoarse(const Camera *camera, int factor, uint32_t generation);
+
+    /// Render one sample per pixel (\c false if cancelled)
+    bool renderPass(const Camera *camera, uint32_t pass, uint32_t generation);
+
+    /// Trace a sample of pixel \c pixel, and return its radiance and film position
+    Color3f sample(const Camera *camera, Sampler *sampler, const Point2i &pixel,
+                   uint32_t pass, Point2f &position) const;
+
+    /// Copy the normalized accumulated pixels of a region to the displayed image
+    void updateDisplay(const Point2i &offset, const Vector2i &size);
+
+    /// Was the render of \c generation superseded by a camera move?
+    bool cancelled(uint32_t generation) const { return m_shutdown || m_generation != generation; }
+
+    const Scene *m_scene;
+    const Camera *m_baseCamera;
+    int m_threadCount;
+    Vector2i m_size;
+    float m_flyStep;
+
+    /* Accumulated full-resolution samples, and the image shown to the user */
+    ImageBlock m_accum, m_display;
+
+    /* Navigation state, only modified by the user interface thread */
+    Transform m_navigation;
+    float m_focusDistance;
+
+    /* Current camera, protected by m_mutex */
+    std::shared_ptr<const Camera> m_camera;
+    std::atomic<uint32_t> m_generation;
+    std::atomic<bool> m_shutdown;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+};
+
+NORI_NAMESPACE_END
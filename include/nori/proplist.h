@@ -33,6 +33,9 @@ class PropertyList
 public:
     PropertyList() {}
 
+    /// Check whether a property with the given name exists
+    bool has(const std::string &name) const { return m_properties.find(name) != m_properties.end(); }
+
     /// Set a boolean property
     void setBoolean(const std::string &name, const bool &value);
 
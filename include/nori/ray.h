@@ -70,6 +70,9 @@ struct TRay
         : o(ray.o), d(ray.d), dRcp(ray.dRcp),
           mint(ray.mint), maxt(ray.maxt) {}
 
+    /// Assignment operator
+    TRay &operator=(const TRay &ray) = default;
+
     /// Copy a ray, but change the covered segment of the copy
     TRay(const TRay &ray, Scalar mint, Scalar maxt)
         : o(ray.o), d(ray.d), dRcp(ray.dRcp), mint(mint), maxt(maxt) {}
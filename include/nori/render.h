@@ -0,0 +1,82 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/block.h>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+class FeatureBuffer;
+
+/// Optional outputs that are produced alongside the rendered image
+struct RenderOutputs
+{
+    /// Time (in microseconds), BVH nodes visited and triangles tested per pixel
+    Bitmap *heatmap = nullptr;
+
+    /// Primary intersections for denoising
+    FeatureBuffer *features = nullptr;
+
+    /// Store the primary-hit AOVs in the image block (see \ref aovChannels())
+    bool aovs = false;
+
+    /// Index of each mesh for the "meshID" AOV
+    std::unordered_map<const Mesh *, int> meshIDs;
+
+    /// Do any of the outputs require the primary intersection?
+    bool needsPrimaryHit() const { return features || aovs; }
+};
+
+/// Additional image block channels that store the primary-hit AOVs
+extern std::vector<ImageChannel> aovChannels();
+
+/**
+ * \brief Render the pixels of an image block as seen by \c camera
+ *
+ * Also fills in the requested additional outputs. The primary-hit AOVs
+ * and denoising features reuse the first intersection computed by the
+ * integrator, which is captured by the acceleration data structure.
+ * \c pass is the index of the progressive pass (each pass uses
+ * different random numbers).
+ */
+extern void renderBlock(const Scene *scene, const Camera *camera, Sampler *sampler, ImageBlock &block,
+                        const RenderOutputs &outputs = RenderOutputs(), uint32_t pass = 0);
+
+/**
+ * \brief Render a scene into a caller-provided buffer
+ *
+ * This is the entry point for applications that embed Nori: it runs the
+ * integrator's preprocessing step and renders all image blocks in
+ * parallel, without any user interface or file output.
+ *
+ * \param scene
+ *     Scene to be rendered, e.g. created using a \ref SceneBuilder
+ * \param rgb
+ *     Output buffer with space for <tt>3 * width * height</tt> values,
+ *     which receives the linear RGB image in row-major order
+ * \param threadCount
+ *     Maximum number of threads (-1: use all cores), which also
+ *     applies to the preprocessing step
+ * \param view
+ *     Index of the camera (see \ref Scene::getCamera())
+ */
+extern void renderImage(Scene *scene, float *rgb, int threadCount = -1, size_t view = 0);
+
+NORI_NAMESPACE_END
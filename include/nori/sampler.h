@@ -78,6 +78,21 @@ public:
      */
     virtual void prepare(const ImageBlock &block) = 0;
 
+    /**
+     * \brief Prepare to render the samples of a pixel
+     *
+     * Samplers that derive their state from the pixel position here
+     * produce the same image regardless of how it is split into blocks
+     * (e.g. when rendering a crop window, or in several processes).
+     * \c pass is the index of the progressive pass, which must produce
+     * samples that are independent of the previous passes.
+     *
+     * Every sampler must implement this: the renderer calls it for each
+     * pixel, and the progressive mode and the merging of checkpoints rely
+     * on the resulting sequences being decorrelated.
+     */
+    virtual void prepare(const Point2i &pixel, uint32_t pass) = 0;
+
     /**
      * \brief Prepare to generate new samples
      *
@@ -44,14 +44,26 @@ public:
     /// Return a pointer to the scene's kd-tree
     const Accel *getAccel() const { return m_accel; }
 
+    /// Return a pointer to the scene's kd-tree
+    Accel *getAccel() { return m_accel; }
+
     /// Return a pointer to the scene's integrator
     const Integrator *getIntegrator() const { return m_integrator; }
 
     /// Return a pointer to the scene's integrator
     Integrator *getIntegrator() { return m_integrator; }
 
-    /// Return a pointer to the scene's camera
-    const Camera *getCamera() const { return m_camera; }
+    /**
+     * \brief Return a pointer to one of the scene's cameras
+     *
+     * A scene can declare several cameras, and animated cameras are
+     * expanded into one camera per frame by \ref activate(). All views
+     * share the scene's geometry and acceleration data structure.
+     */
+    const Camera *getCamera(size_t index = 0) const { return m_cameras[index]; }
+
+    /// Return the number of cameras (i.e. frames to be rendered)
+    size_t getCameraCount() const { return m_cameras.size(); }
 
     /// Return a pointer to the scene's sample generator (const version)
     const Sampler *getSampler() const { return m_sampler; }
@@ -71,6 +83,7 @@ public:
     /// Sample emitter
     const Emitter *sampleEmitter(float rnd, float &pdf) const;
 
+    /// Probability of choosing \c em in \ref sampleEmitter()
     float pdfEmitter(const Emitter *em) const;
 
     /// Get enviromental emmiter
@@ -148,7 +161,7 @@ private:
 
     Integrator *m_integrator = nullptr;
     Sampler *m_sampler = nullptr;
-    Camera *m_camera = nullptr;
+    std::vector<Camera *> m_cameras;
     Accel *m_accel = nullptr;
 
     DiscretePDF m_emitter_pdf;
@@ -0,0 +1,186 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/bbox.h>
+#include <atomic>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/// Atomically add \c value to \c dst (lock-free, using a compare-and-swap loop)
+inline void atomicAdd(std::atomic<float> &dst, float value)
+{
+    float current = dst.load(std::memory_order_relaxed);
+    while (!dst.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+        ;
+}
+
+/**
+ * \brief Adaptive quadtree that represents a distribution over the sphere
+ * of directions (the "D-tree" of practical path guiding)
+ *
+ * Directions are mapped to the unit square with the equal-area cylindrical
+ * mapping <tt>(x, y) = ((cos(theta) + 1) / 2, phi / (2 pi))</tt>, which is
+ * then subdivided recursively into quadrants. Every node stores the
+ * energy that was recorded in each of its four quadrants. Recording only
+ * updates these sums atomically, so that many threads can record into the
+ * same tree without locks while its structure stays fixed.
+ *
+ * Reference: "Practical Path Guiding for Efficient Light-Transport
+ * Simulation" by Thomas Müller, Markus Gross and Jan Novák (2017)
+ */
+class DTree
+{
+public:
+    /// Create a tree that consists of a single node (i.e. four leaves)
+    DTree();
+
+    DTree(const DTree &other) { *this = other; }
+    DTree &operator=(const DTree &other);
+
+    /// Record the energy \c value that arrived from direction \c d (thread-safe)
+    void record(const Vector3f &d, float value);
+
+    /// Return the total recorded energy
+    float getSum() const;
+
+    /// Return the number of nodes of the quadtree
+    size_t getNodeCount() const { return m_nodes.size(); }
+
+    /// Sample a direction proportionally to the recorded energy, and return its density in \c pdf
+    Vector3f sample(Point2f sample, float &pdf) const;
+
+    /// Return the solid angle density of sampling \c d using \ref sample()
+    float pdf(const Vector3f &d) const;
+
+    /**
+     * \brief Adapt the structure of the tree to the recorded energy and
+     * clear it
+     *
+     * Quadrants that received more than the fraction \c threshold of the
+     * total energy are subdivided (by at most one level per call, and up to
+     * \c maxDepth levels), while the nodes of all other quadrants are
+     * collapsed.
+     */
+    void refine(float threshold, int maxDepth);
+
+private:
+    struct Node
+    {
+        /// Energy recorded in each quadrant
+        std::atomic<float> sum[4];
+        /// Index of the node that subdivides each quadrant (0: the quadrant is a leaf)
+        uint32_t child[4];
+
+        Node();
+        Node(const Node &other) { *this = other; }
+        Node &operator=(const Node &other);
+
+        /// Quadrant of \c p, which is then rescaled to the unit square of the quadrant
+        static int quadrant(Point2f &p);
+        /// Total energy of all quadrants
+        float getSum() const;
+    };
+
+    std::vector<Node> m_nodes;
+};
+
+/**
+ * \brief Directional distributions of a spatial region: one that is used
+ * for sampling, and one that records the energy of the current iteration
+ */
+struct DTreeWrapper
+{
+    DTree sampling;
+    DTree building;
+    std::atomic<uint32_t> sampleCount;
+
+    DTreeWrapper() : sampleCount(0) {}
+    DTreeWrapper(const DTreeWrapper &other)
+        : sampling(other.sampling), building(other.building),
+          sampleCount(other.sampleCount.load()) {}
+
+    /// Record energy arriving from direction \c d (thread-safe)
+    void record(const Vector3f &d, float value)
+    {
+        building.record(d, value);
+        sampleCount.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+/**
+ * \brief Spatio-directional tree (SD-tree) for path guiding
+ *
+ * A binary tree that subdivides the scene bounds at the midpoints of
+ * alternating axes, with a \ref DTreeWrapper in every leaf. The tree is
+ * trained in iterations: the leaves record energy while the structure is
+ * fixed, and in between iterations (while no other thread accesses the
+ * tree), leaves that received many samples are split, and the directional
+ * distributions are updated.
+ */
+class SDTree
+{
+public:
+    /// Create a tree with a single leaf that covers (a cube around) \c bbox
+    SDTree(const BoundingBox3f &bbox);
+
+    /// Return the leaf that contains \c p
+    DTreeWrapper *lookup(const Point3f &p) const;
+
+    /**
+     * \brief Finish a training iteration: use the recorded energy for
+     * sampling from now on
+     */
+    void build();
+
+    /**
+     * \brief Prepare the next training iteration
+     *
+     * Splits the leaves that recorded more than \c spatialThreshold samples
+     * and refines the directional trees (see \ref DTree::refine()).
+     */
+    void refine(uint32_t spatialThreshold, float directionalThreshold, int maxDepth);
+
+    /// Return the number of spatial leaves
+    size_t getLeafCount() const { return m_leaves.size(); }
+
+    /// Return the total number of directional quadtree nodes
+    size_t getDirectionalNodeCount() const;
+
+private:
+    struct Node
+    {
+        /// Axis along which the node is split
+        int axis;
+        /// Index of the two children (if this is an interior node)
+        uint32_t child[2];
+        /// Index of the leaf in \ref m_leaves (-1: interior node)
+        int leaf;
+    };
+
+    void split(uint32_t index, uint32_t threshold);
+
+    Point3f m_min;
+    float m_extent;
+    std::vector<Node> m_nodes;
+    std::vector<std::unique_ptr<DTreeWrapper>> m_leaves;
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,117 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* =======================================================================
+     This file contains a lightweight facility for gathering statistics
+     (ray counts, traversal costs, ..) during rendering. It is enabled
+     by defining NORI_ENABLE_STATS; otherwise, all of it compiles away.
+ * ======================================================================= */
+
+#pragma once
+
+#include <nori/common.h>
+
+/// Maximum number of distinct statistics counters
+#define NORI_STATS_MAX_COUNTERS 128
+
+NORI_NAMESPACE_BEGIN
+
+#if defined(NORI_ENABLE_STATS)
+
+/**
+ * \brief Registry of all statistics counters
+ *
+ * Every thread that increments a counter owns a private array of values,
+ * hence counting never requires synchronization. The per-thread values
+ * are only merged when a summary is requested.
+ */
+class Statistics
+{
+public:
+    /// Register a new counter and return its index
+    static int registerCounter(const std::string &category, const std::string &name);
+
+    /// Return the counter values of the calling thread
+    static uint64_t *threadValues()
+    {
+        static thread_local uint64_t *values = nullptr;
+        if (!values)
+            values = registerThread();
+        return values;
+    }
+
+    /// Reset all counters of all threads to zero
+    static void reset();
+
+    /// Return a human-readable summary of all nonzero counters
+    static std::string toString();
+
+private:
+    /// Allocate the counter values of the calling thread
+    static uint64_t *registerThread();
+};
+
+/**
+ * \brief Named event counter, declared via \ref NORI_STAT_COUNTER
+ *
+ * Counters are grouped by category in the summary that is
+ * produced by \ref Statistics::toString().
+ */
+class StatsCounter
+{
+public:
+    StatsCounter(const std::string &category, const std::string &name)
+        : m_index(Statistics::registerCounter(category, name)) {}
+
+    /// Add \c amount to the calling thread's value of this counter
+    void increment(uint64_t amount = 1) const
+    {
+        Statistics::threadValues()[m_index] += amount;
+    }
+
+private:
+    int m_index;
+};
+
+/// Declare a file-scope statistics counter
+#define NORI_STAT_COUNTER(var, category, name) \
+    static nori::StatsCounter var(category, name)
+
+/// Increment a statistics counter by one
+#define NORI_STAT_INC(var) (var).increment()
+
+/// Increment a statistics counter by \c amount
+#define NORI_STAT_ADD(var, amount) (var).increment(amount)
+
+#else
+
+/* Statistics are disabled -- provide empty stubs */
+class Statistics
+{
+public:
+    static void reset() {}
+    static std::string toString() { return ""; }
+};
+
+#define NORI_STAT_COUNTER(var, category, name) static_assert(true, "")
+#define NORI_STAT_INC(var) do { } while (0)
+#define NORI_STAT_ADD(var, amount) do { } while (0)
+
+#endif
+
+NORI_NAMESPACE_END
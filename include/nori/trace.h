@@ -0,0 +1,98 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Timeline of rendering phases and image blocks
+ *
+ * When enabled, this class records the start/end time and thread of
+ * selected events (scene loading, BVH construction, rendering of each
+ * image block, ..) and writes them to a JSON file using the Chrome
+ * trace event format. The result can be inspected using
+ * <tt>chrome://tracing</tt> or https://ui.perfetto.dev.
+ *
+ * Recording is disabled by default, in which case all functions
+ * return immediately.
+ */
+class Trace
+{
+public:
+    /// Start recording events
+    static void enable() { s_enabled = true; }
+
+    /// Are events currently being recorded?
+    static bool isEnabled() { return s_enabled; }
+
+    /// Return the time in microseconds since the process was started
+    static double now();
+
+    /**
+     * \brief Record an event that lasted from \c start to \c end
+     *
+     * \param name
+     *     Name of the event
+     * \param category
+     *     Category of the event (e.g. "phase" or "block")
+     * \param start
+     *     Start time as returned by \ref now()
+     * \param end
+     *     End time as returned by \ref now()
+     * \param args
+     *     Optional JSON object with further information about the event
+     */
+    static void addEvent(const std::string &name, const std::string &category,
+                         double start, double end, const std::string &args = "");
+
+    /// Write all recorded events to a Chrome trace JSON file
+    static void write(const std::string &filename);
+
+private:
+    static bool s_enabled;
+};
+
+/**
+ * \brief Records the lifetime of this object as a \ref Trace event
+ *
+ * Does nothing unless \ref Trace::enable() was called.
+ */
+class TraceScope
+{
+public:
+    TraceScope(const std::string &name, const std::string &category = "phase")
+        : m_name(name), m_category(category), m_start(Trace::isEnabled() ? Trace::now() : 0) {}
+
+    ~TraceScope()
+    {
+        if (Trace::isEnabled())
+            Trace::addEvent(m_name, m_category, m_start, Trace::now(), m_args);
+    }
+
+    /// Attach further information (a JSON object) to the event
+    void setArgs(const std::string &args) { m_args = args; }
+
+private:
+    std::string m_name, m_category, m_args;
+    double m_start;
+};
+
+NORI_NAMESPACE_END
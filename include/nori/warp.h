@@ -21,6 +21,8 @@
 #include <nori/common.h>
 #include <nori/sampler.h>
 
+#define NORI_WARP_BATCH_SIZE 8 /* Samples per SIMD block of the batch warping functions */
+
 NORI_NAMESPACE_BEGIN
 
 /// A collection of useful warping functions for importance sampling
@@ -74,6 +76,29 @@ public:
 
     /// Probability density of \ref squareToBeckmann()
     static float squareToBeckmannPdf(const Vector3f &m, float alpha);
+
+    /**
+     * \brief Batch versions of the warping functions above
+     *
+     * These transform \c count samples at once. Internally, the samples are
+     * processed in blocks of \ref NORI_WARP_BATCH_SIZE in SoA layout so that
+     * the transcendental functions are evaluated with Eigen's SIMD packet
+     * approximations. The results agree with the scalar versions up to
+     * rounding. \c samples and \c result must not overlap.
+     */
+    static void squareToUniformDisk(const Point2f *samples, Point2f *result, size_t count);
+
+    /// Batch version of \ref squareToUniformSphere()
+    static void squareToUniformSphere(const Point2f *samples, Vector3f *result, size_t count);
+
+    /// Batch version of \ref squareToUniformHemisphere()
+    static void squareToUniformHemisphere(const Point2f *samples, Vector3f *result, size_t count);
+
+    /// Batch version of \ref squareToCosineHemisphere()
+    static void squareToCosineHemisphere(const Point2f *samples, Vector3f *result, size_t count);
+
+    /// Batch version of \ref squareToBeckmann()
+    static void squareToBeckmann(const Point2f *samples, Vector3f *result, size_t count, float alpha);
 };
 
 NORI_NAMESPACE_END
@@ -18,12 +18,21 @@
 
 #include <nori/accel.h>
 #include <nori/timer.h>
+#include <nori/stats.h>
+#include <nori/trace.h>
+#include <nori/warp.h>
+#include <nori/numa.h>
+#include <pcg32.h>
 #include <tbb/tbb.h>
 #include <Eigen/Geometry>
 #include <atomic>
 
 NORI_NAMESPACE_BEGIN
 
+NORI_STAT_COUNTER(statsRays, "Rays", "Total (all queries)");
+NORI_STAT_COUNTER(statsNodesVisited, "Acceleration structure", "BVH nodes visited");
+NORI_STAT_COUNTER(statsTrianglesTested, "Acceleration structure", "Triangles tested");
+
 /* Bin data structure for counting triangles and computing their bounding box */
 struct Bins
 {
@@ -31,6 +40,12 @@ struct Bins
 	Bins() { memset(counts, 0, sizeof(n_UINT) * BIN_COUNT); }
 	n_UINT counts[BIN_COUNT];
 	BoundingBox3f bbox[BIN_COUNT];
+
+	/// Return the bin of a centroid coordinate, given the binned interval
+	static int index(float centroid, float min, float inv_bin_size)
+	{
+		return std::min(std::max((int)((centroid - min) * inv_bin_size), 0), BIN_COUNT - 1);
+	}
 };
 
 /**
@@ -46,7 +61,10 @@ struct Bins
 class BVHBuildTask : public tbb::task
 {
 private:
+	typedef Accel::BVHPrimitive BVHPrimitive;
+
 	Accel &bvh;
+	const BVHPrimitive *prims;
 	n_UINT node_idx;
 	n_UINT *start, *end, *temp;
 
@@ -58,13 +76,7 @@ public:
 		SERIAL_THRESHOLD = 32,
 
 		/// Process triangles in batches of 1K for the purpose of parallelization
-		GRAIN_SIZE = 1000,
-
-		/// Heuristic cost value for traversal operations
-		TRAVERSAL_COST = 1,
-
-		/// Heuristic cost value for intersection operations
-		INTERSECTION_COST = 1
+		GRAIN_SIZE = 1000
 	};
 
 public:
@@ -74,6 +86,9 @@ public:
 	 * \param bvh
 	 *    Reference to the underlying BVH
 	 *
+	 * \param prims
+	 *    Precomputed bounding boxes of all triangles
+	 *
 	 * \param node_idx
 	 *    Index of the BVH node that should be built
 	 *
@@ -88,8 +103,9 @@ public:
 	 *    construction purposes. The usable length is <tt>end-start</tt>
 	 *    unsigned integers.
 	 */
-	BVHBuildTask(Accel &bvh, n_UINT node_idx, n_UINT *start, n_UINT *end, n_UINT *temp)
-		: bvh(bvh), node_idx(node_idx), start(start), end(end), temp(temp) {}
+	BVHBuildTask(Accel &bvh, const BVHPrimitive *prims, n_UINT node_idx,
+				 n_UINT *start, n_UINT *end, n_UINT *temp)
+		: bvh(bvh), prims(prims), node_idx(node_idx), start(start), end(end), temp(temp) {}
 
 	task *execute()
 	{
@@ -99,7 +115,7 @@ public:
 		/* Switch to a serial build when less than SERIAL_THRESHOLD triangles are left */
 		if (size < SERIAL_THRESHOLD)
 		{
-			execute_serially(bvh, node_idx, start, end, temp);
+			execute_serially(bvh, prims, node_idx, start, end);
 			return nullptr;
 		}
 
@@ -117,15 +133,10 @@ public:
 			{
 				for (n_UINT i = range.begin(); i != range.end(); ++i)
 				{
-					n_UINT f = start[i];
-					float centroid = bvh.getCentroid(f)[axis];
-
-					int index = std::min(std::max(
-											 (int)((centroid - min) * inv_bin_size), 0),
-										 (Bins::BIN_COUNT - 1));
-
+					const BVHPrimitive &prim = prims[start[i]];
+					int index = Bins::index(prim.centroid(axis), min, inv_bin_size);
 					result.counts[index]++;
-					result.bbox[index].expandBy(bvh.getBoundingBox(f));
+					result.bbox[index].expandBy(prim.bbox);
 				}
 				return result;
 			},
@@ -142,54 +153,24 @@ public:
 			});
 
 		/* Choose the best split plane based on the binned data */
-		BoundingBox3f bbox_left[Bins::BIN_COUNT];
-		bbox_left[0] = bins.bbox[0];
-		for (int i = 1; i < Bins::BIN_COUNT; ++i)
-		{
-			bins.counts[i] += bins.counts[i - 1];
-			bbox_left[i] = BoundingBox3f::merge(bbox_left[i - 1], bins.bbox[i]);
-		}
-
-		BoundingBox3f bbox_right = bins.bbox[Bins::BIN_COUNT - 1], best_bbox_right;
-		int64_t best_index = -1;
-		float best_cost = (float)INTERSECTION_COST * size;
-		float tri_factor = (float)INTERSECTION_COST / node.bbox.getSurfaceArea();
-
-		for (int i = Bins::BIN_COUNT - 2; i >= 0; --i)
-		{
-			n_UINT prims_left = bins.counts[i], prims_right = (n_UINT)(end - start) - bins.counts[i];
-			float sah_cost = 2.0f * TRAVERSAL_COST +
-							 tri_factor * (prims_left * bbox_left[i].getSurfaceArea() +
-										   prims_right * bbox_right.getSurfaceArea());
-			if (sah_cost < best_cost)
-			{
-				best_cost = sah_cost;
-				best_index = i;
-				best_bbox_right = bbox_right;
-			}
-			bbox_right = BoundingBox3f::merge(bbox_right, bins.bbox[i]);
-		}
+		float best_cost = (float)Accel::INTERSECTION_COST * size;
+		BoundingBox3f best_bbox_left, best_bbox_right;
+		int best_index = findSplit(bins, node.bbox, size, best_cost, best_bbox_left, best_bbox_right);
 
 		if (best_index == -1)
 		{
 			/* Could not find a good split plane -- retry with
 			   more careful serial code just to be sure.. */
-			execute_serially(bvh, node_idx, start, end, temp);
+			execute_serially(bvh, prims, node_idx, start, end);
 			return nullptr;
 		}
 
 		n_UINT left_count = bins.counts[best_index];
-		int node_idx_left = node_idx + 1;
-		int node_idx_right = node_idx + 2 * left_count;
-
-		bvh.m_nodes[node_idx_left].bbox = bbox_left[best_index];
-		bvh.m_nodes[node_idx_right].bbox = best_bbox_right;
-		node.inner.rightChild = node_idx_right;
-		node.inner.axis = axis;
-		node.inner.flag = 0;
+		n_UINT node_idx_left = split(bvh, node, axis, best_bbox_left, best_bbox_right);
+		n_UINT node_idx_right = node_idx_left + 1;
 
 		std::atomic<n_UINT> offset_left(0),
-			offset_right(bins.counts[best_index]);
+			offset_right(left_count);
 
 		tbb::parallel_for(
 			tbb::blocked_range<n_UINT>(0u, size, GRAIN_SIZE),
@@ -198,9 +179,7 @@ public:
 				n_UINT count_left = 0, count_right = 0;
 				for (n_UINT i = range.begin(); i != range.end(); ++i)
 				{
-					n_UINT f = start[i];
-					float centroid = bvh.getCentroid(f)[axis];
-					int index = (int)((centroid - min) * inv_bin_size);
+					int index = Bins::index(prims[start[i]].centroid(axis), min, inv_bin_size);
 					(index <= best_index ? count_left : count_right)++;
 				}
 				n_UINT idx_l = offset_left.fetch_add(count_left);
@@ -208,8 +187,7 @@ public:
 				for (n_UINT i = range.begin(); i != range.end(); ++i)
 				{
 					n_UINT f = start[i];
-					float centroid = bvh.getCentroid(f)[axis];
-					int index = (int)((centroid - min) * inv_bin_size);
+					int index = Bins::index(prims[f].centroid(axis), min, inv_bin_size);
 					if (index <= best_index)
 						temp[idx_l++] = f;
 					else
@@ -225,7 +203,7 @@ public:
 
 		/* Post right subtree to scheduler */
 		BVHBuildTask &b = *new (c.allocate_child())
-							  BVHBuildTask(bvh, node_idx_right, start + left_count,
+							  BVHBuildTask(bvh, prims, node_idx_right, start + left_count,
 										   end, temp + left_count);
 		spawn(b);
 
@@ -238,55 +216,41 @@ public:
 	}
 
 	/// Single-threaded build function
-	static void execute_serially(Accel &bvh, n_UINT node_idx, n_UINT *start, n_UINT *end, n_UINT *temp)
+	static void execute_serially(Accel &bvh, const BVHPrimitive *prims, n_UINT node_idx,
+								 n_UINT *start, n_UINT *end)
 	{
 		Accel::BVHNode &node = bvh.m_nodes[node_idx];
 		n_UINT size = (n_UINT)(end - start);
-		float best_cost = (float)INTERSECTION_COST * size;
-		int64_t best_index = -1, best_axis = -1;
-		float *left_areas = (float *)temp;
+		float best_cost = (float)Accel::INTERSECTION_COST * size;
+		int best_index = -1, best_axis = -1;
+		BoundingBox3f best_bbox_left, best_bbox_right;
+
+		BoundingBox3f centroids;
+		for (n_UINT *i = start; i != end; ++i)
+			centroids.expandBy(prims[*i].bbox.getCenter());
 
-		/* Try splitting along every axis */
+		/* Bin the triangles along every axis, and sweep over the bins */
 		for (int axis = 0; axis < 3; ++axis)
 		{
-			/* Sort all triangles based on their centroid positions projected on the axis */
-			std::sort(start, end, [&](n_UINT f1, n_UINT f2)
-					  { return bvh.getCentroid(f1)[axis] < bvh.getCentroid(f2)[axis]; });
+			float min = centroids.min[axis], max = centroids.max[axis];
+			if (!(max > min))
+				continue;
+			float inv_bin_size = Bins::BIN_COUNT / (max - min);
 
-			BoundingBox3f bbox;
-			for (n_UINT i = 0; i < size; ++i)
+			Bins bins;
+			for (n_UINT *i = start; i != end; ++i)
 			{
-				n_UINT f = *(start + i);
-				bbox.expandBy(bvh.getBoundingBox(f));
-				left_areas[i] = (float)bbox.getSurfaceArea();
+				const BVHPrimitive &prim = prims[*i];
+				int index = Bins::index(prim.centroid(axis), min, inv_bin_size);
+				bins.counts[index]++;
+				bins.bbox[index].expandBy(prim.bbox);
 			}
-			if (axis == 0)
-				node.bbox = bbox;
 
-			bbox.reset();
-
-			/* Choose the best split plane */
-			float tri_factor = INTERSECTION_COST / node.bbox.getSurfaceArea();
-			for (n_UINT i = size - 1; i >= 1; --i)
+			int index = findSplit(bins, node.bbox, size, best_cost, best_bbox_left, best_bbox_right);
+			if (index != -1)
 			{
-				n_UINT f = *(start + i);
-				bbox.expandBy(bvh.getBoundingBox(f));
-
-				float left_area = left_areas[i - 1];
-				float right_area = bbox.getSurfaceArea();
-				n_UINT prims_left = i;
-				n_UINT prims_right = size - i;
-
-				float sah_cost = 2.0f * TRAVERSAL_COST +
-								 tri_factor * (prims_left * left_area +
-											   prims_right * right_area);
-
-				if (sah_cost < best_cost)
-				{
-					best_cost = sah_cost;
-					best_index = i;
-					best_axis = axis;
-				}
+				best_index = index;
+				best_axis = axis;
 			}
 		}
 
@@ -299,18 +263,73 @@ public:
 			return;
 		}
 
-		std::sort(start, end, [&](n_UINT f1, n_UINT f2)
-				  { return bvh.getCentroid(f1)[best_axis] < bvh.getCentroid(f2)[best_axis]; });
+		float min = centroids.min[best_axis],
+			  inv_bin_size = Bins::BIN_COUNT / (centroids.max[best_axis] - min);
+		n_UINT *middle = std::partition(start, end, [&](n_UINT f)
+										{ return Bins::index(prims[f].centroid(best_axis), min, inv_bin_size) <= best_index; });
 
-		n_UINT left_count = (n_UINT)best_index;
-		n_UINT node_idx_left = node_idx + 1;
-		n_UINT node_idx_right = node_idx + 2 * left_count;
-		node.inner.rightChild = node_idx_right;
-		node.inner.axis = best_axis;
-		node.inner.flag = 0;
+		n_UINT node_idx_left = split(bvh, node, best_axis, best_bbox_left, best_bbox_right);
+		execute_serially(bvh, prims, node_idx_left, start, middle);
+		execute_serially(bvh, prims, node_idx_left + 1, middle, end);
+	}
+
+	/**
+	 * \brief Find the split between two bins with the lowest SAH cost
+	 *
+	 * Only splits that are cheaper than \c best_cost are considered, in
+	 * which case \c best_cost and the child bounding boxes are updated.
+	 *
+	 * \return The last bin of the left child, or -1 if no split was found
+	 */
+	static int findSplit(Bins &bins, const BoundingBox3f &bbox, n_UINT size, float &best_cost,
+						 BoundingBox3f &best_bbox_left, BoundingBox3f &best_bbox_right)
+	{
+		BoundingBox3f bbox_left[Bins::BIN_COUNT];
+		bbox_left[0] = bins.bbox[0];
+		for (int i = 1; i < Bins::BIN_COUNT; ++i)
+		{
+			bins.counts[i] += bins.counts[i - 1];
+			bbox_left[i] = BoundingBox3f::merge(bbox_left[i - 1], bins.bbox[i]);
+		}
+
+		BoundingBox3f bbox_right = bins.bbox[Bins::BIN_COUNT - 1];
+		int best_index = -1;
+		float tri_factor = (float)Accel::INTERSECTION_COST / bbox.getSurfaceArea();
+
+		for (int i = Bins::BIN_COUNT - 2; i >= 0; --i)
+		{
+			n_UINT prims_left = bins.counts[i], prims_right = size - bins.counts[i];
+			if (prims_left > 0 && prims_right > 0)
+			{
+				float sah_cost = 2.0f * Accel::TRAVERSAL_COST +
+								 tri_factor * (prims_left * bbox_left[i].getSurfaceArea() +
+											   prims_right * bbox_right.getSurfaceArea());
+				if (sah_cost < best_cost)
+				{
+					best_cost = sah_cost;
+					best_index = i;
+					best_bbox_left = bbox_left[i];
+					best_bbox_right = bbox_right;
+				}
+			}
+			bbox_right = BoundingBox3f::merge(bbox_right, bins.bbox[i]);
+		}
+
+		return best_index;
+	}
 
-		execute_serially(bvh, node_idx_left, start, start + left_count, temp);
-		execute_serially(bvh, node_idx_right, start + left_count, end, temp + left_count);
+	/// Turn \c node into an inner node, allocate its two children and return the index of the left one
+	static n_UINT split(Accel &bvh, Accel::BVHNode &node, int axis,
+						const BoundingBox3f &bbox_left, const BoundingBox3f &bbox_right)
+	{
+		auto children = bvh.m_nodes.grow_by(2);
+		children[0].bbox = bbox_left;
+		children[1].bbox = bbox_right;
+
+		node.inner.children = (n_UINT)(children - bvh.m_nodes.begin());
+		node.inner.axis = axis;
+		node.inner.flag = 0;
+		return node.inner.children;
 	}
 };
 
@@ -329,71 +348,318 @@ void Accel::clear()
 	m_meshOffset.clear();
 	m_meshOffset.push_back(0u);
 	m_nodes.clear();
+	m_wideNodes.clear();
 	m_indices.clear();
+	m_replicas.clear();
 	m_bbox.reset();
 	m_nodes.shrink_to_fit();
+	m_wideNodes.shrink_to_fit();
 	m_meshes.shrink_to_fit();
 	m_meshOffset.shrink_to_fit();
 	m_indices.shrink_to_fit();
 }
 
+std::string Accel::getBuilderName(EBuilder builder)
+{
+	switch (builder)
+	{
+	case ESAH:
+		return "sah";
+	case ELBVH:
+		return "lbvh";
+	case EHLBVH:
+		return "hlbvh";
+	default:
+		return "<unknown>";
+	}
+}
+
+Accel::EBuilder Accel::parseBuilder(const std::string &name)
+{
+	for (EBuilder builder : {ESAH, ELBVH, EHLBVH})
+	{
+		if (getBuilderName(builder) == name)
+			return builder;
+	}
+	throw NoriException("Unknown BVH builder \"%s\" (expected \"sah\", \"lbvh\" or \"hlbvh\")!", name);
+}
+
 void Accel::build()
 {
 	n_UINT size = getTriangleCount();
 	if (size == 0)
 		return;
-	cout << "Constructing a SAH BVH (" << m_meshes.size()
+	TraceScope trace("BVH construction");
+	trace.setArgs(tfm::format("{\"triangles\": %i}", size));
+
+	cout << "Constructing a BVH (" << getBuilderName(m_builder) << " builder, " << m_meshes.size()
 		 << (m_meshes.size() == 1 ? " mesh, " : " meshes, ")
 		 << size << " triangles) .. ";
 	cout.flush();
 	Timer timer;
 
-	/* Conservative estimate for the total number of nodes */
-	m_nodes.resize(2 * size);
-	memset(m_nodes.data(), 0, sizeof(BVHNode) * m_nodes.size());
-	m_nodes[0].bbox = m_bbox;
+	if ((sizeof(n_UINT) == 4) && (sizeof(BVHNode) != 32 || sizeof(WideBVHNode) != 64))
+		throw NoriException("BVH Node is not packed! Investigate compiler settings.");
+
+	m_replicas.clear();
+
+	/* Look up the bounding box of every triangle once, instead of going
+	   through findMesh() and the vertex buffers whenever the build needs it */
+	std::vector<BVHPrimitive> prims(size);
+	tbb::parallel_for(tbb::blocked_range<n_UINT>(0u, size, BVHBuildTask::GRAIN_SIZE),
+					  [&](const tbb::blocked_range<n_UINT> &range)
+					  {
+						  n_UINT idx = range.begin(), meshIdx = findMesh(idx);
+						  for (n_UINT i = range.begin(); i != range.end(); ++i, ++idx)
+						  {
+							  while (idx >= m_meshes[meshIdx]->getTriangleCount())
+							  {
+								  idx = 0;
+								  meshIdx++;
+							  }
+							  prims[i].bbox = m_meshes[meshIdx]->getBoundingBox(idx);
+						  }
+					  });
+
+	/* Nodes are allocated in pairs of siblings while the build proceeds. The
+	   pool grows in segments that never move, hence no upper bound on the
+	   node count needs to be reserved, and no compaction step is needed */
+	m_nodes.clear();
+	m_nodes.grow_by(1)->bbox = m_bbox;
 	m_indices.resize(size);
 
-	cout << "Size of each node is " << sizeof(BVHNode);
+	if (m_builder == ESAH)
+	{
+		for (n_UINT i = 0; i < size; ++i)
+			m_indices[i] = i;
+
+		n_UINT *indices = m_indices.data(), *temp = new n_UINT[size];
+		BVHBuildTask &task = *new (tbb::task::allocate_root())
+								 BVHBuildTask(*this, prims.data(), 0u, indices, indices + size, temp);
+		tbb::task::spawn_root_and_wait(task);
+		delete[] temp;
+	}
+	else
+	{
+		buildLBVH(prims, m_builder == EHLBVH);
+	}
+	prims.clear();
+	prims.shrink_to_fit();
+	std::pair<float, n_UINT> stats = statistics();
+	m_sahCost = stats.first;
 
-	if ((sizeof(n_UINT) == 4) && (sizeof(BVHNode) != 32))
-		throw NoriException("BVH Node is not packed! Investigate compiler settings.");
+	/* Collapse the binary tree into compressed 4-wide nodes */
+	m_wideNodes.clear();
+	m_wideNodes.reserve(stats.second / 3 + 1);
+	int stackSize;
+	collapse(0u, stackSize);
+	m_wideNodes.shrink_to_fit();
+	if (stackSize > STACK_SIZE)
+		throw NoriException("Accel::build(): the BVH is too deep for the traversal stack (%i entries needed)!",
+							stackSize);
 
-	for (n_UINT i = 0; i < size; ++i)
-		m_indices[i] = i;
+	size_t binaryMemory = sizeof(BVHNode) * stats.second,
+		   wideMemory = sizeof(WideBVHNode) * m_wideNodes.size();
 
-	n_UINT *indices = m_indices.data(), *temp = new n_UINT[size];
-	BVHBuildTask &task = *new (tbb::task::allocate_root())
-							 BVHBuildTask(*this, 0u, indices, indices + size, temp);
-	tbb::task::spawn_root_and_wait(task);
-	delete[] temp;
-	std::pair<float, n_UINT> stats = statistics();
+	cout << "done (took " << timer.elapsedString() << " and "
+		 << memString(wideMemory + sizeof(n_UINT) * m_indices.size())
+		 << ", SAH cost = " << stats.first
+		 << ")." << endl;
+
+	cout << tfm::format("Compressed 4-wide BVH: %i nodes of %i B = %s (binary: %i nodes of %i B = %s, %.1fx smaller)",
+						m_wideNodes.size(), sizeof(WideBVHNode), memString(wideMemory),
+						stats.second, sizeof(BVHNode), memString(binaryMemory),
+						(double)binaryMemory / wideMemory)
+		 << endl;
+
+	if (m_compareFormats)
+	{
+		double wideRate = measureRayRate(false), binaryRate = measureRayRate(true);
+		cout << tfm::format("Traversal: %.2f Mrays/s (binary: %.2f Mrays/s, %.2fx)",
+							wideRate * 1e-6, binaryRate * 1e-6, wideRate / binaryRate)
+			 << endl;
+	}
+
+	m_nodes.clear();
+	m_nodes.shrink_to_fit();
+}
+
+void Accel::distribute(NumaExecutor &executor)
+{
+	m_replicas.clear();
+	if (executor.getNodeCount() < 2 || m_wideNodes.empty())
+		return;
 
-	/* The node array was allocated conservatively and now contains
-	   many unused entries -- do a compactification pass. */
-	std::vector<BVHNode> compactified(stats.second);
-	std::vector<n_UINT> skipped_accum(m_nodes.size());
+	/* Each copy is written by a thread of its node, which makes the
+	   operating system allocate it in that node's memory */
+	m_replicas.resize(executor.getNodeCount());
+	executor.run([&](int node)
+				 {
+					 m_replicas[node].first = m_wideNodes;
+					 m_replicas[node].second = m_indices;
+				 });
+
+	cout << "Replicated the BVH on " << m_replicas.size() << " NUMA nodes ("
+		 << memString(m_replicas.size() * (sizeof(WideBVHNode) * m_wideNodes.size() +
+										   sizeof(n_UINT) * m_indices.size()))
+		 << ")" << endl;
+}
+
+n_UINT Accel::collapse(n_UINT node_idx, int &stackSize)
+{
+	/* Gather up to four children by repeatedly opening the
+	   inner child with the largest surface area */
+	n_UINT children[4];
+	int childCount = 0;
+	if (m_nodes[node_idx].isLeaf())
+	{
+		/* Only happens at the root of a tiny BVH */
+		children[childCount++] = node_idx;
+	}
+	else
+	{
+		children[childCount++] = m_nodes[node_idx].inner.children;
+		children[childCount++] = m_nodes[node_idx].inner.children + 1;
+	}
 
-	for (int64_t i = stats.second - 1, j = m_nodes.size(), skipped = 0; i >= 0; --i)
+	while (childCount < 4)
 	{
-		while (m_nodes[--j].isUnused())
-			skipped++;
-		BVHNode &new_node = compactified[i];
-		new_node = m_nodes[j];
-		skipped_accum[j] = (n_UINT)skipped;
+		int best = -1;
+		float bestArea = -1;
+		for (int i = 0; i < childCount; ++i)
+		{
+			const BVHNode &child = m_nodes[children[i]];
+			if (child.isInner() && child.bbox.getSurfaceArea() > bestArea)
+			{
+				best = i;
+				bestArea = child.bbox.getSurfaceArea();
+			}
+		}
+		if (best == -1)
+			break;
+		n_UINT opened = children[best];
+		children[best] = m_nodes[opened].inner.children;
+		children[childCount++] = m_nodes[opened].inner.children + 1;
+	}
 
-		if (new_node.isInner())
+	/* Leaves store their triangle count in 16 bits. Larger ones (e.g. made
+	   of overlapping triangles that the builder could not separate) are
+	   split into two halves with the same bounding box, recursively */
+	for (int i = 0; i < childCount; ++i)
+	{
+		BVHNode &child = m_nodes[children[i]];
+		if (child.isLeaf() && child.leaf.size > 0xFFFF)
 		{
-			new_node.inner.rightChild = (n_UINT)(i + new_node.inner.rightChild - j -
-												 (skipped - skipped_accum[new_node.inner.rightChild]));
+			n_UINT start = child.start(), size = child.leaf.size;
+			auto halves = m_nodes.grow_by(2);
+			for (int j = 0; j < 2; ++j)
+			{
+				halves[j].bbox = child.bbox;
+				halves[j].leaf.flag = 1;
+				halves[j].leaf.start = start + j * (size / 2);
+				halves[j].leaf.size = j == 0 ? size / 2 : size - size / 2;
+			}
+			child.inner.children = (n_UINT)(halves - m_nodes.begin());
+			child.inner.axis = 0;
+			child.inner.flag = 0;
 		}
 	}
-	cout << "done (took " << timer.elapsedString() << " and "
-		 << memString(sizeof(BVHNode) * m_nodes.size() + sizeof(n_UINT) * m_indices.size())
-		 << ", SAH cost = " << stats.first
-		 << ")." << endl;
 
-	m_nodes = std::move(compactified);
+	/* Quantize the child bounding boxes relative to their union */
+	BoundingBox3f bounds;
+	for (int i = 0; i < childCount; ++i)
+		bounds.expandBy(m_nodes[children[i]].bbox);
+
+	WideBVHNode node;
+	memset(&node, 0, sizeof(WideBVHNode));
+	node.childCount = (uint8_t)childCount;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float extent = bounds.max[axis] - bounds.min[axis];
+		int exponent = extent > 0 ? (int)std::ceil(std::log2(extent / 255.0f)) : -126;
+		node.origin[axis] = bounds.min[axis];
+		node.exponent[axis] = (int8_t)std::min(std::max(exponent, -126), 127);
+
+		/* Make sure that the grid covers the node despite rounding errors */
+		while (node.exponent[axis] < 127 &&
+			   node.decode(axis, 255, node.scale(axis)) < bounds.max[axis])
+			node.exponent[axis]++;
+
+		float scale = node.scale(axis);
+		for (int i = 0; i < childCount; ++i)
+		{
+			const BoundingBox3f &bbox = m_nodes[children[i]].bbox;
+			int lower = (int)std::floor((bbox.min[axis] - node.origin[axis]) / scale),
+				upper = (int)std::ceil((bbox.max[axis] - node.origin[axis]) / scale);
+			lower = std::min(std::max(lower, 0), 255);
+			upper = std::min(std::max(upper, lower), 255);
+
+			/* Round outwards, such that the decoded box contains the exact one */
+			while (lower > 0 && node.decode(axis, (uint8_t)lower, scale) > bbox.min[axis])
+				lower--;
+			while (upper < 255 && node.decode(axis, (uint8_t)upper, scale) < bbox.max[axis])
+				upper++;
+			node.lower[axis][i] = (uint8_t)lower;
+			node.upper[axis][i] = (uint8_t)upper;
+		}
+	}
+
+	n_UINT wide_idx = (n_UINT)m_wideNodes.size();
+	m_wideNodes.push_back(node);
+
+	/* The traversal pushes all inner children, and visits each of
+	   them while (at most) the other ones are still on the stack */
+	int innerCount = 0;
+	for (int i = 0; i < childCount; ++i)
+		if (m_nodes[children[i]].isInner())
+			innerCount++;
+	stackSize = innerCount;
+
+	for (int i = 0; i < childCount; ++i)
+	{
+		const BVHNode &child = m_nodes[children[i]];
+		if (child.isLeaf())
+		{
+			m_wideNodes[wide_idx].child[i] = child.start();
+			m_wideNodes[wide_idx].leafSize[i] = (uint16_t)child.leaf.size;
+		}
+		else
+		{
+			int childStackSize;
+			n_UINT child_idx = collapse(children[i], childStackSize);
+			m_wideNodes[wide_idx].child[i] = child_idx;
+			stackSize = std::max(stackSize, innerCount - 1 + childStackSize);
+		}
+	}
+
+	return wide_idx;
+}
+
+double Accel::measureRayRate(bool binary) const
+{
+	const int rayCount = 1 << 15;
+
+	/* Rays with random origins inside the scene and random directions */
+	pcg32 rng;
+	std::vector<Ray3f> rays(rayCount);
+	for (Ray3f &ray : rays)
+	{
+		Point3f o = m_bbox.min + m_bbox.getExtents().cwiseProduct(
+									 Vector3f(rng.nextFloat(), rng.nextFloat(), rng.nextFloat()));
+		ray = Ray3f(o, Warp::squareToUniformSphere(Point2f(rng.nextFloat(), rng.nextFloat())));
+	}
+
+	Timer timer;
+	for (const Ray3f &ray : rays)
+	{
+		Intersection its;
+		if (binary)
+			traverseBinary(ray, its, false);
+		else
+			traverse<false>(ray, its, false, nullptr);
+	}
+	return rayCount / std::max(timer.elapsed() * 1e-3, 1e-6);
 }
 
 std::pair<float, n_UINT> Accel::statistics(n_UINT node_idx) const
@@ -401,17 +667,18 @@ std::pair<float, n_UINT> Accel::statistics(n_UINT node_idx) const
 	const BVHNode &node = m_nodes[node_idx];
 	if (node.isLeaf())
 	{
-		return std::make_pair((float)BVHBuildTask::INTERSECTION_COST * node.leaf.size, 1u);
+		return std::make_pair((float)INTERSECTION_COST * node.leaf.size, 1u);
 	}
 	else
 	{
-		std::pair<float, n_UINT> stats_left = statistics(node_idx + 1u);
-		std::pair<float, n_UINT> stats_right = statistics(node.inner.rightChild);
-		float saLeft = m_nodes[node_idx + 1u].bbox.getSurfaceArea();
-		float saRight = m_nodes[node.inner.rightChild].bbox.getSurfaceArea();
+		n_UINT left = node.inner.children, right = left + 1;
+		std::pair<float, n_UINT> stats_left = statistics(left);
+		std::pair<float, n_UINT> stats_right = statistics(right);
+		float saLeft = m_nodes[left].bbox.getSurfaceArea();
+		float saRight = m_nodes[right].bbox.getSurfaceArea();
 		float saCur = node.bbox.getSurfaceArea();
 		float sahCost =
-			2 * BVHBuildTask::TRAVERSAL_COST +
+			2 * TRAVERSAL_COST +
 			(saLeft * stats_left.first + saRight * stats_right.first) / saCur;
 		return std::make_pair(
 			sahCost,
@@ -419,7 +686,191 @@ std::pair<float, n_UINT> Accel::statistics(n_UINT node_idx) const
 	}
 }
 
-bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) const
+thread_local TraversalStatistics *Accel::s_threadStatistics = nullptr;
+thread_local Intersection *Accel::s_capturedHit = nullptr;
+
+bool Accel::rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay) const
+{
+	Intersection *capture = s_capturedHit;
+	if (!capture || shadowRay)
+		return rayIntersectUncaptured(ray, its, shadowRay);
+
+	s_capturedHit = nullptr;
+	bool hit = rayIntersectUncaptured(ray, its, shadowRay);
+	*capture = its;
+	if (!hit)
+		capture->mesh = nullptr;
+	return hit;
+}
+
+bool Accel::rayIntersectUncaptured(const Ray3f &ray, Intersection &its, bool shadowRay) const
+{
+#if defined(NORI_ENABLE_STATS)
+	TraversalStatistics stats;
+	bool result = traverse<true>(ray, its, shadowRay, &stats);
+	NORI_STAT_INC(statsRays);
+	NORI_STAT_ADD(statsNodesVisited, stats.nodesVisited);
+	NORI_STAT_ADD(statsTrianglesTested, stats.trianglesTested);
+	if (TraversalStatistics *threadStats = s_threadStatistics)
+	{
+		threadStats->nodesVisited += stats.nodesVisited;
+		threadStats->trianglesTested += stats.trianglesTested;
+	}
+	return result;
+#else
+	if (TraversalStatistics *threadStats = s_threadStatistics)
+		return traverse<true>(ray, its, shadowRay, threadStats);
+	return traverse<false>(ray, its, shadowRay, nullptr);
+#endif
+}
+
+bool Accel::rayIntersect(const Ray3f &ray, Intersection &its, bool shadowRay,
+						 TraversalStatistics &stats) const
+{
+	return traverse<true>(ray, its, shadowRay, &stats);
+}
+
+template <bool Instrumented>
+bool Accel::traverse(const Ray3f &_ray, Intersection &its, bool shadowRay,
+					 TraversalStatistics *stats) const
+{
+	/* Every node adds at most three entries to the stack, build()
+	   makes sure that the tree is shallow enough */
+	n_UINT node_idx = 0, stack_idx = 0, stack[STACK_SIZE];
+
+	its.t = std::numeric_limits<float>::infinity();
+
+	/* Use an adaptive ray epsilon */
+	Ray3f ray(_ray);
+	if (ray.mint == Epsilon)
+		ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
+
+	if (m_wideNodes.empty() || ray.maxt < ray.mint)
+		return false;
+
+	/* Use the copy of the BVH in the memory of the current NUMA node */
+	const WideBVHNode *nodes = m_wideNodes.data();
+	const n_UINT *indices = m_indices.data();
+	if (!m_replicas.empty())
+	{
+		const auto &replica = m_replicas[NumaExecutor::getCurrentNode()];
+		nodes = replica.first.data();
+		indices = replica.second.data();
+	}
+
+	bool foundIntersection = false;
+	n_UINT f = 0;
+
+	while (true)
+	{
+		const WideBVHNode &node = nodes[node_idx];
+
+		if (Instrumented)
+			stats->nodesVisited++;
+
+		/* Intersect the ray with the decoded child bounding boxes. The loops
+		   run over all four slots, which allows the compiler to vectorize them */
+		float nearT[4], farT[4];
+		for (int i = 0; i < 4; ++i)
+		{
+			nearT[i] = ray.mint;
+			farT[i] = ray.maxt;
+		}
+
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float scale = node.scale(axis), origin = ray.o[axis], rcp = ray.dRcp[axis];
+
+			if (ray.d[axis] == 0)
+			{
+				for (int i = 0; i < 4; ++i)
+				{
+					if (origin < node.decode(axis, node.lower[axis][i], scale) ||
+						origin > node.decode(axis, node.upper[axis][i], scale))
+						nearT[i] = std::numeric_limits<float>::infinity();
+				}
+				continue;
+			}
+
+			for (int i = 0; i < 4; ++i)
+			{
+				float t1 = (node.decode(axis, node.lower[axis][i], scale) - origin) * rcp;
+				float t2 = (node.decode(axis, node.upper[axis][i], scale) - origin) * rcp;
+				nearT[i] = std::max(nearT[i], std::min(t1, t2));
+				farT[i] = std::min(farT[i], std::max(t1, t2));
+			}
+		}
+
+		/* Sort the children that were hit by their distance */
+		float distance[4];
+		int order[4], hitCount = 0;
+		for (int i = 0; i < node.childCount; ++i)
+		{
+			if (!(nearT[i] <= farT[i]))
+				continue;
+
+			int j = hitCount++;
+			for (; j > 0 && distance[j - 1] > nearT[i]; --j)
+			{
+				distance[j] = distance[j - 1];
+				order[j] = order[j - 1];
+			}
+			distance[j] = nearT[i];
+			order[j] = i;
+		}
+
+		/* Intersect the leaves front to back, and push the inner
+		   nodes such that the closest one is visited next */
+		for (int k = 0; k < hitCount; ++k)
+		{
+			int i = order[k];
+			if (node.leafSize[i] == 0 || distance[k] > ray.maxt)
+				continue;
+
+			for (n_UINT j = node.child[i], end = j + node.leafSize[i]; j < end; ++j)
+			{
+				n_UINT idx = indices[j];
+				const Mesh *mesh = m_meshes[findMesh(idx)];
+
+				if (Instrumented)
+					stats->trianglesTested++;
+
+				float u, v, t;
+				if (mesh->rayIntersect(idx, ray, u, v, t))
+				{
+					if (shadowRay)
+						return true;
+					foundIntersection = true;
+					ray.maxt = its.t = t;
+					its.uv = Point2f(u, v);
+					its.mesh = mesh;
+					f = idx;
+				}
+			}
+		}
+
+		for (int k = hitCount - 1; k >= 0; --k)
+		{
+			int i = order[k];
+			if (node.leafSize[i] == 0 && distance[k] <= ray.maxt)
+			{
+				stack[stack_idx++] = node.child[i];
+				assert(stack_idx <= STACK_SIZE);
+			}
+		}
+
+		if (stack_idx == 0)
+			break;
+		node_idx = stack[--stack_idx];
+	}
+
+	if (foundIntersection)
+		finalizeIntersection(its, f);
+
+	return foundIntersection;
+}
+
+bool Accel::traverseBinary(const Ray3f &_ray, Intersection &its, bool shadowRay) const
 {
 	n_UINT node_idx = 0, stack_idx = 0, stack[64];
 
@@ -450,8 +901,8 @@ bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) c
 
 		if (node.isInner())
 		{
-			stack[stack_idx++] = node.inner.rightChild;
-			node_idx++;
+			stack[stack_idx++] = node.inner.children + 1;
+			node_idx = node.inner.children;
 			assert(stack_idx < 64);
 		}
 		else
@@ -481,57 +932,60 @@ bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) c
 	}
 
 	if (foundIntersection)
-	{
-		/* Find the barycentric coordinates */
-		Vector3f bary;
-		bary << 1 - its.uv.sum(), its.uv;
+		finalizeIntersection(its, f);
 
-		/* References to all relevant mesh buffers */
-		const Mesh *mesh = its.mesh;
-		const MatrixXf &V = mesh->getVertexPositions();
-		const MatrixXf &N = mesh->getVertexNormals();
-		const MatrixXf &UV = mesh->getVertexTexCoords();
-		const MatrixXu &F = mesh->getIndices();
+	return foundIntersection;
+}
 
-		/* Vertex indices of the triangle */
-		n_UINT idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
+void Accel::finalizeIntersection(Intersection &its, n_UINT f) const
+{
+	/* Find the barycentric coordinates */
+	Vector3f bary;
+	bary << 1 - its.uv.sum(), its.uv;
 
-		Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2);
+	/* References to all relevant mesh buffers */
+	const Mesh *mesh = its.mesh;
+	const MatrixXf &V = mesh->getVertexPositions();
+	const MatrixXf &N = mesh->getVertexNormals();
+	const MatrixXf &UV = mesh->getVertexTexCoords();
+	const MatrixXu &F = mesh->getIndices();
 
-		/* Compute the intersection positon accurately
-		   using barycentric coordinates */
-		its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
+	/* Vertex indices of the triangle */
+	n_UINT idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
 
-		/* Compute proper texture coordinates if provided by the mesh */
-		if (UV.size() > 0)
-			its.uv = bary.x() * UV.col(idx0) +
-					 bary.y() * UV.col(idx1) +
-					 bary.z() * UV.col(idx2);
+	Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2);
 
-		/* Compute the geometry frame */
-		its.geoFrame = Frame((p1 - p0).cross(p2 - p0).normalized());
+	/* Compute the intersection positon accurately
+	   using barycentric coordinates */
+	its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
 
-		if (N.size() > 0)
-		{
-			/* Compute the shading frame. Note that for simplicity,
-			   the current implementation doesn't attempt to provide
-			   tangents that are continuous across the surface. That
-			   means that this code will need to be modified to be able
-			   use anisotropic BRDFs, which need tangent continuity */
-
-			its.shFrame = Frame(
-				(bary.x() * N.col(idx0) +
-				 bary.y() * N.col(idx1) +
-				 bary.z() * N.col(idx2))
-					.normalized());
-		}
-		else
-		{
-			its.shFrame = its.geoFrame;
-		}
-	}
+	/* Compute proper texture coordinates if provided by the mesh */
+	if (UV.size() > 0)
+		its.uv = bary.x() * UV.col(idx0) +
+				 bary.y() * UV.col(idx1) +
+				 bary.z() * UV.col(idx2);
 
-	return foundIntersection;
+	/* Compute the geometry frame */
+	its.geoFrame = Frame((p1 - p0).cross(p2 - p0).normalized());
+
+	if (N.size() > 0)
+	{
+		/* Compute the shading frame. Note that for simplicity,
+		   the current implementation doesn't attempt to provide
+		   tangents that are continuous across the surface. That
+		   means that this code will need to be modified to be able
+		   use anisotropic BRDFs, which need tangent continuity */
+
+		its.shFrame = Frame(
+			(bary.x() * N.col(idx0) +
+			 bary.y() * N.col(idx1) +
+			 bary.z() * N.col(idx2))
+				.normalized());
+	}
+	else
+	{
+		its.shFrame = its.geoFrame;
+	}
 }
 
 NORI_NAMESPACE_END
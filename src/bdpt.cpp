@@ -0,0 +1,634 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/emitter.h>
+#include <nori/mesh.h>
+#include <nori/block.h>
+#include <nori/warp.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/stats.h>
+#include <tbb/parallel_for.h>
+#include <tbb/enumerable_thread_specific.h>
+
+NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+NORI_STAT_COUNTER(statsLightPaths, "BDPT", "Light paths");
+NORI_STAT_COUNTER(statsSplats, "BDPT", "Light image splats");
+
+/**
+ * \brief Bidirectional path tracing
+ *
+ * Every camera sample also traces a path from a light source, and all
+ * vertices of the two subpaths are connected to each other. The resulting
+ * estimates are combined using multiple importance sampling (balance
+ * heuristic) over all strategies that can create a path of the same
+ * length, see "Robust Monte Carlo Methods for Light Transport Simulation"
+ * by Eric Veach (1997) and pbrt-v3.
+ *
+ * Connections of light path vertices to the camera (i.e. light tracing)
+ * contribute to other pixels than the one of the camera ray. They are
+ * splatted into a full-resolution light image of every thread, which are
+ * summed and added to the rendered pixels in \ref endRender(). (Unlike the
+ * other contributions, they are thus not filtered by the reconstruction
+ * filter.) The subpaths are stored in buffers of every thread, so that no
+ * memory is allocated per sample.
+ *
+ * Without a camera (\ref beginRender(), e.g. in the interactive preview),
+ * light tracing is disabled and the other strategies are weighted
+ * accordingly. Environment emitters are not supported.
+ */
+class BDPT : public Integrator
+{
+public:
+    BDPT(const PropertyList &props)
+    {
+        /* Maximum number of bounces of a path */
+        m_maxDepth = props.getInteger("max_depth", 64);
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        if (scene->getEnvironmentalEmitter())
+            throw NoriException("BDPT: environment emitters are not supported!");
+    }
+
+    void beginRender(const Scene *scene, const Camera *camera)
+    {
+        m_camera = camera;
+        m_threadStates.clear();
+    }
+
+    void endRender(ImageBlock &result)
+    {
+        if (!m_camera)
+            return;
+
+        Vector2i size = m_camera->getOutputSize();
+        uint64_t lightPathCount = 0;
+        for (const ThreadState &state : m_threadStates)
+            lightPathCount += state.lightPathCount;
+
+        /* The light paths estimate the entire image, whose pixels each
+           received 1 / (pixel count) of them on average */
+        if (lightPathCount > 0)
+        {
+            float scale = (float)size.x() * size.y() / lightPathCount;
+            int border = result.getBorderSize();
+
+            tbb::parallel_for(0, size.y(), [&](int y)
+                              {
+                for (int x = 0; x < size.x(); ++x)
+                {
+                    Color3f value(0.0f);
+                    for (const ThreadState &state : m_threadStates)
+                    {
+                        if (!state.lightImage.empty())
+                            value += state.lightImage[y * size.x() + x];
+                    }
+
+                    Color4f &pixel = result.coeffRef(y + border, x + border);
+                    if (pixel.w() > 0)
+                    {
+                        value *= scale * pixel.w();
+                        pixel += Color4f(value.r(), value.g(), value.b(), 0.0f);
+                    }
+                } });
+        }
+
+        m_threadStates.clear();
+        m_camera = nullptr;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+    {
+        return trace(scene, sampler, ray);
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "BDPT[\n"
+            "  max_depth = %i\n"
+            "]",
+            m_maxDepth);
+    }
+
+private:
+    /// A vertex of a camera or light subpath
+    struct PathVertex
+    {
+        enum EType
+        {
+            ECamera,
+            ELight,
+            ESurface
+        };
+
+        EType type;
+        /// Was the direction towards the next vertex sampled from a delta lobe?
+        bool delta;
+        /// Does the vertex lie on a surface (i.e. are densities per unit area)?
+        bool onSurface;
+        Point3f p;
+        /// Shading frame (surfaces) or emission normal in \c frame.n (area lights)
+        Frame frame;
+        /// Geometric normal, for conversions between solid angle and area densities
+        Normal3f ng;
+        Point2f uv;
+        const BSDF *bsdf;
+        BSDFClosure closure;
+        /// Light source (light vertices, and surfaces that are emitters)
+        const Emitter *emitter;
+        /// Direction towards the previous vertex (surfaces)
+        Vector3f wi;
+        /// Throughput of the subpath up to this vertex
+        Color3f beta;
+        /// Area density of this vertex when it is sampled from the previous / next vertex
+        float pdfFwd, pdfRev;
+    };
+
+    /// Buffers of a rendering thread
+    struct ThreadState
+    {
+        std::vector<PathVertex> cameraPath;
+        std::vector<PathVertex> lightPath;
+        /// Light tracing contributions (row-major, in pixels of the camera)
+        std::vector<Color3f> lightImage;
+        uint64_t lightPathCount = 0;
+    };
+
+    Color3f trace(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+    {
+        ThreadState &state = m_threadStates.local();
+        if (state.cameraPath.empty())
+        {
+            state.cameraPath.resize(m_maxDepth + 2);
+            state.lightPath.resize(m_maxDepth + 1);
+        }
+        if (m_camera && state.lightImage.empty())
+        {
+            Vector2i size = m_camera->getOutputSize();
+            state.lightImage.assign((size_t)size.x() * size.y(), Color3f(0.0f));
+        }
+        PathVertex *camera = state.cameraPath.data(), *light = state.lightPath.data();
+
+        /* Camera subpath. The importance is already accounted for by the
+           camera sample, and the pinhole cannot be hit by light paths */
+        Color3f Li(0.0f);
+        camera[0].type = PathVertex::ECamera;
+        camera[0].delta = camera[0].onSurface = false;
+        camera[0].p = ray.o;
+        camera[0].beta = Color3f(1.0f);
+        camera[0].pdfFwd = camera[0].pdfRev = 0.0f;
+
+        Point3f position;
+        Point2f pixel;
+        float pdfCamera = m_camera ? m_camera->project(ray(1.0f), position, pixel) : 0.0f;
+        int cameraCount = 1 + randomWalk(scene, sampler, ray, Color3f(1.0f), pdfCamera,
+                                         m_maxDepth + 1, camera + 1, &Li);
+
+        /* Light subpath */
+        int lightCount = 0;
+        if (!scene->getLights().empty())
+        {
+            NORI_STAT_INC(statsLightPaths);
+            lightCount = generateLightSubpath(scene, sampler, light);
+            if (m_camera)
+                state.lightPathCount++;
+        }
+
+        /* Connect all prefixes of the subpaths */
+        for (int t = 1; t <= cameraCount; ++t)
+        {
+            for (int s = 0; s <= lightCount; ++s)
+            {
+                int depth = t + s - 2;
+                if ((s == 1 && t == 1) || depth < 0 || depth > m_maxDepth)
+                    continue;
+                if (t == 1 && !m_camera)
+                    continue;
+
+                Point2f splat;
+                Color3f L = connect(scene, sampler, light, camera, s, t, splat);
+                if (L.isZero())
+                    continue;
+
+                if (t == 1)
+                {
+                    Vector2i size = m_camera->getOutputSize();
+                    int x = clamp((int)splat.x(), 0, size.x() - 1), y = clamp((int)splat.y(), 0, size.y() - 1);
+                    state.lightImage[y * size.x() + x] += L;
+                    NORI_STAT_INC(statsSplats);
+                }
+                else
+                {
+                    Li += L;
+                }
+            }
+        }
+
+        return Li;
+    }
+
+    /// Sample the first vertex and direction of a light subpath, and continue it with \ref randomWalk()
+    int generateLightSubpath(const Scene *scene, Sampler *sampler, PathVertex *path) const
+    {
+        float pdfSelect;
+        const Emitter *emitter = scene->sampleEmitter(sampler->next1D(), pdfSelect);
+        const Mesh *mesh = emitter->getMesh();
+        Point2f positionSample = sampler->next2D(), directionSample = sampler->next2D();
+
+        PathVertex &vertex = path[0];
+        vertex.type = PathVertex::ELight;
+        vertex.delta = false;
+        vertex.emitter = emitter;
+        vertex.pdfRev = 0.0f;
+
+        Vector3f d;
+        float pdfDirection, cosTheta;
+        if (mesh)
+        {
+            Normal3f n;
+            Point2f uv;
+            mesh->samplePosition(positionSample, vertex.p, n, uv);
+            vertex.frame = Frame(n);
+            vertex.ng = n;
+            vertex.onSurface = true;
+            vertex.uv = uv;
+            vertex.pdfFwd = pdfSelect * mesh->pdf(vertex.p);
+
+            Vector3f local = Warp::squareToCosineHemisphere(directionSample);
+            d = vertex.frame.toWorld(local);
+            cosTheta = Frame::cosTheta(local);
+            pdfDirection = Warp::squareToCosineHemispherePdf(local);
+            vertex.beta = emitter->eval(EmitterQueryRecord(emitter, vertex.p + d, vertex.p, n, uv));
+        }
+        else if (emitter->isDelta())
+        {
+            EmitterQueryRecord lRec(Point3f(0.0f));
+            emitter->sample(lRec, positionSample, 0.0f);
+            vertex.p = lRec.p;
+            vertex.frame = Frame(Normal3f(0.0f, 0.0f, 1.0f));
+            vertex.ng = Normal3f(0.0f);
+            vertex.onSurface = false;
+            vertex.pdfFwd = pdfSelect;
+
+            d = Warp::squareToUniformSphere(directionSample);
+            cosTheta = 1.0f;
+            pdfDirection = INV_FOURPI;
+            vertex.beta = emitter->radiance();
+        }
+        else
+        {
+            return 0;
+        }
+
+        if (vertex.beta.isZero() || !(vertex.pdfFwd > 0) || !(pdfDirection > 0))
+            return 1;
+
+        Color3f beta = vertex.beta * cosTheta / (vertex.pdfFwd * pdfDirection);
+        return 1 + randomWalk(scene, sampler, Ray3f(vertex.p, d), beta, pdfDirection, m_maxDepth, path + 1, nullptr);
+    }
+
+    /**
+     * Extend a subpath whose last vertex is <tt>path[-1]</tt> by up to
+     * \c maxVertices vertices, starting with \c ray that was sampled with
+     * the solid angle density \c pdf. Return the number of new vertices. If
+     * \c background is given, it receives the background that is seen by
+     * an escaping path.
+     */
+    int randomWalk(const Scene *scene, Sampler *sampler, Ray3f ray, Color3f beta, float pdf,
+                   int maxVertices, PathVertex *path, Color3f *background) const
+    {
+        int count = 0;
+        while (count < maxVertices)
+        {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+            {
+                if (background)
+                    *background += beta * scene->getBackground(ray);
+                break;
+            }
+
+            PathVertex &vertex = path[count], &prev = path[count - 1];
+            vertex.type = PathVertex::ESurface;
+            vertex.delta = false;
+            vertex.onSurface = true;
+            vertex.p = its.p;
+            vertex.frame = its.shFrame;
+            vertex.ng = its.geoFrame.n;
+            vertex.uv = its.uv;
+            vertex.bsdf = its.mesh->getBSDF();
+            vertex.emitter = its.mesh->isEmitter() ? its.mesh->getEmitter() : nullptr;
+            vertex.wi = -ray.d;
+            vertex.beta = beta;
+            vertex.pdfFwd = convertDensity(prev, pdf, vertex);
+            vertex.pdfRev = 0.0f;
+            ++count;
+
+            if (!vertex.bsdf)
+                break;
+            vertex.bsdf->evalClosure(vertex.uv, vertex.closure);
+            if (count == maxVertices)
+                break;
+
+            BSDFQueryRecord bRec(vertex.frame.toLocal(vertex.wi), vertex.uv, &vertex.closure);
+            bRec.measure = ESolidAngle;
+            Color3f weight = vertex.bsdf->sample(bRec, sampler->next2D());
+            if (weight.isZero())
+                break;
+            beta *= weight;
+
+            float pdfRev;
+            if (bRec.lobe & EDelta)
+            {
+                vertex.delta = true;
+                pdf = pdfRev = 0.0f;
+            }
+            else
+            {
+                pdf = bRec.pdf;
+                pdfRev = vertex.bsdf->pdf(BSDFQueryRecord(bRec.wo, bRec.wi, vertex.uv, ESolidAngle, &vertex.closure));
+            }
+            prev.pdfRev = convertDensity(vertex, pdfRev, prev);
+
+            /* Russian roulette based on the change of the throughput (the
+               MIS weights still sum to one, as they ignore it everywhere) */
+            if (count >= 3)
+            {
+                float q = std::min(weight.maxCoeff(), 0.95f);
+                if (sampler->next1D() >= q)
+                    break;
+                beta /= q;
+            }
+
+            NORI_STAT_INC(statsSecondaryRays);
+            ray = Ray3f(vertex.p, vertex.frame.toWorld(bRec.wo));
+        }
+        return count;
+    }
+
+    /**
+     * Compute the MIS-weighted contribution of the strategy that uses \c s
+     * light and \c t camera vertices. For light tracing (<tt>t == 1</tt>),
+     * \c splat receives the pixel of the contribution.
+     */
+    Color3f connect(const Scene *scene, Sampler *sampler, PathVertex *light, PathVertex *camera,
+                    int s, int t, Point2f &splat) const
+    {
+        const PathVertex &pt = camera[t - 1];
+        Color3f L(0.0f);
+        PathVertex sampled;
+
+        if (s == 0)
+        {
+            /* The camera subpath hits an emitter */
+            if (!pt.emitter)
+                return Color3f(0.0f);
+            const PathVertex &prev = camera[t - 2];
+            L = pt.beta * pt.emitter->eval(EmitterQueryRecord(pt.emitter, prev.p, pt.p, pt.frame.n, pt.uv));
+        }
+        else if (t == 1)
+        {
+            /* Connect the light subpath to the camera (light tracing) */
+            const PathVertex &qs = light[s - 1];
+            if (!isConnectible(qs))
+                return Color3f(0.0f);
+
+            float pdfCamera = m_camera->project(qs.p, sampled.p, splat);
+            if (!(pdfCamera > 0))
+                return Color3f(0.0f);
+            sampled.type = PathVertex::ECamera;
+            sampled.delta = sampled.onSurface = false;
+            sampled.pdfFwd = sampled.pdfRev = 0.0f;
+            sampled.beta = Color3f(pdfCamera / (sampled.p - qs.p).squaredNorm());
+
+            L = qs.beta * f(qs, sampled) * sampled.beta * absCos(qs, sampled.p);
+            if (!L.isZero() && !visible(scene, qs.p, sampled.p))
+                return Color3f(0.0f);
+        }
+        else if (s == 1)
+        {
+            /* Sample a point on an emitter (next event estimation) */
+            if (!isConnectible(pt))
+                return Color3f(0.0f);
+
+            float pdfSelect;
+            const Emitter *emitter = scene->sampleEmitter(sampler->next1D(), pdfSelect);
+            EmitterQueryRecord lRec(pt.p);
+            Color3f Le = emitter->sample(lRec, sampler->next2D(), 0.0f);
+            float pdf = pdfSelect * emitter->pdf(lRec);
+            if (Le.isZero() || !(pdf > 0))
+                return Color3f(0.0f);
+
+            sampled.type = PathVertex::ELight;
+            sampled.delta = false;
+            sampled.emitter = emitter;
+            sampled.p = lRec.p;
+            sampled.onSurface = emitter->getMesh() != nullptr;
+            sampled.frame = Frame(sampled.onSurface ? lRec.n : Normal3f(0.0f, 0.0f, 1.0f));
+            sampled.ng = sampled.onSurface ? lRec.n : Normal3f(0.0f);
+            sampled.beta = Le / pdf;
+            sampled.pdfFwd = pdfLightOrigin(scene, sampled);
+            sampled.pdfRev = 0.0f;
+
+            L = pt.beta * f(pt, sampled) * sampled.beta * absCos(pt, sampled.p);
+            if (!L.isZero() && !visible(scene, pt.p, sampled.p))
+                return Color3f(0.0f);
+        }
+        else
+        {
+            /* Connect two surface vertices */
+            const PathVertex &qs = light[s - 1];
+            if (!isConnectible(qs) || !isConnectible(pt))
+                return Color3f(0.0f);
+
+            L = qs.beta * f(qs, pt) * f(pt, qs) * pt.beta;
+            if (L.isZero())
+                return Color3f(0.0f);
+            L *= absCos(qs, pt.p) * absCos(pt, qs.p) / (qs.p - pt.p).squaredNorm();
+            if (!L.isZero() && !visible(scene, qs.p, pt.p))
+                return Color3f(0.0f);
+        }
+
+        if (L.isZero())
+            return L;
+        return L * misWeight(scene, light, camera, sampled, s, t);
+    }
+
+    /**
+     * Balance heuristic weight of the strategy (s, t), computed from the
+     * ratios of the densities of sampling each vertex from either side
+     */
+    float misWeight(const Scene *scene, PathVertex *light, PathVertex *camera, const PathVertex &sampled,
+                    int s, int t) const
+    {
+        if (s + t == 2)
+            return 1.0f;
+
+        /* The vertex sampled by the connection replaces the endpoint of its subpath */
+        PathVertex lightOrigin = light[0], cameraOrigin = camera[0];
+        if (s == 1)
+            light[0] = sampled;
+        else if (t == 1)
+            camera[0] = sampled;
+
+        /* Update the reverse densities of the vertices next to the connection */
+        PathVertex *qs = s > 0 ? &light[s - 1] : nullptr, *pt = &camera[t - 1];
+        PathVertex *qsMinus = s > 1 ? &light[s - 2] : nullptr, *ptMinus = t > 1 ? &camera[t - 2] : nullptr;
+        float saved[4] = {pt->pdfRev, ptMinus ? ptMinus->pdfRev : 0.0f,
+                          qs ? qs->pdfRev : 0.0f, qsMinus ? qsMinus->pdfRev : 0.0f};
+        bool ptDelta = pt->delta, qsDelta = qs ? qs->delta : false;
+
+        pt->delta = false;
+        pt->pdfRev = qs ? pdf(scene, *qs, qsMinus, *pt) : pdfLightOrigin(scene, *pt);
+        if (ptMinus)
+            ptMinus->pdfRev = qs ? pdf(scene, *pt, qs, *ptMinus) : pdfLight(*pt, *ptMinus);
+        if (qs)
+        {
+            qs->delta = false;
+            qs->pdfRev = pdf(scene, *pt, ptMinus, *qs);
+        }
+        if (qsMinus)
+            qsMinus->pdfRev = pdf(scene, *qs, pt, *qsMinus);
+
+        /* The products of the ratios easily overflow in single precision */
+        auto remap = [](float pdf)
+        { return pdf != 0 ? (double)pdf : 1.0; };
+        double sum = 0.0, ratio = 1.0;
+        for (int i = t - 1; i > 0; --i)
+        {
+            ratio *= remap(camera[i].pdfRev) / remap(camera[i].pdfFwd);
+            /* i == 1 is light tracing, which needs the camera */
+            if (!camera[i].delta && !camera[i - 1].delta && (i > 1 || m_camera))
+                sum += ratio;
+        }
+        ratio = 1.0;
+        for (int i = s - 1; i >= 0; --i)
+        {
+            ratio *= remap(light[i].pdfRev) / remap(light[i].pdfFwd);
+            bool deltaLight = i > 0 ? light[i - 1].delta : isDeltaLight(light[0]);
+            if (!light[i].delta && !deltaLight)
+                sum += ratio;
+        }
+
+        /* Restore the subpaths */
+        pt->pdfRev = saved[0];
+        pt->delta = ptDelta;
+        if (ptMinus)
+            ptMinus->pdfRev = saved[1];
+        if (qs)
+        {
+            qs->pdfRev = saved[2];
+            qs->delta = qsDelta;
+        }
+        if (qsMinus)
+            qsMinus->pdfRev = saved[3];
+        if (s == 1)
+            light[0] = lightOrigin;
+        else if (t == 1)
+            camera[0] = cameraOrigin;
+
+        return (float)(1.0 / (1.0 + sum));
+    }
+
+    /// Convert the solid angle density \c pdf of sampling \c to from \c from into an area density
+    static float convertDensity(const PathVertex &from, float pdf, const PathVertex &to)
+    {
+        Vector3f d = to.p - from.p;
+        float invDist2 = 1.0f / d.squaredNorm();
+        if (to.onSurface)
+            pdf *= std::abs(to.ng.dot(d)) * std::sqrt(invDist2);
+        return pdf * invDist2;
+    }
+
+    /// Area density of sampling \c next from \c vertex, when \c vertex was reached from \c prev
+    float pdf(const Scene *scene, const PathVertex &vertex, const PathVertex *prev, const PathVertex &next) const
+    {
+        if (vertex.type == PathVertex::ELight)
+            return pdfLight(vertex, next);
+
+        float pdf;
+        if (vertex.type == PathVertex::ECamera)
+        {
+            Point3f position;
+            Point2f pixel;
+            pdf = m_camera ? m_camera->project(next.p, position, pixel) : 0.0f;
+        }
+        else
+        {
+            if (!vertex.bsdf)
+                return 0.0f;
+            Vector3f wo = (next.p - vertex.p).normalized();
+            Vector3f wi = prev ? (prev->p - vertex.p).normalized() : vertex.wi;
+            pdf = vertex.bsdf->pdf(BSDFQueryRecord(vertex.frame.toLocal(wi), vertex.frame.toLocal(wo),
+                                                   vertex.uv, ESolidAngle, &vertex.closure));
+        }
+        return convertDensity(vertex, pdf, next);
+    }
+
+    /// Area density of emitting towards \c next from \c vertex on an emitter
+    static float pdfLight(const PathVertex &vertex, const PathVertex &next)
+    {
+        Vector3f d = next.p - vertex.p;
+        float invDist2 = 1.0f / d.squaredNorm();
+        d *= std::sqrt(invDist2);
+
+        float pdf = vertex.emitter->getMesh() ? std::max(0.0f, vertex.frame.n.dot(d)) * INV_PI : INV_FOURPI;
+        if (next.onSurface)
+            pdf *= std::abs(next.ng.dot(d));
+        return pdf * invDist2;
+    }
+
+    /// Area density of starting a light subpath at \c vertex on an emitter
+    static float pdfLightOrigin(const Scene *scene, const PathVertex &vertex)
+    {
+        float pdf = scene->pdfEmitter(vertex.emitter);
+        const Mesh *mesh = vertex.emitter->getMesh();
+        return mesh ? pdf * mesh->pdf(vertex.p) : pdf;
+    }
+
+    static bool isDeltaLight(const PathVertex &vertex)
+    {
+        return vertex.emitter->isDelta();
+    }
+
+    /// Can the vertex be connected to another one (i.e. does it have a non-delta BSDF)?
+    static bool isConnectible(const PathVertex &vertex)
+    {
+        return vertex.type != PathVertex::ESurface || (vertex.bsdf && vertex.bsdf->isDiffuse());
+    }
+
+    /// BSDF of a surface vertex for scattering between its previous vertex and \c next
+    static Color3f f(const PathVertex &vertex, const PathVertex &next)
+    {
+        Vector3f wo = (next.p - vertex.p).normalized();
+        return vertex.bsdf->eval(BSDFQueryRecord(vertex.frame.toLocal(vertex.wi), vertex.frame.toLocal(wo),
+                                                 vertex.uv, ESolidAngle, &vertex.closure));
+    }
+
+    /// Cosine between the shading normal of a surface vertex and the direction towards \c p
+    static float absCos(const PathVertex &vertex, const Point3f &p)
+    {
+        return std::abs(vertex.frame.n.dot((p - vertex.p).normalized()));
+    }
+
+    static bool visible(const Scene *scene, const Point3f &a, const Point3f &b)
+    {
+        Vector3f d = b - a;
+        float dist = d.norm();
+        NORI_STAT_INC(statsShadowRays);
+        return !scene->rayIntersect(Ray3f(a, d / dist, Epsilon, dist * (1.0f - Epsilon)));
+    }
+
+    int m_maxDepth;
+    const Camera *m_camera = nullptr;
+    mutable tbb::enumerable_thread_specific<ThreadState> m_threadStates;
+};
+
+NORI_REGISTER_CLASS(BDPT, "bdpt");
+NORI_NAMESPACE_END
@@ -27,7 +27,11 @@
 #include <ImfVersion.h>
 #include <ImfIO.h>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
+/* The image loader is compiled in (with internal linkage, since the
+   user interface library contains another copy), so that the rendering
+   core does not depend on it. The writer is implemented in stbiw.cpp */
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 #include <stb_image_write.h>
 
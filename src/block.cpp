@@ -20,12 +20,22 @@
 #include <nori/bitmap.h>
 #include <nori/rfilter.h>
 #include <nori/bbox.h>
+#include <nori/stats.h>
 #include <tbb/tbb.h>
+#include <ImfOutputFile.h>
+#include <ImfInputFile.h>
+#include <ImfChannelList.h>
+#include <ImfStringAttribute.h>
+#include <set>
+#include <sstream>
 
 NORI_NAMESPACE_BEGIN
 
-ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
-    : m_offset(0, 0), m_size(size)
+NORI_STAT_COUNTER(statsInvalidSamples, "Image reconstruction", "Invalid samples rejected");
+
+ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter,
+                       const std::vector<ImageChannel> &channels)
+    : m_offset(0, 0), m_size(size), m_channels(channels)
 {
     if (filter)
     {
@@ -49,6 +59,31 @@ ImageBlock::ImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
 
     /* Allocate space for pixels and border regions */
     resize(size.y() + 2 * m_borderSize, size.x() + 2 * m_borderSize);
+
+    if (!m_channels.empty())
+        m_channelData.resize(rows() * cols() * (m_channels.size() + 1));
+}
+
+void ImageBlock::clear()
+{
+    clearRows(0, (int)rows());
+}
+
+void ImageBlock::clearRows(int firstRow, int lastRow)
+{
+    middleRows(firstRow, lastRow - firstRow).setConstant(Color4f());
+
+    if (m_channelData.empty())
+        return;
+
+    size_t stride = m_channels.size() + 1;
+    size_t end = (size_t)lastRow * cols() * stride;
+    for (size_t i = (size_t)firstRow * cols() * stride; i < end; i += stride)
+    {
+        for (size_t c = 0; c < m_channels.size(); ++c)
+            m_channelData[i + c] = m_channels[c].maximum ? -std::numeric_limits<float>::infinity() : 0.f;
+        m_channelData[i + m_channels.size()] = 0.f;
+    }
 }
 
 ImageBlock::~ImageBlock()
@@ -58,6 +93,28 @@ ImageBlock::~ImageBlock()
     delete[] m_weightsY;
 }
 
+void ImageBlock::serialize(std::ostream &os) const
+{
+    int32_t header[4] = {(int32_t)rows(), (int32_t)cols(), m_borderSize, (int32_t)m_channels.size()};
+    os.write(reinterpret_cast<const char *>(header), sizeof(header));
+    os.write(reinterpret_cast<const char *>(data()), sizeof(Color4f) * size());
+    os.write(reinterpret_cast<const char *>(m_channelData.data()), sizeof(float) * m_channelData.size());
+}
+
+void ImageBlock::unserialize(std::istream &is)
+{
+    int32_t header[4];
+    is.read(reinterpret_cast<char *>(header), sizeof(header));
+    if (!is || header[0] != rows() || header[1] != cols() ||
+        header[2] != m_borderSize || header[3] != (int32_t)m_channels.size())
+        throw NoriException("ImageBlock::unserialize(): the stored block has an incompatible layout!");
+
+    is.read(reinterpret_cast<char *>(data()), sizeof(Color4f) * size());
+    is.read(reinterpret_cast<char *>(m_channelData.data()), sizeof(float) * m_channelData.size());
+    if (!is)
+        throw NoriException("ImageBlock::unserialize(): unexpected end of data!");
+}
+
 Bitmap *ImageBlock::toBitmap() const
 {
     Bitmap *result = new Bitmap(m_size);
@@ -83,6 +140,7 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value)
     {
         /* If this happens, go fix your code instead of removing this warning ;) */
         cerr << "Integrator: computed an invalid radiance value: " << value.toString() << endl;
+        NORI_STAT_INC(statsInvalidSamples);
         return;
     }
 
@@ -108,6 +166,25 @@ void ImageBlock::put(const Point2f &_pos, const Color3f &value)
             coeffRef(y, x) += Color4f(value) * m_weightsX[xr] * m_weightsY[yr];
 }
 
+void ImageBlock::putChannels(const Point2f &pos, const float *values)
+{
+    /* Box filter: only the pixel containing the sample is affected */
+    int x = (int)std::floor(pos.x()) - m_offset.x() + m_borderSize,
+        y = (int)std::floor(pos.y()) - m_offset.y() + m_borderSize;
+    if (m_channelData.empty() || x < 0 || y < 0 || x >= cols() || y >= rows())
+        return;
+
+    float *pixel = &m_channelData[(y * cols() + x) * (m_channels.size() + 1)];
+    for (size_t c = 0; c < m_channels.size(); ++c)
+    {
+        if (m_channels[c].maximum)
+            pixel[c] = std::max(pixel[c], values[c]);
+        else
+            pixel[c] += values[c];
+    }
+    pixel[m_channels.size()] += 1;
+}
+
 void ImageBlock::put(ImageBlock &b)
 {
     Vector2i offset = b.getOffset() - m_offset +
@@ -117,6 +194,231 @@ void ImageBlock::put(ImageBlock &b)
     tbb::mutex::scoped_lock lock(m_mutex);
 
     block(offset.y(), offset.x(), size.y(), size.x()) += b.topLeftCorner(size.y(), size.x());
+
+    if (m_channelData.empty() || b.m_channelData.empty())
+        return;
+    if (b.m_channels.size() != m_channels.size())
+        throw NoriException("ImageBlock::put(): the blocks have different channels!");
+
+    size_t stride = m_channels.size() + 1;
+    for (int y = 0; y < size.y(); ++y)
+    {
+        for (int x = 0; x < size.x(); ++x)
+        {
+            const float *src = &b.m_channelData[(y * b.cols() + x) * stride];
+            float *dst = &m_channelData[((y + offset.y()) * cols() + x + offset.x()) * stride];
+            for (size_t c = 0; c < m_channels.size(); ++c)
+                dst[c] = m_channels[c].maximum ? std::max(dst[c], src[c]) : dst[c] + src[c];
+            dst[m_channels.size()] += src[m_channels.size()];
+        }
+    }
+}
+
+void ImageBlock::copyFrom(const ImageBlock &b)
+{
+    m_offset = b.m_offset;
+    m_size = b.m_size;
+    m_borderSize = b.m_borderSize;
+    m_channels = b.m_channels;
+    Eigen::Array<Color4f, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>::operator=(b);
+    m_channelData = b.m_channelData;
+}
+
+/// Write a set of interleaved float channels to an OpenEXR file
+static void writeChannels(const std::string &filename, const Vector2i &size,
+                          const std::vector<std::string> &names, std::vector<float> &data,
+                          const std::string &maximumChannels = "")
+{
+    Imf::Header header(size.x(), size.y());
+    header.insert("comments", Imf::StringAttribute("Generated by Nori"));
+    if (!maximumChannels.empty())
+        header.insert("maximumChannels", Imf::StringAttribute(maximumChannels));
+
+    Imf::FrameBuffer frameBuffer;
+    size_t compStride = sizeof(float),
+           pixelStride = names.size() * compStride,
+           rowStride = pixelStride * size.x();
+
+    for (size_t c = 0; c < names.size(); ++c)
+    {
+        header.channels().insert(names[c], Imf::Channel(Imf::FLOAT));
+        frameBuffer.insert(names[c], Imf::Slice(Imf::FLOAT, reinterpret_cast<char *>(&data[c]),
+                                                pixelStride, rowStride));
+    }
+
+    std::string path = filename + ".exr";
+    Imf::OutputFile file(path.c_str(), header);
+    file.setFrameBuffer(frameBuffer);
+    file.writePixels(size.y());
+}
+
+void ImageBlock::saveEXR(const std::string &filename) const
+{
+    cout << "Writing a " << m_size.x() << "x" << m_size.y() << " OpenEXR file with "
+         << m_channels.size() + 4 << " channels to \"" << filename << "\"" << endl;
+
+    size_t channelCount = m_channels.size() + 4;
+    size_t stride = m_channels.size() + 1;
+
+    /* Gather all channels: RGB, the additional ones, and the sample count */
+    std::vector<std::string> names = {"R", "G", "B"};
+    for (const ImageChannel &channel : m_channels)
+        names.push_back(channel.name);
+    names.push_back("sampleCount");
+
+    std::vector<float> data((size_t)m_size.x() * m_size.y() * channelCount, 0.f);
+    for (int y = 0; y < m_size.y(); ++y)
+    {
+        for (int x = 0; x < m_size.x(); ++x)
+        {
+            float *dst = &data[((size_t)y * m_size.x() + x) * channelCount];
+            Color3f color = coeff(y + m_borderSize, x + m_borderSize).divideByFilterWeight();
+            dst[0] = color.r();
+            dst[1] = color.g();
+            dst[2] = color.b();
+
+            if (m_channelData.empty())
+                continue;
+
+            const float *src = &m_channelData[((y + m_borderSize) * cols() + x + m_borderSize) * stride];
+            float count = src[m_channels.size()];
+            for (size_t c = 0; c < m_channels.size(); ++c)
+            {
+                if (count == 0)
+                    dst[3 + c] = 0.f;
+                else
+                    dst[3 + c] = m_channels[c].maximum ? src[c] : src[c] / count;
+            }
+            dst[channelCount - 1] = count;
+        }
+    }
+
+    writeChannels(filename, m_size, names, data);
+}
+
+void ImageBlock::savePartialEXR(const std::string &filename) const
+{
+    cout << "Writing a " << m_size.x() << "x" << m_size.y() << " partial OpenEXR file to \""
+         << filename << "\"" << endl;
+
+    size_t stride = m_channels.size() + 1;
+    size_t channelCount = 4 + (m_channelData.empty() ? 0 : stride);
+
+    /* Unnormalized color and weight, followed by the raw additional channels */
+    std::vector<std::string> names = {"R", "G", "B", "W"};
+    std::string maximumChannels;
+    for (const ImageChannel &channel : m_channels)
+    {
+        names.push_back(channel.name);
+        if (channel.maximum)
+            maximumChannels += (maximumChannels.empty() ? "" : ",") + channel.name;
+    }
+    if (!m_channelData.empty())
+        names.push_back("sampleCount");
+
+    std::vector<float> data((size_t)m_size.x() * m_size.y() * channelCount);
+    for (int y = 0; y < m_size.y(); ++y)
+    {
+        for (int x = 0; x < m_size.x(); ++x)
+        {
+            float *dst = &data[((size_t)y * m_size.x() + x) * channelCount];
+            const Color4f &value = coeff(y + m_borderSize, x + m_borderSize);
+            for (int c = 0; c < 4; ++c)
+                dst[c] = value[c];
+            if (!m_channelData.empty())
+            {
+                const float *src = &m_channelData[((y + m_borderSize) * cols() + x + m_borderSize) * stride];
+                std::copy(src, src + stride, dst + 4);
+            }
+        }
+    }
+
+    writeChannels(filename, m_size, names, data, maximumChannels);
+}
+
+ImageBlock *ImageBlock::fromPartialEXR(const std::string &filename)
+{
+    Imf::InputFile file(filename.c_str());
+    const Imf::Header &header = file.header();
+    Imath::Box2i dw = header.dataWindow();
+    Vector2i size(dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1);
+
+    if (!header.channels().findChannel("W"))
+        throw NoriException("\"%s\" is not a partial render (no weight channel)!", filename);
+
+    /* Recover the additional channels, in the order they were written */
+    std::set<std::string> maximum;
+    if (const Imf::StringAttribute *attr = header.findTypedAttribute<Imf::StringAttribute>("maximumChannels"))
+    {
+        std::istringstream is(attr->value());
+        std::string name;
+        while (std::getline(is, name, ','))
+            maximum.insert(name);
+    }
+
+    std::vector<ImageChannel> channels;
+    for (auto it = header.channels().begin(); it != header.channels().end(); ++it)
+    {
+        std::string name = it.name();
+        if (name != "R" && name != "G" && name != "B" && name != "W" && name != "sampleCount")
+            channels.push_back(ImageChannel(name, maximum.count(name) > 0));
+    }
+
+    ImageBlock *block = new ImageBlock(size, nullptr, channels);
+    block->clear();
+    return block;
+}
+
+void ImageBlock::putPartialEXR(const std::string &filename)
+{
+    cout << "Reading a partial OpenEXR file from \"" << filename << "\"" << endl;
+
+    Imf::InputFile file(filename.c_str());
+    const Imf::Header &header = file.header();
+    Imath::Box2i dw = header.dataWindow();
+    Vector2i size(dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1);
+    if (size != m_size)
+        throw NoriException("\"%s\" has a different resolution than the other partial renders!", filename);
+
+    std::vector<std::string> names = {"R", "G", "B", "W"};
+    for (const ImageChannel &channel : m_channels)
+        names.push_back(channel.name);
+    if (!m_channelData.empty())
+        names.push_back("sampleCount");
+    for (const std::string &name : names)
+        if (!header.channels().findChannel(name))
+            throw NoriException("\"%s\" does not contain the channel \"%s\"!", filename, name);
+
+    size_t channelCount = names.size();
+    std::vector<float> data((size_t)size.x() * size.y() * channelCount);
+    Imf::FrameBuffer frameBuffer;
+    size_t compStride = sizeof(float),
+           pixelStride = channelCount * compStride,
+           rowStride = pixelStride * size.x();
+    char *ptr = reinterpret_cast<char *>(data.data()) - dw.min.x * pixelStride - dw.min.y * rowStride;
+    for (size_t c = 0; c < channelCount; ++c)
+        frameBuffer.insert(names[c], Imf::Slice(Imf::FLOAT, ptr + c * compStride, pixelStride, rowStride));
+    file.setFrameBuffer(frameBuffer);
+    file.readPixels(dw.min.y, dw.max.y);
+
+    size_t stride = m_channels.size() + 1;
+    for (int y = 0; y < size.y(); ++y)
+    {
+        for (int x = 0; x < size.x(); ++x)
+        {
+            const float *src = &data[((size_t)y * size.x() + x) * channelCount];
+            Color4f &value = coeffRef(y + m_borderSize, x + m_borderSize);
+            for (int c = 0; c < 4; ++c)
+                value[c] += src[c];
+
+            if (m_channelData.empty())
+                continue;
+            float *dst = &m_channelData[((y + m_borderSize) * cols() + x + m_borderSize) * stride];
+            for (size_t c = 0; c < m_channels.size(); ++c)
+                dst[c] = m_channels[c].maximum ? std::max(dst[c], src[4 + c]) : dst[c] + src[4 + c];
+            dst[m_channels.size()] += src[4 + m_channels.size()];
+        }
+    }
 }
 
 std::string ImageBlock::toString() const
@@ -126,60 +428,142 @@ std::string ImageBlock::toString() const
 }
 
 BlockGenerator::BlockGenerator(const Vector2i &size, int blockSize)
-    : m_size(size), m_blockSize(blockSize)
+    : m_size(size), m_blockSize(blockSize), m_cropOffset(0, 0), m_cropSize(size)
 {
     m_numBlocks = Vector2i(
         (int)std::ceil(size.x() / (float)blockSize),
         (int)std::ceil(size.y() / (float)blockSize));
-    m_blocksLeft = m_numBlocks.x() * m_numBlocks.y();
-    m_direction = ERight;
-    m_block = Point2i(m_numBlocks / 2);
-    m_stepsLeft = 1;
-    m_numSteps = 1;
+
+    /* Enumerate the blocks in a spiraling pattern */
+    int blockCount = m_numBlocks.x() * m_numBlocks.y();
+    Point2i block(m_numBlocks / 2);
+    int direction = ERight, stepsLeft = 1, numSteps = 1;
+
+    while (true)
+    {
+        m_blocks.push_back(block);
+        if ((int)m_blocks.size() == blockCount)
+            break;
+
+        do
+        {
+            switch (direction)
+            {
+            case ERight:
+                ++block.x();
+                break;
+            case EDown:
+                ++block.y();
+                break;
+            case ELeft:
+                --block.x();
+                break;
+            case EUp:
+                --block.y();
+                break;
+            }
+
+            if (--stepsLeft == 0)
+            {
+                direction = (direction + 1) % 4;
+                if (direction == ELeft || direction == ERight)
+                    ++numSteps;
+                stepsLeft = numSteps;
+            }
+        } while ((block.array() < 0).any() ||
+                 (block.array() >= m_numBlocks.array()).any());
+    }
+
+    m_first = 0;
+    m_last = blockCount;
+    setPartitionCount(1);
 }
 
-bool BlockGenerator::next(ImageBlock &block)
+void BlockGenerator::setPartitionCount(int count)
 {
-    tbb::mutex::scoped_lock lock(m_mutex);
+    m_partitions.resize(std::max(count, 1));
+    m_partitionNext.reset(new std::atomic<int>[m_partitions.size()]);
+    reset();
+}
 
-    if (m_blocksLeft == 0)
-        return false;
+void BlockGenerator::setCropWindow(const Point2i &offset, const Vector2i &size)
+{
+    m_cropOffset = offset.cwiseMax(Point2i(0, 0));
+    m_cropSize = (offset + size).cwiseMin(m_size) - m_cropOffset;
+    reset();
+}
 
-    Point2i pos = m_block * m_blockSize;
-    block.setOffset(pos);
-    block.setSize((m_size - pos).cwiseMin(Vector2i::Constant(m_blockSize)));
+void BlockGenerator::setBlockRange(int first, int last)
+{
+    m_first = std::max(first, 0);
+    m_last = std::min(last, (int)m_blocks.size());
+    reset();
+}
 
-    if (--m_blocksLeft == 0)
-        return true;
+bool BlockGenerator::getRegion(int index, Point2i &offset, Vector2i &size) const
+{
+    /* Intersect the block with the crop window */
+    Point2i start = (m_blocks[index] * m_blockSize).cwiseMax(m_cropOffset);
+    Point2i end = ((m_blocks[index] + Point2i(1, 1)) * m_blockSize)
+                      .cwiseMin(m_size)
+                      .cwiseMin(m_cropOffset + m_cropSize);
+    offset = start;
+    size = end - start;
+    return (size.array() > 0).all();
+}
 
-    do
+void BlockGenerator::reset()
+{
+    tbb::mutex::scoped_lock lock(m_mutex);
+    m_next = m_first;
+    m_blockCount = 0;
+    for (auto &partition : m_partitions)
+        partition.clear();
+    Point2i offset;
+    Vector2i size;
+    for (int i = m_first; i < m_last; ++i)
     {
-        switch (m_direction)
+        if (getRegion(i, offset, size))
         {
-        case ERight:
-            ++m_block.x();
-            break;
-        case EDown:
-            ++m_block.y();
-            break;
-        case ELeft:
-            --m_block.x();
-            break;
-        case EUp:
-            --m_block.y();
-            break;
+            m_blockCount++;
+            m_partitions[m_blocks[i].y() % m_partitions.size()].push_back(i);
         }
+    }
+    for (size_t i = 0; i < m_partitions.size(); ++i)
+        m_partitionNext[i] = 0;
+}
 
-        if (--m_stepsLeft == 0)
+bool BlockGenerator::next(ImageBlock &block)
+{
+    tbb::mutex::scoped_lock lock(m_mutex);
+
+    Point2i offset;
+    Vector2i size;
+    while (m_next < m_last)
+    {
+        if (getRegion(m_next++, offset, size))
         {
-            m_direction = (m_direction + 1) % 4;
-            if (m_direction == ELeft || m_direction == ERight)
-                ++m_numSteps;
-            m_stepsLeft = m_numSteps;
+            block.setOffset(offset);
+            block.setSize(size);
+            return true;
         }
-    } while ((m_block.array() < 0).any() ||
-             (m_block.array() >= m_numBlocks.array()).any());
+    }
+
+    return false;
+}
+
+bool BlockGenerator::next(ImageBlock &block, int partition)
+{
+    const std::vector<int> &blocks = m_partitions[partition];
+    int index = m_partitionNext[partition]++;
+    if (index >= (int)blocks.size())
+        return false;
 
+    Point2i offset;
+    Vector2i size;
+    getRegion(blocks[index], offset, size);
+    block.setOffset(offset);
+    block.setSize(size);
     return true;
 }
 
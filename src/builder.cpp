@@ -0,0 +1,105 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/builder.h>
+#include <nori/mesh.h>
+#include <nori/scene.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/// Triangle mesh whose contents are copied from memory
+class MemoryMesh : public Mesh
+{
+public:
+    MemoryMesh(const std::string &name,
+               const float *positions, uint32_t vertexCount,
+               const uint32_t *indices, uint32_t triangleCount,
+               const float *normals, const float *texcoords)
+    {
+        m_name = name;
+        m_V = Eigen::Map<const MatrixXf>(positions, 3, vertexCount);
+        m_F = Eigen::Map<const MatrixXu>(indices, 3, triangleCount);
+        if (normals)
+            m_N = Eigen::Map<const MatrixXf>(normals, 3, vertexCount);
+        if (texcoords)
+            m_UV = Eigen::Map<const MatrixXf>(texcoords, 2, vertexCount);
+
+        for (uint32_t i = 0; i < triangleCount; ++i)
+            for (int j = 0; j < 3; ++j)
+                if (m_F(j, i) >= vertexCount)
+                    throw NoriException("Mesh \"%s\": vertex index %i of triangle %i is out of range!",
+                                        name, m_F(j, i), i);
+
+        for (uint32_t i = 0; i < vertexCount; ++i)
+            m_bbox.expandBy(Point3f(m_V.col(i)));
+    }
+};
+
+SceneBuilder::~SceneBuilder()
+{
+    for (NoriObject *object : m_objects)
+        delete object;
+}
+
+NoriObject *SceneBuilder::create(const std::string &type, const PropertyList &propList,
+                                 const std::vector<NoriObject *> &children)
+{
+    std::unique_ptr<NoriObject> result(NoriObjectFactory::createInstance(type, propList));
+    for (NoriObject *child : children)
+    {
+        result->addChild(child);
+        child->setParent(result.get());
+    }
+    result->activate();
+    return result.release();
+}
+
+Mesh *SceneBuilder::addMesh(const std::string &name,
+                            const float *positions, uint32_t vertexCount,
+                            const uint32_t *indices, uint32_t triangleCount,
+                            const float *normals, const float *texcoords,
+                            NoriObject *bsdf, NoriObject *emitter)
+{
+    std::unique_ptr<Mesh> mesh(new MemoryMesh(name, positions, vertexCount, indices,
+                                              triangleCount, normals, texcoords));
+    for (NoriObject *child : {bsdf, emitter})
+    {
+        if (!child)
+            continue;
+        mesh->addChild(child);
+        child->setParent(mesh.get());
+    }
+    mesh->activate();
+    m_objects.push_back(mesh.get());
+    return mesh.release();
+}
+
+void SceneBuilder::add(NoriObject *object)
+{
+    m_objects.push_back(object);
+}
+
+Scene *SceneBuilder::build()
+{
+    std::vector<NoriObject *> objects;
+    objects.swap(m_objects);
+    return static_cast<Scene *>(create("scene", PropertyList(), objects));
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,186 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/checkpoint.h>
+#include <nori/trace.h>
+#include <cstdio>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+/* Identifies checkpoint files, followed by a format version */
+static const char CheckpointMagic[8] = {'N', 'O', 'R', 'I', 'C', 'K', 'P', 'T'};
+static const uint32_t CheckpointVersion = 1;
+
+Checkpoint::Checkpoint(const std::string &filename, ImageBlock &result,
+                       const std::string &description, float interval)
+    : m_filename(filename), m_description(description), m_result(result), m_interval(interval),
+      m_snapshot(Vector2i(0, 0), nullptr)
+{
+    m_writer = std::thread([this]
+                           { writer(); });
+}
+
+Checkpoint::~Checkpoint()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        m_shutdown = true;
+    }
+    m_cond.notify_all();
+    m_writer.join();
+}
+
+bool Checkpoint::resume()
+{
+    std::ifstream is(m_filename, std::ios::binary);
+    if (!is)
+        return false;
+
+    char magic[8];
+    uint32_t version = 0, length = 0, count = 0;
+    is.read(magic, sizeof(magic));
+    is.read(reinterpret_cast<char *>(&version), sizeof(version));
+    if (!is || !std::equal(magic, magic + 8, CheckpointMagic) || version != CheckpointVersion)
+        throw NoriException("\"%s\" is not a valid checkpoint file!", m_filename);
+
+    is.read(reinterpret_cast<char *>(&length), sizeof(length));
+    std::string description(length, '\0');
+    is.read(&description[0], length);
+    if (!is || description != m_description)
+        throw NoriException("The checkpoint \"%s\" was created with different render settings!", m_filename);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    is.read(reinterpret_cast<char *>(&count), sizeof(count));
+    m_finished.clear();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        int32_t offset[2];
+        is.read(reinterpret_cast<char *>(offset), sizeof(offset));
+        m_finished.insert(std::make_pair(offset[0], offset[1]));
+    }
+    if (!is)
+        throw NoriException("The checkpoint \"%s\" is truncated!", m_filename);
+
+    m_result.unserialize(is);
+    m_resumedBlocks = m_finished.size();
+    return true;
+}
+
+bool Checkpoint::isFinished(const Point2i &offset) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_finished.count(std::make_pair(offset.x(), offset.y())) > 0;
+}
+
+void Checkpoint::put(ImageBlock &block)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_result.put(block);
+    m_finished.insert(std::make_pair(block.getOffset().x(), block.getOffset().y()));
+
+    if (m_timer.elapsed() >= m_interval * 1000)
+    {
+        snapshot();
+        m_timer.reset();
+    }
+}
+
+void Checkpoint::snapshot()
+{
+    {
+        /* Skip this snapshot if the previous one is still being written */
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        if (m_pending)
+            return;
+    }
+
+    {
+        TraceScope trace("Checkpoint snapshot");
+        m_snapshot.copyFrom(m_result);
+        m_snapshotFinished = m_finished;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        m_pending = true;
+    }
+    m_cond.notify_all();
+}
+
+void Checkpoint::write()
+{
+    TraceScope trace("Checkpoint write");
+
+    /* Write to a temporary file first, so that an interruption
+       never leaves behind a partially written checkpoint */
+    std::string tempName = m_filename + ".tmp";
+    std::ofstream os(tempName, std::ios::binary);
+    uint32_t length = (uint32_t)m_description.size(), count = (uint32_t)m_snapshotFinished.size();
+    os.write(CheckpointMagic, sizeof(CheckpointMagic));
+    os.write(reinterpret_cast<const char *>(&CheckpointVersion), sizeof(CheckpointVersion));
+    os.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    os.write(m_description.data(), length);
+    os.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    for (const auto &offset : m_snapshotFinished)
+    {
+        int32_t values[2] = {offset.first, offset.second};
+        os.write(reinterpret_cast<const char *>(values), sizeof(values));
+    }
+    m_snapshot.serialize(os);
+    os.close();
+    if (!os)
+        cerr << "Warning: unable to write the checkpoint file \"" << tempName << "\"" << endl;
+    else if (std::rename(tempName.c_str(), m_filename.c_str()) != 0)
+    {
+        /* Windows does not replace existing files */
+        std::remove(m_filename.c_str());
+        if (std::rename(tempName.c_str(), m_filename.c_str()) != 0)
+            cerr << "Warning: unable to create the checkpoint file \"" << m_filename << "\"" << endl;
+    }
+}
+
+void Checkpoint::writer()
+{
+    std::unique_lock<std::mutex> lock(m_writerMutex);
+    while (true)
+    {
+        m_cond.wait(lock, [this]
+                    { return m_shutdown || m_pending; });
+        if (!m_pending)
+            break;
+
+        lock.unlock();
+        write();
+        lock.lock();
+        m_pending = false;
+        m_cond.notify_all();
+    }
+}
+
+void Checkpoint::remove()
+{
+    {
+        std::unique_lock<std::mutex> lock(m_writerMutex);
+        m_cond.wait(lock, [this]
+                    { return !m_pending; });
+    }
+    std::remove(m_filename.c_str());
+}
+
+NORI_NAMESPACE_END
@@ -20,6 +20,9 @@
 #include <nori/warp.h>
 #include <pcg32.h>
 #include <hypothesis.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
 #include <fstream>
 #include <memory>
 
@@ -80,7 +83,7 @@ public:
             delete bsdf;
     }
 
-    void addChild(NoriObject *obj)
+    void addChild(NoriObject *obj, const std::string &name = "none")
     {
         switch (obj->getClassType())
         {
@@ -97,111 +100,71 @@ public:
     /// Execute the chi-square test
     void activate()
     {
-        int passed = 0, total = 0, res = m_cosThetaResolution * m_phiResolution;
+        int passed = 0, res = m_cosThetaResolution * m_phiResolution;
         pcg32 random; /* Pseudorandom number generator */
 
-        std::unique_ptr<double[]> obsFrequencies(new double[res]);
-        std::unique_ptr<double[]> expFrequencies(new double[res]);
-
-        /* Test each registered BSDF */
+        /* Each provided BSDF is tested for several incident directions. These
+           directions are drawn up front and in a fixed order, so that the
+           individual tests can then run concurrently while the results stay
+           deterministic for a fixed seed. */
+        std::vector<TestCase> tests;
         for (auto bsdf : m_bsdfs)
         {
-            /* Run several tests per BSDF to be on the safe side */
             for (int l = 0; l < m_testCount; ++l)
             {
-                memset(obsFrequencies.get(), 0, res * sizeof(double));
-                memset(expFrequencies.get(), 0, res * sizeof(double));
-
-                cout << "------------------------------------------------------" << endl;
-                cout << "Testing: " << bsdf->toString() << endl;
-                ++total;
-
                 float cosTheta = random.nextFloat();
                 float sinTheta = std::sqrt(std::max((float)0, 1 - cosTheta * cosTheta));
                 float sinPhi, cosPhi;
                 sincosf(2.0f * M_PI * random.nextFloat(), &sinPhi, &cosPhi);
-                Vector3f wi(cosPhi * sinTheta, sinPhi * sinTheta, cosTheta);
-
-                cout << "Accumulating " << m_sampleCount << " samples into a " << m_cosThetaResolution
-                     << "x" << m_phiResolution << " contingency table .. ";
-                cout.flush();
-
-                /* Generate many samples from the BSDF and create
-                   a histogram / contingency table */
-                BSDFQueryRecord bRec(wi);
-                for (int i = 0; i < m_sampleCount; ++i)
-                {
-                    Point2f sample(random.nextFloat(), random.nextFloat());
-                    Color3f result = bsdf->sample(bRec, sample);
-
-                    if ((result.array() == 0).all())
-                        continue;
-
-                    int cosThetaBin = std::min(std::max(0, (int)std::floor((bRec.wo.z() * 0.5f + 0.5f) * m_cosThetaResolution)), m_cosThetaResolution - 1);
-
-                    float scaledPhi = std::atan2(bRec.wo.y(), bRec.wo.x()) * INV_TWOPI;
-                    if (scaledPhi < 0)
-                        scaledPhi += 1;
 
-                    int phiBin = std::min(std::max(0,
-                                                   (int)std::floor(scaledPhi * m_phiResolution)),
-                                          m_phiResolution - 1);
-                    obsFrequencies[cosThetaBin * m_phiResolution + phiBin] += 1;
-                }
-                cout << "done." << endl;
-
-                /* Numerically integrate the probability density
-                   function over rectangles in spherical coordinates. */
-                double *ptr = expFrequencies.get();
-                cout << "Integrating expected frequencies .. ";
-                cout.flush();
-                for (int i = 0; i < m_cosThetaResolution; ++i)
-                {
-                    double cosThetaStart = -1.0 + i * 2.0 / m_cosThetaResolution;
-                    double cosThetaEnd = -1.0 + (i + 1) * 2.0 / m_cosThetaResolution;
-                    for (int j = 0; j < m_phiResolution; ++j)
-                    {
-                        double phiStart = j * 2 * M_PI / m_phiResolution;
-                        double phiEnd = (j + 1) * 2 * M_PI / m_phiResolution;
+                TestCase test;
+                test.bsdf = bsdf;
+                test.wi = Vector3f(cosPhi * sinTheta, sinPhi * sinTheta, cosTheta);
+                test.obsFrequencies.resize(res);
+                test.expFrequencies.resize(res);
+                tests.push_back(std::move(test));
+            }
+        }
 
-                        auto integrand = [&](double cosTheta, double phi) -> double
-                        {
-                            double sinTheta = std::sqrt(1 - cosTheta * cosTheta);
-                            double sinPhi = std::sin(phi), cosPhi = std::cos(phi);
+        cout << "Running " << tests.size() << " tests, accumulating " << m_sampleCount
+             << " samples into a " << m_cosThetaResolution << "x" << m_phiResolution
+             << " contingency table each .. ";
+        cout.flush();
 
-                            Vector3f wo((float)(sinTheta * cosPhi),
-                                        (float)(sinTheta * sinPhi),
-                                        (float)cosTheta);
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, tests.size(), 1),
+                          [&](const tbb::blocked_range<size_t> &range)
+                          {
+                              for (size_t t = range.begin(); t != range.end(); ++t)
+                                  runTest(tests[t], (uint64_t)t);
+                          });
 
-                            BSDFQueryRecord bRec(wi, wo, Vector2f(), ESolidAngle);
-                            return bsdf->pdf(bRec);
-                        };
+        cout << "done." << endl;
 
-                        double integral = hypothesis::adaptiveSimpson2D(
-                            integrand, cosThetaStart, phiStart, cosThetaEnd,
-                            phiEnd);
+        /* Report the results in the order in which the tests were declared */
+        for (size_t t = 0; t < tests.size(); ++t)
+        {
+            const TestCase &test = tests[t];
+            int index = (int)t + 1;
 
-                        *ptr++ = integral * m_sampleCount;
-                    }
-                }
-                cout << "done." << endl;
+            cout << "------------------------------------------------------" << endl;
+            cout << "Testing: " << test.bsdf->toString() << endl;
 
-                /* Write the test input data to disk for debugging */
-                hypothesis::chi2_dump(m_cosThetaResolution, m_phiResolution, obsFrequencies.get(), expFrequencies.get(),
-                                      tfm::format("chi2test_%i.m", total));
+            /* Write the test input data to disk for debugging */
+            hypothesis::chi2_dump(m_cosThetaResolution, m_phiResolution, test.obsFrequencies.data(),
+                                  test.expFrequencies.data(), tfm::format("chi2test_%i.m", index));
 
-                /* Perform the Chi^2 test */
-                std::pair<bool, std::string> result =
-                    hypothesis::chi2_test(m_cosThetaResolution * m_phiResolution, obsFrequencies.get(), expFrequencies.get(),
-                                          m_sampleCount, m_minExpFrequency, m_significanceLevel, m_testCount * (int)m_bsdfs.size());
+            /* Perform the Chi^2 test */
+            std::pair<bool, std::string> result =
+                hypothesis::chi2_test(res, test.obsFrequencies.data(), test.expFrequencies.data(),
+                                      m_sampleCount, m_minExpFrequency, m_significanceLevel, m_testCount * (int)m_bsdfs.size());
 
-                if (result.first)
-                    ++passed;
+            if (result.first)
+                ++passed;
 
-                cout << result.second << endl;
-            }
+            cout << result.second << endl;
         }
 
+        int total = (int)tests.size();
         cout << "Passed " << passed << "/" << total << " tests." << endl;
         if (passed < total)
             throw std::runtime_error("Some tests failed :(");
@@ -228,6 +191,109 @@ public:
     EClassType getClassType() const { return ETest; }
 
 private:
+    /// Input and output data of a single chi^2 test
+    struct TestCase
+    {
+        const BSDF *bsdf;
+        Vector3f wi;
+        std::vector<double> obsFrequencies;
+        std::vector<double> expFrequencies;
+    };
+
+    /// Fill the observed and expected frequencies of a test (thread-safe)
+    void runTest(TestCase &test, uint64_t testIndex) const
+    {
+        const BSDF *bsdf = test.bsdf;
+        const Vector3f wi = test.wi;
+        int res = m_cosThetaResolution * m_phiResolution;
+        int chunkCount = (m_sampleCount + SAMPLE_CHUNK_SIZE - 1) / SAMPLE_CHUNK_SIZE;
+
+        /* Generate many samples from the BSDF and create a histogram /
+           contingency table. Every chunk of samples draws from its own
+           random number stream, which only depends on the test and chunk
+           index. The splitting of the deterministic reduction is fixed as
+           well, hence the histogram does not depend on the thread count. */
+        test.obsFrequencies = tbb::parallel_deterministic_reduce(
+            tbb::blocked_range<int>(0, chunkCount, 1),
+            std::vector<double>(res, 0.0),
+            [&](const tbb::blocked_range<int> &range, std::vector<double> histogram)
+            {
+                for (int chunk = range.begin(); chunk != range.end(); ++chunk)
+                {
+                    pcg32 random((uint64_t)chunk, testIndex);
+                    int start = chunk * SAMPLE_CHUNK_SIZE,
+                        end = std::min(start + SAMPLE_CHUNK_SIZE, m_sampleCount);
+
+                    BSDFQueryRecord bRec(wi);
+                    for (int i = start; i < end; ++i)
+                    {
+                        Point2f sample(random.nextFloat(), random.nextFloat());
+                        Color3f result = bsdf->sample(bRec, sample);
+
+                        if ((result.array() == 0).all())
+                            continue;
+
+                        int cosThetaBin = std::min(std::max(0, (int)std::floor((bRec.wo.z() * 0.5f + 0.5f) * m_cosThetaResolution)), m_cosThetaResolution - 1);
+
+                        float scaledPhi = std::atan2(bRec.wo.y(), bRec.wo.x()) * INV_TWOPI;
+                        if (scaledPhi < 0)
+                            scaledPhi += 1;
+
+                        int phiBin = std::min(std::max(0,
+                                                       (int)std::floor(scaledPhi * m_phiResolution)),
+                                              m_phiResolution - 1);
+                        histogram[cosThetaBin * m_phiResolution + phiBin] += 1;
+                    }
+                }
+                return histogram;
+            },
+            [](std::vector<double> h1, const std::vector<double> &h2)
+            {
+                for (size_t i = 0; i < h1.size(); ++i)
+                    h1[i] += h2[i];
+                return h1;
+            });
+
+        /* Numerically integrate the probability density
+           function over rectangles in spherical coordinates.
+           Every cell is independent and writes its own entry. */
+        double *expFrequencies = test.expFrequencies.data();
+        tbb::parallel_for(tbb::blocked_range<int>(0, res, 1),
+                          [&](const tbb::blocked_range<int> &range)
+                          {
+                              for (int cell = range.begin(); cell != range.end(); ++cell)
+                              {
+                                  int i = cell / m_phiResolution, j = cell % m_phiResolution;
+                                  double cosThetaStart = -1.0 + i * 2.0 / m_cosThetaResolution;
+                                  double cosThetaEnd = -1.0 + (i + 1) * 2.0 / m_cosThetaResolution;
+                                  double phiStart = j * 2 * M_PI / m_phiResolution;
+                                  double phiEnd = (j + 1) * 2 * M_PI / m_phiResolution;
+
+                                  auto integrand = [&](double cosTheta, double phi) -> double
+                                  {
+                                      double sinTheta = std::sqrt(1 - cosTheta * cosTheta);
+                                      double sinPhi = std::sin(phi), cosPhi = std::cos(phi);
+
+                                      Vector3f wo((float)(sinTheta * cosPhi),
+                                                  (float)(sinTheta * sinPhi),
+                                                  (float)cosTheta);
+
+                                      BSDFQueryRecord bRec(wi, wo, Vector2f(), ESolidAngle);
+                                      return bsdf->pdf(bRec);
+                                  };
+
+                                  double integral = hypothesis::adaptiveSimpson2D(
+                                      integrand, cosThetaStart, phiStart, cosThetaEnd,
+                                      phiEnd);
+
+                                  expFrequencies[cell] = integral * m_sampleCount;
+                              }
+                          });
+    }
+
+    /// Number of BSDF samples that share one random number stream
+    static const int SAMPLE_CHUNK_SIZE = 65536;
+
     int m_cosThetaResolution;
     int m_phiResolution;
     int m_minExpFrequency;
@@ -0,0 +1,174 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/denoiser.h>
+#include <nori/bsdf.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Albedo values below this threshold are not divided out of the image
+#define ALBEDO_EPSILON 1e-2f
+
+FeatureBuffer::FeatureBuffer(const Vector2i &size)
+    : m_size(size), m_pixels((size_t)size.x() * (size_t)size.y()) {}
+
+void FeatureBuffer::put(const Point2i &pixel, const Color3f &value, const Intersection *its)
+{
+    if (!value.isValid())
+        return;
+
+    Pixel &p = m_pixels[pixel.y() * m_size.x() + pixel.x()];
+
+    if (its)
+    {
+        const BSDF *bsdf = its->mesh->getBSDF();
+        if (its->mesh->isEmitter() || !bsdf)
+            p.albedo += Color3f(1.0f);
+        else
+            p.albedo += bsdf->getAlbedo(its->uv);
+        p.normal += its->shFrame.n;
+        p.depth += its->t;
+    }
+
+    float lum = value.getLuminance();
+    p.lum += lum;
+    p.lum2 += lum * lum;
+    p.count += 1;
+}
+
+float FeatureBuffer::getVariance(int x, int y) const
+{
+    const Pixel &p = get(x, y);
+    if (p.count < 2)
+        return 0.f;
+    float mean = p.lum / p.count;
+    float sampleVariance = std::max(0.f, (p.lum2 - p.count * mean * mean) / (p.count - 1));
+    return sampleVariance / p.count;
+}
+
+Bitmap *Denoiser::denoise(const Bitmap &image, const FeatureBuffer &features) const
+{
+    int width = (int)image.cols(), height = (int)image.rows();
+    if (features.getSize() != Vector2i(width, height))
+        throw NoriException("Denoiser: the feature buffer does not match the image size!");
+
+    /* Remove the albedo, and precompute per-pixel features */
+    Bitmap irradiance(Vector2i(width, height));
+    std::vector<Color3f> albedo(width * height);
+    std::vector<Normal3f> normal(width * height);
+    std::vector<float> depth(width * height), variance(width * height);
+
+    tbb::parallel_for(tbb::blocked_range<int>(0, height), [&](const tbb::blocked_range<int> &range)
+                      {
+        for (int y = range.begin(); y < range.end(); ++y) {
+            for (int x = 0; x < width; ++x) {
+                int i = y * width + x;
+                albedo[i] = features.getAlbedo(x, y);
+                normal[i] = features.getNormal(x, y);
+                depth[i] = features.getDepth(x, y);
+
+                Color3f a = albedo[i].max(ALBEDO_EPSILON);
+                irradiance(y, x) = image(y, x) / a;
+
+                /* The variance was estimated from the (modulated) luminance */
+                float lum = a.getLuminance();
+                variance[i] = features.getVariance(x, y) / (lum * lum);
+            }
+        } });
+
+    /* The color term compares 3x3 box filtered versions of the irradiance,
+       which are far more reliable at low sample counts. Their variance is
+       correspondingly lower; the variance estimates are smoothed as well */
+    Bitmap guide(Vector2i(width, height));
+    std::vector<float> guideVariance(width * height);
+    tbb::parallel_for(tbb::blocked_range<int>(0, height), [&](const tbb::blocked_range<int> &range)
+                      {
+        for (int y = range.begin(); y < range.end(); ++y) {
+            for (int x = 0; x < width; ++x) {
+                Color3f sum(0.f);
+                float varianceSum = 0.f;
+                int count = 0;
+                for (int qy = std::max(0, y - 1); qy <= std::min(height - 1, y + 1); ++qy) {
+                    for (int qx = std::max(0, x - 1); qx <= std::min(width - 1, x + 1); ++qx) {
+                        sum += irradiance(qy, qx);
+                        varianceSum += variance[qy * width + qx];
+                        count++;
+                    }
+                }
+                guide(y, x) = sum / count;
+                guideVariance[y * width + x] = varianceSum / (count * count);
+            }
+        } });
+
+    /* Precompute the spatial weights */
+    std::vector<float> spatial(2 * radius + 1);
+    for (int d = -radius; d <= radius; ++d)
+        spatial[d + radius] = std::exp(-(d * d) / (2 * sigmaSpatial * sigmaSpatial));
+
+    float invAlbedo = 1.f / (2 * sigmaAlbedo * sigmaAlbedo);
+    float invNormal = 1.f / (2 * sigmaNormal * sigmaNormal);
+    float invDepth = 1.f / (2 * sigmaDepth * sigmaDepth);
+
+    Bitmap *result = new Bitmap(Vector2i(width, height));
+
+    tbb::parallel_for(tbb::blocked_range<int>(0, height), [&](const tbb::blocked_range<int> &range)
+                      {
+        for (int y = range.begin(); y < range.end(); ++y) {
+            for (int x = 0; x < width; ++x) {
+                int p = y * width + x;
+                const Color3f &cp = guide(y, x);
+                float vp = guideVariance[p];
+                float dp = depth[p];
+                Color3f sum(0.f);
+                float weightSum = 0.f;
+
+                for (int qy = std::max(0, y - radius); qy <= std::min(height - 1, y + radius); ++qy) {
+                    float wy = spatial[qy - y + radius];
+                    for (int qx = std::max(0, x - radius); qx <= std::min(width - 1, x + radius); ++qx) {
+                        int q = qy * width + qx;
+                        const Color3f &cq = guide(qy, qx);
+                        float vq = guideVariance[q];
+
+                        /* Color distance, corrected for the expected difference due to noise */
+                        float colorDist = (cp - cq).matrix().squaredNorm() / 3.f;
+                        colorDist = std::max(0.f, colorDist - (vp + std::min(vp, vq))) /
+                                    (Epsilon + sigmaColor * sigmaColor * (vp + vq));
+
+                        float albedoDist = (albedo[p] - albedo[q]).matrix().squaredNorm() * invAlbedo;
+                        float normalDist = (normal[p] - normal[q]).squaredNorm() * invNormal;
+                        float depthDist = dp > 0 ? (dp - depth[q]) * (dp - depth[q]) / (dp * dp) * invDepth
+                                                 : (depth[q] > 0 ? std::numeric_limits<float>::infinity() : 0.f);
+
+                        float weight = wy * spatial[qx - x + radius] *
+                                       std::exp(-(colorDist + albedoDist + normalDist + depthDist));
+                        sum += weight * irradiance(qy, qx);
+                        weightSum += weight;
+                    }
+                }
+
+                Color3f a = albedo[p].max(ALBEDO_EPSILON);
+                result->coeffRef(y, x) = weightSum > 0 ? Color3f(sum / weightSum * a) : image(y, x);
+            }
+        } });
+
+    return result;
+}
+
+NORI_NAMESPACE_END
@@ -18,10 +18,13 @@
 
 #include <nori/bsdf.h>
 #include <nori/frame.h>
+#include <nori/stats.h>
 #include <nori/reflectance.h>
 
 NORI_NAMESPACE_BEGIN
 
+NORI_STAT_COUNTER(statsSamples, "BSDF samples", "dielectric");
+
 /// Ideal dielectric BSDF
 class Dielectric : public BSDF
 {
@@ -49,20 +52,26 @@ public:
 
     Color3f sample(BSDFQueryRecord &bRec, const Point2f &sample) const
     {
+        NORI_STAT_INC(statsSamples);
 
         float cosThetaI = Frame::cosTheta(bRec.wi);
         float F = Reflectance::fresnel(cosThetaI, m_extIOR, m_intIOR);
 
         bRec.measure = EDiscrete;
 
+        /* Discrete BSDFs always have a zero density in Nori */
+        bRec.pdf = 0.0f;
+
         if (sample[0] < F) // Reflect
         {
+            bRec.lobe = EDeltaReflection;
             bRec.eta = 1;
             bRec.wo = Vector3f(-bRec.wi.x(), -bRec.wi.y(), bRec.wi.z());
             return 1;
         }
         else
         {
+            bRec.lobe = EDeltaTransmission;
             bRec.wo = Reflectance::refract(bRec.wi, Vector3f(0, 0, 1), m_extIOR, m_intIOR);
             if (cosThetaI < 0.0f)
                 bRec.eta = m_extIOR / m_intIOR;
@@ -21,11 +21,14 @@
 
 #include <nori/bsdf.h>
 #include <nori/frame.h>
+#include <nori/stats.h>
 #include <nori/warp.h>
 #include <nori/texture.h>
 
 NORI_NAMESPACE_BEGIN
 
+NORI_STAT_COUNTER(statsSamples, "BSDF samples", "diffuse");
+
 /**
  * \brief Diffuse / Lambertian BRDF model
  */
@@ -46,7 +49,7 @@ public:
             return Color3f(0.0f);
 
         /* The BRDF is simply the albedo / pi */
-        return m_albedo->eval(bRec.uv) * INV_PI;
+        return getAlbedo(bRec) * INV_PI;
     }
 
     /// Compute the density of \ref sample() wrt. solid angles
@@ -66,24 +69,41 @@ public:
         return INV_PI * Frame::cosTheta(bRec.wo);
     }
 
+    /// Evaluate the BRDF model and the density of \ref sample()
+    Color3f evalWithPdf(const BSDFQueryRecord &bRec, float &pdf) const
+    {
+        if (bRec.measure != ESolidAngle || Frame::cosTheta(bRec.wi) <= 0 || Frame::cosTheta(bRec.wo) <= 0)
+        {
+            pdf = 0.0f;
+            return Color3f(0.0f);
+        }
+
+        pdf = INV_PI * Frame::cosTheta(bRec.wo);
+        return getAlbedo(bRec) * INV_PI;
+    }
+
     /// Draw a a sample from the BRDF model
     Color3f sample(BSDFQueryRecord &bRec, const Point2f &sample) const
     {
+        NORI_STAT_INC(statsSamples);
+
         if (Frame::cosTheta(bRec.wi) <= 0)
             return Color3f(0.0f);
 
         bRec.measure = ESolidAngle;
+        bRec.lobe = EDiffuseReflection;
 
         /* Warp a uniformly distributed sample on [0,1]^2
            to a direction on a cosine-weighted hemisphere */
         bRec.wo = Warp::squareToCosineHemisphere(sample);
+        bRec.pdf = Frame::cosTheta(bRec.wo) > 0 ? INV_PI * Frame::cosTheta(bRec.wo) : 0.0f;
 
         /* Relative index of refraction: no change */
         bRec.eta = 1.0f;
 
         /* eval() / pdf() * cos(theta) = albedo. There
            is no need to call these functions. */
-        return m_albedo->eval(bRec.uv);
+        return getAlbedo(bRec);
     }
 
     bool isDiffuse() const
@@ -91,6 +111,21 @@ public:
         return true;
     }
 
+    bool isLambertian() const
+    {
+        return true;
+    }
+
+    Color3f getAlbedo(const Point2f &uv) const
+    {
+        return m_albedo->eval(uv);
+    }
+
+    void evalClosure(const Point2f &uv, BSDFClosure &closure) const
+    {
+        closure.color = m_albedo->eval(uv);
+    }
+
     /// Return a human-readable summary
     std::string toString() const
     {
@@ -125,6 +160,12 @@ public:
     EClassType getClassType() const { return EBSDF; }
 
 private:
+    /// Return the albedo at the queried point (from the closure, if available)
+    Color3f getAlbedo(const BSDFQueryRecord &bRec) const
+    {
+        return bRec.closure ? bRec.closure->color : m_albedo->eval(bRec.uv);
+    }
+
     Texture *m_albedo;
 };
 
@@ -3,9 +3,13 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/stats.h>
 #include <nori/scene.h>
 
 NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+
 class DirectEmitterSampling : public Integrator
 {
 public:
@@ -48,6 +52,7 @@ public:
         // V function in equation term
         Ray3f shadowRay(its.p, emitterRecord.wi);
         Intersection shadowIts;
+        NORI_STAT_INC(statsShadowRays);
         if (scene->rayIntersect(shadowRay, shadowIts) && shadowIts.t <= emitterRecord.dist)
             return Lo;
 
@@ -3,9 +3,13 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/stats.h>
 #include <nori/scene.h>
 
 NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+
 class DirectMaterialSampling : public Integrator
 {
 public:
@@ -50,6 +54,7 @@ public:
         Vector3f wi = its.toWorld(bsdfRecord.wo);
         Ray3f sampledRay(its.p, wi);
         Intersection shadowIts;
+        NORI_STAT_INC(statsSecondaryRays);
         if (scene->rayIntersect(sampledRay, shadowIts))
         {
             if (shadowIts.mesh->isEmitter())
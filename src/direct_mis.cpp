@@ -3,9 +3,14 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/stats.h>
 #include <nori/scene.h>
 
 NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+
 class DirectMIS : public Integrator
 {
 public:
@@ -51,11 +56,15 @@ public:
         // bsdf sampling
         const BSDF *bsdf = its.mesh->getBSDF();
 
-        BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d), its.uv);
+        // Look up the textures of the BSDF once for all queries below
+        BSDFClosure closure;
+        bsdf->evalClosure(its.uv, closure);
+
+        BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d), its.uv, &closure);
         bsdfRecord.measure = ESolidAngle;
 
         Color3f frMats = bsdf->sample(bsdfRecord, sampler->next2D());
-        float p_matW_mat = bsdf->pdf(bsdfRecord);
+        float p_matW_mat = bsdfRecord.pdf;
 
         // Here perform a visibility query, to check whether the light
         // source "em" is visible from the intersection point.
@@ -64,14 +73,15 @@ public:
         // V function in equation term
         Ray3f shadowRay(its.p, emitterRecord.wi);
         Intersection shadowItsEms;
+        NORI_STAT_INC(statsShadowRays);
         if (!(scene->rayIntersect(shadowRay, shadowItsEms) && shadowItsEms.t <= emitterRecord.dist))
         {
             BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d),
-                                       its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
+                                       its.toLocal(emitterRecord.wi), its.uv, ESolidAngle, &closure);
 
             float cosTheta = its.shFrame.n.dot(emitterRecord.wi);
-            float p_mat_Wem = bsdf->pdf(bsdfRecord);
-            Color3f frEms = its.mesh->getBSDF()->eval(bsdfRecord);
+            float p_mat_Wem;
+            Color3f frEms = bsdf->evalWithPdf(bsdfRecord, p_mat_Wem);
             float wem = p_emW_em / (p_emW_em + p_mat_Wem);
 
             Lo += wem * ((LiEms * frEms * cosTheta) / p_emW_em);
@@ -84,6 +94,7 @@ public:
         Vector3f wi = its.toWorld(bsdfRecord.wo);
         Ray3f sampledRay(its.p, wi);
         Intersection shadowItsMats;
+        NORI_STAT_INC(statsSecondaryRays);
         if (scene->rayIntersect(sampledRay, shadowItsMats))
         {
             if (shadowItsMats.mesh->isEmitter())
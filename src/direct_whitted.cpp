@@ -3,7 +3,11 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/stats.h>
 NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+
 class DirectWhittedIntegrator : public Integrator
 {
 public:
@@ -19,6 +23,10 @@ public:
         if (!scene->rayIntersect(ray, its))
             return scene->getBackground(ray);
         EmitterQueryRecord emitterRecord(its.p);
+        // Look up the textures of the BSDF once for all lights
+        const BSDF *bsdf = its.mesh->getBSDF();
+        BSDFClosure closure;
+        bsdf->evalClosure(its.uv, closure);
         // Get all lights in the scene
         const std::vector<Emitter *> lights = scene->getLights();
         // Let's iterate over all emitters
@@ -33,6 +41,7 @@ public:
             // For that, we create a ray object (shadow ray),
             // and compute the intersection
             Ray3f shadowRay(its.p, emitterRecord.wi);
+            NORI_STAT_INC(statsShadowRays);
             if (scene->rayIntersect(shadowRay))
                 continue;
 
@@ -44,10 +53,10 @@ public:
             // of reference; and b) that both the incoming and outgoing
             // directions are assumed to start from the intersection point.
             BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d),
-                                       its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
+                                       its.toLocal(emitterRecord.wi), its.uv, ESolidAngle, &closure);
             // For each light, we accomulate the incident light times the
             // foreshortening times the BSDF term (i.e. the render equation).
-            Lo += Le * its.shFrame.n.dot(emitterRecord.wi) * its.mesh->getBSDF()->eval(bsdfRecord);
+            Lo += Le * its.shFrame.n.dot(emitterRecord.wi) * bsdf->eval(bsdfRecord);
         }
         return Lo;
     }
@@ -1,5 +1,6 @@
 #include <nori/gui.h>
 #include <nori/block.h>
+#include <nori/preview.h>
 #include <nanogui/glutil.h>
 #include <nanogui/label.h>
 #include <nanogui/slider.h>
@@ -7,8 +8,9 @@
 
 NORI_NAMESPACE_BEGIN
 
-NoriScreen::NoriScreen(const ImageBlock &block)
-    : nanogui::Screen(block.getSize() + Vector2i(0, 36), "Nori", false), m_block(block)
+NoriScreen::NoriScreen(const Vector2i &size)
+    : nanogui::Screen(size + Vector2i(0, 36), "Nori", false), m_block(&m_copy),
+      m_copy(Vector2i(0, 0), nullptr)
 {
     using namespace nanogui;
 
@@ -25,11 +27,11 @@ NoriScreen::NoriScreen(const ImageBlock &block)
             m_scale = std::pow(2.f, (value - 0.5f) * 20);
         });
 
-    panel->setSize(block.getSize());
+    panel->setSize(size);
     performLayout(mNVGContext);
 
     panel->setPosition(
-        Vector2i((mSize.x() - panel->size().x()) / 2, block.getSize().y()));
+        Vector2i((mSize.x() - panel->size().x()) / 2, size.y()));
 
     /* Simple gamma tonemapper as a GLSL shader */
     m_shader = new GLShader();
@@ -86,25 +88,56 @@ NoriScreen::NoriScreen(const ImageBlock &block)
     setVisible(true);
 }
 
+NoriScreen::NoriScreen(const ImageBlock &block)
+    : NoriScreen(block.getSize())
+{
+    m_block = &block;
+}
+
+NoriScreen::NoriScreen(PreviewRenderer &preview)
+    : NoriScreen(preview.getImage())
+{
+    m_preview = &preview;
+}
+
 NoriScreen::~NoriScreen()
 {
     glDeleteTextures(1, &m_texture);
     delete m_shader;
 }
 
+void NoriScreen::setBlock(const ImageBlock *block)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!block)
+    {
+        if (m_block != &m_copy)
+        {
+            m_block->lock();
+            m_copy.copyFrom(*m_block);
+            m_block->unlock();
+        }
+        block = &m_copy;
+    }
+    m_block = block;
+}
+
 void NoriScreen::drawContents()
 {
     /* Reload the partially rendered image onto the GPU */
-    m_block.lock();
-    int borderSize = m_block.getBorderSize();
-    const Vector2i &size = m_block.getSize();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Vector2i size = m_block->getSize();
+    if (size.x() == 0 || size.y() == 0)
+        return;
+    m_block->lock();
+    int borderSize = m_block->getBorderSize();
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_texture);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)m_block.cols());
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, (GLint)m_block->cols());
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, size.x(), size.y(),
-                 0, GL_RGBA, GL_FLOAT, (uint8_t *)m_block.data() + (borderSize * m_block.cols() + borderSize) * sizeof(Color4f));
+                 0, GL_RGBA, GL_FLOAT, (uint8_t *)m_block->data() + (borderSize * m_block->cols() + borderSize) * sizeof(Color4f));
     glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    m_block.unlock();
+    m_block->unlock();
 
     glViewport(0, GLsizei(36 * mPixelRatio), GLsizei(mPixelRatio * size[0]),
                GLsizei(mPixelRatio * size[1]));
@@ -115,4 +148,67 @@ void NoriScreen::drawContents()
     glViewport(0, 0, mFBSize[0], mFBSize[1]);
 }
 
+bool NoriScreen::mouseMotionEvent(const nanogui::Vector2i &p, const nanogui::Vector2i &rel, int button, int modifiers)
+{
+    if (Screen::mouseMotionEvent(p, rel, button, modifiers))
+        return true;
+    if (!m_preview)
+        return false;
+
+    if (button & (1 << GLFW_MOUSE_BUTTON_1))
+        m_preview->orbit(rel.cast<float>());
+    else if (button & (1 << GLFW_MOUSE_BUTTON_2))
+        m_preview->pan(rel.cast<float>());
+    else
+        return false;
+    return true;
+}
+
+bool NoriScreen::scrollEvent(const nanogui::Vector2i &p, const nanogui::Vector2f &rel)
+{
+    if (Screen::scrollEvent(p, rel))
+        return true;
+    if (!m_preview)
+        return false;
+
+    m_preview->dolly(rel.y());
+    return true;
+}
+
+bool NoriScreen::keyboardEvent(int key, int scancode, int action, int modifiers)
+{
+    if (Screen::keyboardEvent(key, scancode, action, modifiers))
+        return true;
+    if (!m_preview || action == GLFW_RELEASE)
+        return false;
+
+    /* Directions along the camera's right, up and forward axes */
+    Vector3f direction(0.f);
+    switch (key)
+    {
+    case GLFW_KEY_W:
+        direction.z() = 1.f;
+        break;
+    case GLFW_KEY_S:
+        direction.z() = -1.f;
+        break;
+    case GLFW_KEY_D:
+        direction.x() = 1.f;
+        break;
+    case GLFW_KEY_A:
+        direction.x() = -1.f;
+        break;
+    case GLFW_KEY_E:
+        direction.y() = 1.f;
+        break;
+    case GLFW_KEY_Q:
+        direction.y() = -1.f;
+        break;
+    default:
+        return false;
+    }
+    m_preview->fly(direction);
+    return true;
+}
+
 NORI_NAMESPACE_END
@@ -58,6 +58,13 @@ public:
             block.getOffset().y() + m_seed);
     }
 
+    void prepare(const Point2i &pixel, uint32_t pass)
+    {
+        m_random.seed(
+            ((uint64_t)pass << 32) + pixel.x() + m_seed,
+            pixel.y() + m_seed);
+    }
+
     void generate() { /* No-op for this sampler */ }
     void advance() { /* No-op for this sampler */ }
 
@@ -0,0 +1,132 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/irradiancecache.h>
+#include <Eigen/Geometry>
+
+/* Maximum depth of the octree */
+#define NORI_IRRADIANCE_MAX_DEPTH 16
+
+NORI_NAMESPACE_BEGIN
+
+IrradianceCache::IrradianceCache(const BoundingBox3f &bbox, float accuracy)
+    : m_accuracy(accuracy), m_nodes(1)
+{
+    /* Use a cube, so that the nodes have the same extents along all axes */
+    m_extent = std::max(bbox.getExtents().maxCoeff(), Epsilon) * (1 + Epsilon);
+    m_min = bbox.getCenter() - Vector3f(0.5f * m_extent);
+}
+
+void IrradianceCache::insert(const IrradianceRecord &record)
+{
+    /* The region of influence, outside of which the distance alone exceeds the accuracy */
+    float radius = m_accuracy * record.R;
+    BoundingBox3f bounds(record.p - Vector3f(radius), record.p + Vector3f(radius));
+
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, true);
+    uint32_t index = (uint32_t)m_records.size();
+    m_records.push_back(record);
+    insert(0, m_min, m_extent, 0, index, bounds);
+}
+
+void IrradianceCache::insert(uint32_t node, const Point3f &min, float size, int depth,
+                             uint32_t index, const BoundingBox3f &bounds)
+{
+    if (depth == NORI_IRRADIANCE_MAX_DEPTH || size < bounds.getExtents().x())
+    {
+        m_nodes[node].records.push_back(index);
+        return;
+    }
+
+    float half = 0.5f * size;
+    for (int i = 0; i < 8; ++i)
+    {
+        Point3f childMin = min + half * Vector3f((float)(i & 1), (float)((i >> 1) & 1), (float)(i >> 2));
+        if (!bounds.overlaps(BoundingBox3f(childMin, childMin + Vector3f(half))))
+            continue;
+
+        if (!m_nodes[node].child[i])
+        {
+            m_nodes[node].child[i] = (uint32_t)m_nodes.size();
+            m_nodes.emplace_back();
+        }
+        insert(m_nodes[node].child[i], childMin, half, depth + 1, index, bounds);
+    }
+}
+
+bool IrradianceCache::interpolate(const Point3f &p, const Normal3f &n, Color3f &E) const
+{
+    Color3f sum(0.0f);
+    float weightSum = 0.0f;
+
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, false);
+    Point3f min = m_min;
+    float size = m_extent;
+    uint32_t node = 0;
+
+    while (true)
+    {
+        for (uint32_t index : m_nodes[node].records)
+        {
+            const IrradianceRecord &record = m_records[index];
+            Vector3f d = p - record.p;
+            float error = d.norm() / record.R + std::sqrt(std::max(0.0f, 1 - n.dot(record.n)));
+            if (error >= m_accuracy)
+                continue;
+
+            /* Skip records in front of p, which see other surroundings */
+            if (0.5f * d.dot(n + record.n) < -0.05f * record.R)
+                continue;
+
+            Color3f extrapolated = record.E + (record.rotGrad * record.n.cross(n)).array() +
+                                   (record.transGrad * d).array();
+            float weight = 1 - error / m_accuracy;
+            sum += weight * extrapolated.cwiseMax(0.0f);
+            weightSum += weight;
+        }
+
+        /* Descend into the child that contains p (if p is inside the octree) */
+        float half = 0.5f * size;
+        int i = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (p[axis] >= min[axis] + half)
+            {
+                min[axis] += half;
+                i |= 1 << axis;
+            }
+        }
+        if (!m_nodes[node].child[i] || !((p - min).minCoeff() >= 0) || (p - min).maxCoeff() > half)
+            break;
+        node = m_nodes[node].child[i];
+        size = half;
+    }
+
+    if (!(weightSum > 0))
+        return false;
+    E = sum / weightSum;
+    return true;
+}
+
+size_t IrradianceCache::size() const
+{
+    tbb::spin_rw_mutex::scoped_lock lock(m_mutex, false);
+    return m_records.size();
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,387 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/emitter.h>
+#include <nori/sampler.h>
+#include <nori/bsdf.h>
+#include <nori/irradiancecache.h>
+#include <nori/stats.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+NORI_STAT_COUNTER(statsCacheLookups, "Irradiance cache", "Lookups");
+NORI_STAT_COUNTER(statsCacheRecords, "Irradiance cache", "Records created");
+
+/**
+ * \brief Irradiance caching
+ *
+ * Camera paths are traced up to the first Lambertian (\c diffuse) surface,
+ * where direct illumination is computed using next event estimation, and
+ * indirect illumination from the irradiance that is interpolated from the
+ * records of an \ref IrradianceCache. Where the cache has no valid record,
+ * a new one is computed by path tracing a stratified hemisphere of
+ * directions, which also yields the irradiance gradients and the
+ * validity radius (see "Irradiance Gradients" by Ward and Heckbert).
+ *
+ * The cache is populated by a parallel pass over the pixel centers during
+ * the preprocessing step, so that the final render mostly interpolates.
+ * The final render still creates records where necessary. Since threads
+ * insert concurrently, the set of records depends on the scheduling.
+ */
+class IrradianceCaching : public Integrator
+{
+public:
+    IrradianceCaching(const PropertyList &props)
+    {
+        /* Maximum error of the records used for interpolation (smaller: more records) */
+        m_accuracy = props.getFloat("accuracy", 0.2f);
+
+        /* Number of hemisphere rays used to compute a record */
+        m_samples = props.getInteger("samples", 256);
+
+        /* Bounds of the validity radius (0: 1/500 and 1/10 of the scene diagonal) */
+        m_minRadius = props.getFloat("min_radius", 0.0f);
+        m_maxRadius = props.getFloat("max_radius", 0.0f);
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        BoundingBox3f bbox = scene->getBoundingBox();
+        float diagonal = bbox.getExtents().norm();
+        if (m_minRadius <= 0)
+            m_minRadius = diagonal / 500.0f;
+        if (m_maxRadius <= 0)
+            m_maxRadius = diagonal / 10.0f;
+        m_cache.reset(new IrradianceCache(bbox, m_accuracy));
+
+        const Camera *camera = scene->getCamera();
+        Vector2i outputSize = camera->getOutputSize();
+        Timer timer;
+
+        tbb::parallel_for(tbb::blocked_range<int>(0, outputSize.y()), [&](const tbb::blocked_range<int> &range)
+                          {
+            std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+            for (int y = range.begin(); y < range.end(); ++y)
+            {
+                for (int x = 0; x < outputSize.x(); ++x)
+                {
+                    /* Use other random numbers than the passes of the final render */
+                    sampler->prepare(Point2i(x, y), 0x80000000u);
+
+                    Point2f pixelSample((float)x + 0.5f, (float)y + 0.5f);
+                    Ray3f ray;
+                    if (camera->sampleRay(ray, pixelSample, sampler->next2D()).isZero())
+                        continue;
+
+                    trace(scene, sampler.get(), ray, true);
+                }
+            } });
+
+        cout << tfm::format("Irradiance caching: created %i records (took %s)",
+                            m_cache->size(), timer.elapsedString())
+             << endl;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+    {
+        return trace(scene, sampler, ray, false);
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "IrradianceCaching[\n"
+            "  accuracy = %g,\n"
+            "  samples = %i,\n"
+            "  min_radius = %g,\n"
+            "  max_radius = %g\n"
+            "]",
+            m_accuracy, m_samples, m_minRadius, m_maxRadius);
+    }
+
+private:
+    /**
+     * Trace a camera path, which ends at the first Lambertian surface. When
+     * populating the cache (\c populate == true), only the irradiance at that
+     * surface is looked up, which creates a record if necessary.
+     */
+    Color3f trace(const Scene *scene, Sampler *sampler, Ray3f ray, bool populate) const
+    {
+        Color3f Li(0.0f), throughput(1.0f);
+        bool specular = true;
+
+        for (int depth = 0;; ++depth)
+        {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+            {
+                if (specular || !scene->getEnvironmentalEmitter())
+                    Li += throughput * scene->getBackground(ray);
+                break;
+            }
+
+            if (its.mesh->isEmitter())
+            {
+                if (specular)
+                {
+                    const Emitter *emitter = its.mesh->getEmitter();
+                    EmitterQueryRecord lRec(emitter, ray.o, its.p, its.shFrame.n, its.uv);
+                    Li += throughput * emitter->eval(lRec);
+                }
+                break;
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            if (!bsdf)
+                break;
+
+            /* Look up the textures of the BSDF once for all queries below */
+            BSDFClosure closure;
+            bsdf->evalClosure(its.uv, closure);
+            Vector3f wi = its.toLocal(-ray.d);
+
+            if (bsdf->isLambertian())
+            {
+                if (Frame::cosTheta(wi) <= 0)
+                    break;
+                Color3f E = irradiance(scene, sampler, its);
+                if (!populate)
+                    Li += throughput * (directLighting(scene, sampler, its, wi, bsdf, closure) +
+                                        closure.color * INV_PI * E);
+                break;
+            }
+
+            /* Other surfaces are path traced, until a Lambertian surface is found */
+            if (!populate && bsdf->isDiffuse())
+                Li += throughput * directLighting(scene, sampler, its, wi, bsdf, closure);
+            if (!scatter(its, wi, bsdf, closure, sampler, depth, ray, throughput, specular))
+                break;
+        }
+
+        return Li;
+    }
+
+    /**
+     * Path trace the radiance arriving along \c ray, and return the distance
+     * to the first intersection in \c dist. Emission that is visible at the
+     * first intersection is excluded, unless \c specular is true.
+     */
+    Color3f pathTrace(const Scene *scene, Sampler *sampler, Ray3f ray, bool specular, float &dist) const
+    {
+        Color3f Li(0.0f), throughput(1.0f);
+        dist = std::numeric_limits<float>::infinity();
+
+        for (int depth = 0;; ++depth)
+        {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+            {
+                if (specular || !scene->getEnvironmentalEmitter())
+                    Li += throughput * scene->getBackground(ray);
+                break;
+            }
+            if (depth == 0)
+                dist = its.t;
+
+            if (its.mesh->isEmitter())
+            {
+                if (specular)
+                {
+                    const Emitter *emitter = its.mesh->getEmitter();
+                    EmitterQueryRecord lRec(emitter, ray.o, its.p, its.shFrame.n, its.uv);
+                    Li += throughput * emitter->eval(lRec);
+                }
+                break;
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            if (!bsdf)
+                break;
+
+            BSDFClosure closure;
+            bsdf->evalClosure(its.uv, closure);
+            Vector3f wi = its.toLocal(-ray.d);
+
+            if (bsdf->isDiffuse())
+                Li += throughput * directLighting(scene, sampler, its, wi, bsdf, closure);
+            if (!scatter(its, wi, bsdf, closure, sampler, depth, ray, throughput, specular))
+                break;
+        }
+
+        return Li;
+    }
+
+    /// Sample the BSDF to continue a path (with Russian roulette), return false if the path ends
+    bool scatter(const Intersection &its, const Vector3f &wi, const BSDF *bsdf, const BSDFClosure &closure,
+                 Sampler *sampler, int depth, Ray3f &ray, Color3f &throughput, bool &specular) const
+    {
+        BSDFQueryRecord bRec(wi, its.uv, &closure);
+        bRec.measure = ESolidAngle;
+        Color3f weight = bsdf->sample(bRec, sampler->next2D());
+        if (weight.isZero())
+            return false;
+        throughput *= weight;
+        specular = (bRec.lobe & EDelta) != 0;
+
+        if (depth >= 3)
+        {
+            float q = std::min(throughput.maxCoeff(), 0.95f);
+            if (sampler->next1D() >= q)
+                return false;
+            throughput /= q;
+        }
+
+        NORI_STAT_INC(statsSecondaryRays);
+        ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        return true;
+    }
+
+    Color3f directLighting(const Scene *scene, Sampler *sampler, const Intersection &its,
+                           const Vector3f &wi, const BSDF *bsdf, const BSDFClosure &closure) const
+    {
+        if (scene->getLights().empty())
+            return Color3f(0.0f);
+
+        float pdfEmitter;
+        const Emitter *emitter = scene->sampleEmitter(sampler->next1D(), pdfEmitter);
+        EmitterQueryRecord lRec(its.p);
+        Color3f Le = emitter->sample(lRec, sampler->next2D(), 0.0f);
+        float pdf = pdfEmitter * emitter->pdf(lRec);
+        if (Le.isZero() || !(pdf > 0))
+            return Color3f(0.0f);
+
+        float maxt = std::isfinite(lRec.dist) ? lRec.dist * (1.0f - Epsilon) : std::numeric_limits<float>::infinity();
+        NORI_STAT_INC(statsShadowRays);
+        if (scene->rayIntersect(Ray3f(its.p, lRec.wi, Epsilon, maxt)))
+            return Color3f(0.0f);
+
+        BSDFQueryRecord bRec(wi, its.toLocal(lRec.wi), its.uv, ESolidAngle, &closure);
+        return bsdf->eval(bRec) * std::abs(Frame::cosTheta(bRec.wo)) * Le / pdf;
+    }
+
+    /// Return the indirect irradiance at \c its, and create a new record if the cache has no valid one
+    Color3f irradiance(const Scene *scene, Sampler *sampler, const Intersection &its) const
+    {
+        NORI_STAT_INC(statsCacheLookups);
+        Color3f E;
+        if (m_cache->interpolate(its.p, its.shFrame.n, E))
+            return E;
+
+        NORI_STAT_INC(statsCacheRecords);
+        IrradianceRecord record = computeRecord(scene, sampler, its);
+        m_cache->insert(record);
+        return record.E;
+    }
+
+    /**
+     * Compute the irradiance at \c its from M x N cosine-weighted strata
+     * (M along theta, N = pi M along phi), along with its gradients
+     */
+    IrradianceRecord computeRecord(const Scene *scene, Sampler *sampler, const Intersection &its) const
+    {
+        int M = std::max(1, (int)std::round(std::sqrt(m_samples * INV_PI)));
+        int N = std::max(1, (int)std::round(m_samples / (float)M));
+        std::vector<Color3f> L(M * N);
+        std::vector<float> dist(M * N), sinTheta(M * N);
+
+        Color3f sum(0.0f);
+        float invDistSum = 0.0f;
+        Eigen::Matrix3f rotGrad = Eigen::Matrix3f::Zero(), transGrad = Eigen::Matrix3f::Zero();
+
+        for (int j = 0; j < M; ++j)
+        {
+            for (int k = 0; k < N; ++k)
+            {
+                Point2f sample = sampler->next2D();
+                float sin2Theta = (j + sample.x()) / M;
+                float phi = 2 * M_PI * (k + sample.y()) / N;
+                float s = std::sqrt(sin2Theta), c = std::sqrt(std::max(0.0f, 1 - sin2Theta));
+                Vector3f d(s * std::cos(phi), s * std::sin(phi), c);
+
+                int index = j * N + k;
+                L[index] = pathTrace(scene, sampler, Ray3f(its.p, its.shFrame.toWorld(d)), false, dist[index]);
+                sinTheta[index] = s;
+                sum += L[index];
+                invDistSum += 1 / dist[index];
+
+                /* Rotating the normal towards phi + pi/2 changes the cosine by tan(theta) */
+                Vector3f v(-std::sin(phi), std::cos(phi), 0.0f);
+                rotGrad += (s / std::max(c, Epsilon)) * L[index].matrix() * v.transpose();
+            }
+        }
+
+        /* Translational gradient: changes of the solid angles of the strata,
+           where neighboring strata see different surfaces */
+        for (int k = 0; k < N; ++k)
+        {
+            float phiCenter = 2 * M_PI * (k + 0.5f) / N, phiMin = 2 * M_PI * k / N;
+            Vector3f u(std::cos(phiCenter), std::sin(phiCenter), 0.0f);
+            Vector3f v(-std::sin(phiMin), std::cos(phiMin), 0.0f);
+            int kPrev = (k + N - 1) % N;
+
+            for (int j = 0; j < M; ++j)
+            {
+                float sinThetaMin = std::sqrt(j / (float)M);
+                float cosThetaMin = std::sqrt(1 - j / (float)M);
+                float cosThetaMax = std::sqrt(std::max(0.0f, 1 - (j + 1) / (float)M));
+                int index = j * N + k;
+
+                if (j > 0)
+                {
+                    int below = (j - 1) * N + k;
+                    float weight = 2 * M_PI / N * sinThetaMin * cosThetaMin * cosThetaMin /
+                                   std::min(dist[index], dist[below]);
+                    transGrad += weight * (L[index] - L[below]).matrix() * u.transpose();
+                }
+
+                int previous = j * N + kPrev;
+                float weight = (cosThetaMin - cosThetaMax) /
+                               (std::max(sinTheta[index], Epsilon) * std::min(dist[index], dist[previous]));
+                transGrad += weight * (L[index] - L[previous]).matrix() * v.transpose();
+            }
+        }
+
+        /* Convert the gradients to world space */
+        Eigen::Matrix3f toLocal;
+        toLocal << its.shFrame.s.transpose(), its.shFrame.t.transpose(), its.shFrame.n.transpose();
+
+        IrradianceRecord record;
+        record.p = its.p;
+        record.n = its.shFrame.n;
+        record.E = sum * M_PI / (M * N);
+        record.rotGrad = rotGrad * toLocal * (M_PI / (M * N));
+        record.transGrad = transGrad * toLocal;
+
+        /* Validity radius: harmonic mean distance, limited such that the
+           gradient does not extrapolate negative values within it */
+        float R = invDistSum > 0 ? M * N / invDistSum : m_maxRadius;
+        for (int i = 0; i < 3; ++i)
+        {
+            float gradient = record.transGrad.row(i).norm();
+            if (gradient > 0)
+                R = std::min(R, record.E[i] / gradient);
+        }
+        if (R < m_minRadius)
+        {
+            record.transGrad *= R / m_minRadius;
+            R = m_minRadius;
+        }
+        record.R = std::min(R, m_maxRadius);
+        return record;
+    }
+
+    float m_accuracy;
+    int m_samples;
+    float m_minRadius;
+    float m_maxRadius;
+    std::unique_ptr<IrradianceCache> m_cache;
+};
+
+NORI_REGISTER_CLASS(IrradianceCaching, "irradiance_cache");
+NORI_NAMESPACE_END
@@ -0,0 +1,436 @@
+/*
+	This file is part of Nori, a simple educational ray tracer
+
+	Copyright (c) 2015 by Wenzel Jakob
+
+	Nori is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License Version 3
+	as published by the Free Software Foundation.
+
+	Nori is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/accel.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <atomic>
+
+/*
+ * Linear BVH construction
+ *
+ * The triangles are sorted along a Morton (Z-order) curve through the
+ * centers of their bounding boxes using a parallel radix sort. Adjacent
+ * triangles are then linked into a binary tree in linear time, following
+ * "Fast and Simple Agglomerative LBVH Construction" by Ciprian Apetrei
+ * (Computer Graphics & Visual Computing, 2014): starting at every leaf, a
+ * thread walks up the tree, and only the second thread that arrives at an
+ * inner node continues past it. Bounding boxes and SAH costs are computed
+ * on the way, which is also used to merge small subtrees into leaves.
+ *
+ * Optionally, the top of the tree is rebuilt from about
+ * LBVH_CLUSTER_COUNT subtrees using the agglomerative clustering from
+ * "Parallel Locally-Ordered Clustering for Bounding Volume Hierarchy
+ * Construction" by Meister and Bittner (IEEE TVCG, 2018). This recovers
+ * much of the quality that the Morton curve loses in the top levels,
+ * where it matters most.
+ */
+
+/// Process triangles in batches of 4K for the purpose of parallelization
+#define LBVH_GRAIN_SIZE 4096
+
+/// Morton codes with 10 bits per axis are used below this number of triangles, and 21 bits above
+#define LBVH_LONG_CODE_THRESHOLD (1u << 20)
+
+/// Maximum number of triangles that are merged into a single leaf
+#define LBVH_MAX_LEAF_SIZE 16
+
+/// Approximate number of subtrees that the top levels are rebuilt from
+#define LBVH_CLUSTER_COUNT 2048
+
+/// The nearest neighbor of a cluster is searched among this many clusters on either side
+#define LBVH_SEARCH_RADIUS 8
+
+NORI_NAMESPACE_BEGIN
+
+namespace
+{
+	/// Node of the intermediate tree, which is turned into BVH nodes at the end
+	struct LBVHNode
+	{
+		BoundingBox3f bbox;
+		n_UINT child[2];
+		n_UINT start, size; ///< Range of sorted triangles (only contiguous below the clusters)
+		float cost;			///< SAH cost of the subtree
+		bool leaf;			///< Does the BVH store this subtree as a single leaf?
+	};
+
+	/// Insert two zero bits after each of the lower 10 bits of \c x
+	uint32_t expandBits(uint32_t x)
+	{
+		x &= 0x3ff;
+		x = (x | (x << 16)) & 0x030000ff;
+		x = (x | (x << 8)) & 0x0300f00f;
+		x = (x | (x << 4)) & 0x030c30c3;
+		x = (x | (x << 2)) & 0x09249249;
+		return x;
+	}
+
+	/// Insert two zero bits after each of the lower 21 bits of \c x
+	uint64_t expandBits(uint64_t x)
+	{
+		x &= 0x1fffff;
+		x = (x | (x << 32)) & 0x001f00000000ffffull;
+		x = (x | (x << 16)) & 0x001f0000ff0000ffull;
+		x = (x | (x << 8)) & 0x100f00f00f00f00full;
+		x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+		x = (x | (x << 2)) & 0x1249249249249249ull;
+		return x;
+	}
+
+	/**
+	 * \brief Stable parallel radix sort of \c keys (and \c values) that
+	 * considers the lower \c bits bits of the keys
+	 */
+	template <typename Key>
+	void radixSort(std::vector<Key> &keys, std::vector<n_UINT> &values, int bits)
+	{
+		size_t size = keys.size(), blockCount = (size + LBVH_GRAIN_SIZE - 1) / LBVH_GRAIN_SIZE;
+		std::vector<Key> tempKeys(size);
+		std::vector<n_UINT> tempValues(size);
+		std::vector<size_t> offsets(blockCount * 256);
+
+		for (int shift = 0; shift < bits; shift += 8)
+		{
+			/* Histogram of the current digit within each block */
+			tbb::parallel_for((size_t)0, blockCount, [&](size_t block)
+							  {
+								  size_t *count = &offsets[block * 256];
+								  std::fill(count, count + 256, (size_t)0);
+								  for (size_t i = block * LBVH_GRAIN_SIZE, end = std::min(size, i + LBVH_GRAIN_SIZE); i < end; ++i)
+									  count[(keys[i] >> shift) & 0xff]++;
+							  });
+
+			/* Convert the counts into the output offset of each digit and block */
+			size_t sum = 0;
+			for (int digit = 0; digit < 256; ++digit)
+			{
+				for (size_t block = 0; block < blockCount; ++block)
+				{
+					size_t count = offsets[block * 256 + digit];
+					offsets[block * 256 + digit] = sum;
+					sum += count;
+				}
+			}
+
+			tbb::parallel_for((size_t)0, blockCount, [&](size_t block)
+							  {
+								  size_t *offset = &offsets[block * 256];
+								  for (size_t i = block * LBVH_GRAIN_SIZE, end = std::min(size, i + LBVH_GRAIN_SIZE); i < end; ++i)
+								  {
+									  size_t j = offset[(keys[i] >> shift) & 0xff]++;
+									  tempKeys[j] = keys[i];
+									  tempValues[j] = values[i];
+								  }
+							  });
+
+			keys.swap(tempKeys);
+			values.swap(tempValues);
+		}
+	}
+
+	/**
+	 * \brief Compute the Morton codes of the bounding box centers, and sort
+	 * the triangle indices accordingly
+	 *
+	 * \c bounds(i) returns the bounding box of triangle \c i. Keys of type
+	 * \c uint32_t store 10 bits per axis, and \c uint64_t keys 21 bits.
+	 */
+	template <typename Key, typename BoundsFunc>
+	void sortByMortonCode(n_UINT size, const BoundsFunc &bounds, std::vector<Key> &codes,
+						  std::vector<n_UINT> &indices)
+	{
+		const int bitsPerAxis = sizeof(Key) == 4 ? 10 : 21;
+
+		BoundingBox3f centers = tbb::parallel_reduce(
+			tbb::blocked_range<n_UINT>(0u, size, LBVH_GRAIN_SIZE), BoundingBox3f(),
+			[&](const tbb::blocked_range<n_UINT> &range, BoundingBox3f result)
+			{
+				for (n_UINT i = range.begin(); i != range.end(); ++i)
+					result.expandBy(bounds(i).getCenter());
+				return result;
+			},
+			[](const BoundingBox3f &b1, const BoundingBox3f &b2)
+			{ return BoundingBox3f::merge(b1, b2); });
+
+		float maxValue = (float)((1u << bitsPerAxis) - 1);
+		Vector3f scale;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float extent = centers.max[axis] - centers.min[axis];
+			scale[axis] = extent > 0 ? maxValue / extent : 0.f;
+		}
+
+		codes.resize(size);
+		indices.resize(size);
+		tbb::parallel_for(tbb::blocked_range<n_UINT>(0u, size, LBVH_GRAIN_SIZE),
+						  [&](const tbb::blocked_range<n_UINT> &range)
+						  {
+							  for (n_UINT i = range.begin(); i != range.end(); ++i)
+							  {
+								  Point3f p = bounds(i).getCenter();
+								  Key code = 0;
+								  for (int axis = 0; axis < 3; ++axis)
+								  {
+									  float value = std::min(std::max((p[axis] - centers.min[axis]) * scale[axis], 0.f), maxValue);
+									  code |= expandBits((Key)value) << (2 - axis);
+								  }
+								  codes[i] = code;
+								  indices[i] = i;
+							  }
+						  });
+
+		radixSort(codes, indices, 3 * bitsPerAxis);
+	}
+
+	/**
+	 * \brief Link the sorted leaves <tt>nodes[0..n-1]</tt> into a binary tree
+	 * and return the index of its root
+	 *
+	 * The inner node that splits the sorted sequence between leaves \c i and
+	 * <tt>i+1</tt> is stored at <tt>nodes[n+i]</tt> and initialized by
+	 * <tt>combine(n+i, left, right)</tt>.
+	 */
+	template <typename Key, typename CombineFunc>
+	n_UINT linkNodes(const std::vector<Key> &codes, std::vector<LBVHNode> &nodes, const CombineFunc &combine)
+	{
+		n_UINT size = (n_UINT)codes.size(), root = 0;
+		if (size == 1)
+			return root;
+
+		/* Is the split between i and i+1 lower in the tree than the one between j and j+1?
+		   Identical codes are told apart by the position in the sorted sequence */
+		auto lower = [&](n_UINT i, n_UINT j)
+		{
+			Key di = codes[i] ^ codes[i + 1], dj = codes[j] ^ codes[j + 1];
+			if (di != dj)
+				return di < dj;
+			return (i ^ (i + 1)) < (j ^ (j + 1));
+		};
+
+		/* Bound of the range of the child that reached an inner node first */
+		const n_UINT invalid = (n_UINT)-1;
+		std::vector<std::atomic<n_UINT>> otherBound(size - 1);
+		for (std::atomic<n_UINT> &bound : otherBound)
+			bound.store(invalid, std::memory_order_relaxed);
+
+		tbb::parallel_for(tbb::blocked_range<n_UINT>(0u, size, LBVH_GRAIN_SIZE),
+						  [&](const tbb::blocked_range<n_UINT> &range)
+						  {
+							  for (n_UINT i = range.begin(); i != range.end(); ++i)
+							  {
+								  n_UINT current = i, left = i, right = i;
+								  while (left != 0 || right != size - 1)
+								  {
+									  /* The parent splits at whichever end of the range is lower in the tree */
+									  bool isLeftChild = left == 0 || (right != size - 1 && lower(right, left - 1));
+									  n_UINT split = isLeftChild ? right : left - 1;
+									  nodes[size + split].child[isLeftChild ? 0 : 1] = current;
+
+									  /* The first thread to arrive stops here */
+									  n_UINT bound = otherBound[split].exchange(isLeftChild ? left : right);
+									  if (bound == invalid)
+										  break;
+									  (isLeftChild ? right : left) = bound;
+
+									  current = size + split;
+									  LBVHNode &node = nodes[current];
+									  combine(current, node.child[0], node.child[1]);
+								  }
+								  if (left == 0 && right == size - 1)
+									  root = current;
+							  }
+						  });
+
+		return root;
+	}
+}
+
+void Accel::buildLBVH(const std::vector<BVHPrimitive> &prims, bool refine)
+{
+	n_UINT size = (n_UINT)prims.size();
+	std::vector<LBVHNode> nodes(2 * size - 1);
+
+	/* Initialize an inner node from its children. Subtrees that cover a
+	   contiguous range of the sorted triangles become leaves if that is
+	   cheaper according to the SAH */
+	auto combine = [&](n_UINT idx, n_UINT left, n_UINT right, bool contiguous)
+	{
+		LBVHNode &node = nodes[idx];
+		const LBVHNode &l = nodes[left], &r = nodes[right];
+		node.child[0] = left;
+		node.child[1] = right;
+		node.bbox = BoundingBox3f::merge(l.bbox, r.bbox);
+		node.start = std::min(l.start, r.start);
+		node.size = l.size + r.size;
+
+		float area = node.bbox.getSurfaceArea();
+		node.cost = 2.0f * TRAVERSAL_COST +
+					(area > 0 ? (l.bbox.getSurfaceArea() * l.cost + r.bbox.getSurfaceArea() * r.cost) / area
+							  : l.cost + r.cost);
+
+		float leafCost = (float)INTERSECTION_COST * node.size;
+		node.leaf = contiguous && node.size <= LBVH_MAX_LEAF_SIZE && leafCost <= node.cost;
+		if (node.leaf)
+			node.cost = leafCost;
+	};
+
+	auto bounds = [&](n_UINT i) -> const BoundingBox3f &
+	{ return prims[i].bbox; };
+
+	/* Leaves hold a single triangle in Morton order */
+	auto initLeaves = [&]()
+	{
+		tbb::parallel_for(tbb::blocked_range<n_UINT>(0u, size, LBVH_GRAIN_SIZE),
+						  [&](const tbb::blocked_range<n_UINT> &range)
+						  {
+							  for (n_UINT i = range.begin(); i != range.end(); ++i)
+							  {
+								  LBVHNode &node = nodes[i];
+								  node.bbox = prims[m_indices[i]].bbox;
+								  node.start = i;
+								  node.size = 1;
+								  node.cost = (float)INTERSECTION_COST;
+								  node.leaf = true;
+							  }
+						  });
+	};
+
+	auto combineContiguous = [&](n_UINT idx, n_UINT left, n_UINT right)
+	{ combine(idx, left, right, true); };
+
+	n_UINT root;
+	if (size < LBVH_LONG_CODE_THRESHOLD)
+	{
+		std::vector<uint32_t> codes;
+		sortByMortonCode(size, bounds, codes, m_indices);
+		initLeaves();
+		root = linkNodes(codes, nodes, combineContiguous);
+	}
+	else
+	{
+		std::vector<uint64_t> codes;
+		sortByMortonCode(size, bounds, codes, m_indices);
+		initLeaves();
+		root = linkNodes(codes, nodes, combineContiguous);
+	}
+
+	if (refine && size > 1)
+	{
+		/* Cut the tree into clusters of (up to) a given number of triangles.
+		   A depth-first traversal finds them in Morton order */
+		n_UINT clusterSize = std::max(size / LBVH_CLUSTER_COUNT, 1u);
+		std::vector<n_UINT> clusters, stack(1, root);
+		while (!stack.empty())
+		{
+			n_UINT idx = stack.back();
+			stack.pop_back();
+			if (nodes[idx].leaf || nodes[idx].size <= clusterSize)
+			{
+				clusters.push_back(idx);
+				continue;
+			}
+			stack.push_back(nodes[idx].child[1]);
+			stack.push_back(nodes[idx].child[0]);
+		}
+		nodes.reserve(nodes.size() + clusters.size());
+
+		/* Repeatedly merge all pairs of clusters that are each other's
+		   nearest neighbor, i.e. whose union has the smallest surface area.
+		   Ties are resolved towards the lower index, which ensures that
+		   there is at least one such pair in each round */
+		std::vector<n_UINT> neighbor;
+		while (clusters.size() > 1)
+		{
+			int count = (int)clusters.size();
+			neighbor.resize(count);
+			tbb::parallel_for(tbb::blocked_range<int>(0, count, 64),
+							  [&](const tbb::blocked_range<int> &range)
+							  {
+								  for (int i = range.begin(); i != range.end(); ++i)
+								  {
+									  const BoundingBox3f &bbox = nodes[clusters[i]].bbox;
+									  float bestArea = std::numeric_limits<float>::infinity();
+									  for (int j = std::max(i - LBVH_SEARCH_RADIUS, 0),
+											   end = std::min(i + LBVH_SEARCH_RADIUS, count - 1);
+										   j <= end; ++j)
+									  {
+										  if (j == i)
+											  continue;
+										  float area = BoundingBox3f::merge(bbox, nodes[clusters[j]].bbox).getSurfaceArea();
+										  if (area < bestArea)
+										  {
+											  bestArea = area;
+											  neighbor[i] = (n_UINT)j;
+										  }
+									  }
+								  }
+							  });
+
+			n_UINT remaining = 0;
+			for (int i = 0; i < count; ++i)
+			{
+				n_UINT j = neighbor[i];
+				if (neighbor[j] != (n_UINT)i)
+				{
+					clusters[remaining++] = clusters[i];
+				}
+				else if ((n_UINT)i < j)
+				{
+					n_UINT idx = (n_UINT)nodes.size();
+					nodes.emplace_back();
+					combine(idx, clusters[i], clusters[j], false);
+					clusters[remaining++] = idx;
+				}
+			}
+			clusters.resize(remaining);
+		}
+		root = clusters[0];
+	}
+
+	/* Convert the intermediate tree into BVH nodes (the root node has already been allocated) */
+	std::vector<std::pair<n_UINT, n_UINT>> stack(1, std::make_pair(root, 0u));
+	while (!stack.empty())
+	{
+		const LBVHNode &node = nodes[stack.back().first];
+		BVHNode &target = m_nodes[stack.back().second];
+		stack.pop_back();
+
+		if (node.leaf)
+		{
+			target.leaf.flag = 1;
+			target.leaf.start = node.start;
+			target.leaf.size = node.size;
+			continue;
+		}
+
+		auto children = m_nodes.grow_by(2);
+		children[0].bbox = nodes[node.child[0]].bbox;
+		children[1].bbox = nodes[node.child[1]].bbox;
+
+		target.inner.children = (n_UINT)(children - m_nodes.begin());
+		target.inner.axis = node.bbox.getLargestAxis();
+		target.inner.flag = 0;
+		stack.push_back(std::make_pair(node.child[1], target.inner.children + 1));
+		stack.push_back(std::make_pair(node.child[0], target.inner.children));
+	}
+}
+
+NORI_NAMESPACE_END
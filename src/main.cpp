@@ -25,150 +25,493 @@
 #include <nori/sampler.h>
 #include <nori/integrator.h>
 #include <nori/gui.h>
+#include <nori/stats.h>
+#include <nori/trace.h>
+#include <nori/denoiser.h>
+#include <nori/checkpoint.h>
+#include <nori/render.h>
+#include <nori/preview.h>
+#include <nori/numa.h>
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 #include <tbb/task_scheduler_init.h>
 #include <filesystem/resolver.h>
+#include <atomic>
 #include <thread>
 
 using namespace nori;
 
 static int threadCount = -1;
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block)
-{
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
+/// Split the rendering work by NUMA node (see \ref NumaExecutor)
+static bool numa = true;
+
+/// Interval between checkpoints in seconds (disabled if negative)
+static float checkpointInterval = -1;
+
+/// Default interval between checkpoints when only \c --resume is given
+#define NORI_CHECKPOINT_INTERVAL 60
 
-    Point2i offset = block.getOffset();
-    Vector2i size = block.getSize();
+/// Crop window (offset and size in pixels, disabled if the size is zero)
+static Point2i cropOffset(0, 0);
+static Vector2i cropSize(0, 0);
 
-    /* Clear the block contents */
-    block.clear();
+/// Range of blocks to be rendered (disabled if \c lastBlock is negative)
+static int firstBlock = 0, lastBlock = -1;
 
-    /* For each pixel and pixel sample sample */
-    for (int y = 0; y < size.y(); ++y)
+/// Render progressive passes until this many seconds have elapsed, but at least one (disabled if negative)
+static float timeBudget = -1;
+
+/// Render progressive passes until the estimated relative error drops below this value (disabled if negative)
+static float noiseTarget = -1;
+
+/**
+ * Save the per-pixel costs recorded by \ref renderBlock(). The EXR file
+ * contains the raw values, the PNG file visualizes the render time
+ * relative to the 99th percentile (isolated outliers, e.g. due to
+ * preemption, would otherwise dominate the image).
+ */
+static void saveHeatmap(Bitmap &heatmap, const std::string &filename)
+{
+    heatmap.saveEXR(filename);
+
+    std::vector<float> times;
+    times.reserve(heatmap.size());
+    for (int y = 0; y < heatmap.rows(); ++y)
+        for (int x = 0; x < heatmap.cols(); ++x)
+            times.push_back(heatmap(y, x).r());
+    auto percentile = times.begin() + (times.size() * 99) / 100;
+    std::nth_element(times.begin(), percentile, times.end());
+    float maxTime = percentile != times.end() ? *percentile : 0.f;
+
+    /* Black -> red -> yellow -> white color ramp. The values are
+       given in linear space since savePNG() applies the sRGB curve */
+    Bitmap visualization(Vector2i((int)heatmap.cols(), (int)heatmap.rows()));
+    for (int y = 0; y < heatmap.rows(); ++y)
     {
-        for (int x = 0; x < size.x(); ++x)
+        for (int x = 0; x < heatmap.cols(); ++x)
         {
-            for (uint32_t i = 0; i < sampler->getSampleCount(); ++i)
-            {
-                Point2f pixelSample = Point2f((float)(x + offset.x()), (float)(y + offset.y())) + sampler->next2D();
-                Point2f apertureSample = sampler->next2D();
+            float t = maxTime > 0 ? 3.f * heatmap(y, x).r() / maxTime : 0.f;
+            visualization(y, x) = Color3f(clamp(t, 0.f, 1.f),
+                                          clamp(t - 1.f, 0.f, 1.f),
+                                          clamp(t - 2.f, 0.f, 1.f)).toLinearRGB();
+        }
+    }
+    visualization.savePNG(filename);
+}
 
-                /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+/**
+ * Combine the partial results written by several (crop window or block
+ * range) renders of the same scene into the final image
+ */
+static void merge(const std::vector<std::string> &partials, const std::string &filename)
+{
+    std::unique_ptr<ImageBlock> result(ImageBlock::fromPartialEXR(partials[0]));
+    for (const std::string &partial : partials)
+        result->putPartialEXR(partial);
+
+    int uncovered = 0;
+    for (int y = 0; y < result->rows(); ++y)
+        for (int x = 0; x < result->cols(); ++x)
+            if (result->coeff(y, x).w() == 0)
+                uncovered++;
+    if (uncovered > 0)
+        cerr << "Warning: " << uncovered << " pixels are not covered by any of the partial results!" << endl;
 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
+    std::string outputName = filename;
+    size_t lastdot = outputName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        outputName.erase(lastdot, std::string::npos);
 
-                /* Store in the image block */
-                block.put(pixelSample, value);
-            }
+    std::unique_ptr<Bitmap> bitmap(result->toBitmap());
+    bitmap->saveEXR(outputName);
+    bitmap->savePNG(outputName);
+
+    if (!result->getChannels().empty())
+        result->saveEXR(outputName + "_aovs");
+}
+
+/**
+ * Estimate the relative RMS error of a progressive render from the
+ * difference between the even and the odd passes, which are independent
+ * estimates of the image with half the samples each.
+ */
+static float estimateRelativeError(const ImageBlock &total, const ImageBlock &odd)
+{
+    int border = total.getBorderSize();
+    Vector2i size = total.getSize();
+    double sum = 0;
+    for (int y = border; y < size.y() + border; ++y)
+    {
+        for (int x = border; x < size.x() + border; ++x)
+        {
+            const Color4f &t = total.coeff(y, x), &o = odd.coeff(y, x);
+            Color4f even = t - o;
+            float mean = t.divideByFilterWeight().getLuminance();
+            float diff = 0.5f * (even.divideByFilterWeight().getLuminance() -
+                                 o.divideByFilterWeight().getLuminance());
+            sum += diff * diff / (mean * mean + 1e-2f);
         }
     }
+    return (float)std::sqrt(sum / ((double)size.x() * size.y()));
 }
 
-static void render(Scene *scene, const std::string &filename, bool nogui)
+/**
+ * Render the view of \c camera. The output files are named after
+ * \c baseName, i.e. the scene filename without extension, followed by the
+ * frame number (if any) and the sample count. The integrator must have
+ * been preprocessed already, and the BVH distributed to the nodes of
+ * \c executor. The partially rendered image is shown in \c screen
+ * (if not \c nullptr).
+ */
+static void render(Scene *scene, const Camera *camera, const std::string &baseName, NumaExecutor &executor,
+                   NoriScreen *screen, bool heatmap, bool denoise, bool aovs, bool resume)
 {
-    const Camera *camera = scene->getCamera();
     Vector2i outputSize = camera->getOutputSize();
-    scene->getIntegrator()->preprocess(scene);
+
+    /* Determine the filename of the output bitmap */
+    int sampleCount = scene->getSampler()->getSampleCount();
+    std::string outputName = baseName;
+
+    /* With a time or noise budget, the sample count is the size of a progressive pass */
+    bool progressive = timeBudget >= 0 || noiseTarget >= 0;
+    if (!progressive)
+        outputName += "_" + std::to_string(sampleCount);
+    if (timeBudget >= 0)
+        outputName += tfm::format("_%gs", timeBudget);
+    if (noiseTarget >= 0)
+        outputName += tfm::format("_noise%g", noiseTarget);
 
     /* Create a block generator (i.e. a work scheduler) */
     BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
 
-    /* Allocate memory for the entire output image and clear it */
-    ImageBlock result(outputSize, camera->getReconstructionFilter());
-    result.clear();
+    /* When rendering only part of the image, save the unnormalized result
+       so that it can later be merged with the other parts (see --merge) */
+    bool partial = cropSize.x() > 0 || lastBlock >= 0;
+    if (cropSize.x() > 0)
+    {
+        blockGenerator.setCropWindow(cropOffset, cropSize);
+        outputName += tfm::format("_crop_%i_%i_%i_%i", cropOffset.x(), cropOffset.y(), cropSize.x(), cropSize.y());
+    }
+    if (lastBlock >= 0)
+    {
+        blockGenerator.setBlockRange(firstBlock, lastBlock);
+        outputName += tfm::format("_blocks_%i_%i", firstBlock, lastBlock);
+    }
+    if (partial)
+        cout << "Rendering " << blockGenerator.getBlockCount() << " of "
+             << blockGenerator.getTotalBlockCount() << " blocks" << endl;
+
+    /* Every NUMA node renders its own interleaved bands of block rows */
+    blockGenerator.setPartitionCount(executor.getNodeCount());
+
+    /* Allocate memory for the entire output image and clear it. Each
+       node clears its own rows, so that they reside in its memory */
+    std::vector<ImageChannel> channels;
+    if (aovs)
+        channels = aovChannels();
+    ImageBlock result(outputSize, camera->getReconstructionFilter(), channels);
+    executor.run([&](int node)
+                 {
+        int border = result.getBorderSize();
+        for (int row = 0; row < result.rows(); ++row)
+            if (blockGenerator.getPartition(clamp(row - border, 0, outputSize.y() - 1)) == node)
+                result.clearRows(row, row + 1); });
+
+    RenderOutputs outputs;
+    outputs.aovs = aovs;
+    for (size_t i = 0; i < scene->getMeshes().size(); ++i)
+        outputs.meshIDs[scene->getMeshes()[i]] = (int)i;
+
+    /* Optionally also record the cost of every pixel */
+    std::unique_ptr<Bitmap> costs;
+    if (heatmap)
+        costs.reset(new Bitmap(outputSize));
+    outputs.heatmap = costs.get();
+
+    /* .. and the feature buffers needed for denoising */
+    std::unique_ptr<FeatureBuffer> features;
+    if (denoise)
+        features.reset(new FeatureBuffer(outputSize));
+    outputs.features = features.get();
+
+    /* Periodically save the finished blocks, and skip the ones
+       that were finished by a previous (interrupted) run */
+    std::unique_ptr<Checkpoint> checkpoint;
+    if (checkpointInterval >= 0 || resume)
+    {
+        checkpoint.reset(new Checkpoint(
+            outputName + ".checkpoint", result,
+            camera->toString() + scene->getSampler()->toString() + scene->getIntegrator()->toString(),
+            checkpointInterval >= 0 ? checkpointInterval : NORI_CHECKPOINT_INTERVAL));
 
-    /* Create a window that visualizes the partially rendered result */
-    NoriScreen *screen = 0;
-    if (!nogui)
+        if (resume && checkpoint->resume())
+        {
+            if (heatmap || denoise)
+                throw NoriException("Cannot resume a render with --heatmap or --denoise, "
+                                    "their data is not part of the checkpoint!");
+            cout << "Resuming from \"" << outputName << ".checkpoint\" ("
+                 << checkpoint->getResumedBlockCount() << "/" << blockGenerator.getBlockCount()
+                 << " blocks finished)" << endl;
+        }
+    }
+
+    /* The odd passes are also accumulated separately to estimate the noise */
+    std::unique_ptr<ImageBlock> oddPasses;
+    if (noiseTarget >= 0)
     {
-        nanogui::init();
-        screen = new NoriScreen(result);
+        oddPasses.reset(new ImageBlock(outputSize, camera->getReconstructionFilter()));
+        oddPasses->clear();
     }
 
-    /* Do the following in parallel and asynchronously */
-    std::thread render_thread([&]
-                              {
+    /* Visualize the partially rendered result */
+    if (screen)
+        screen->setBlock(&result);
+
+    scene->getIntegrator()->beginRender(scene, camera);
+
+    {
         tbb::task_scheduler_init init(threadCount);
 
+        Statistics::reset();
+
         cout << "Rendering .. ";
         cout.flush();
         Timer timer;
+        TraceScope trace("Rendering");
 
         tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+        uint32_t pass = 0;
+        std::atomic<int> skippedBlocks(0);
+        float relativeError = -1;
 
-        auto map = [&](const tbb::blocked_range<int>& range) {
+        auto map = [&](const tbb::blocked_range<int>& range, int node) {
             /* Allocate memory for a small image block to be rendered
                by the current thread */
             ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
+                camera->getReconstructionFilter(), channels);
 
             /* Create a clone of the sampler for the current thread */
             std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
 
             for (int i = range.begin(); i < range.end(); ++i) {
-                /* Request an image block from the block generator */
-                blockGenerator.next(block);
+                /* Request an image block of this node from the block generator */
+                blockGenerator.next(block, node);
+
+                if (checkpoint && checkpoint->isFinished(block.getOffset()))
+                    continue;
+
+                /* Out of time: skip the rest of the current pass. All pixels are
+                   normalized by their own weights, hence the result remains valid.
+                   The first pass is always finished, so that every pixel is covered */
+                if (timeBudget >= 0 && pass > 0 && timer.elapsed() >= timeBudget * 1000) {
+                    skippedBlocks++;
+                    continue;
+                }
+
+                double start = Trace::isEnabled() ? Trace::now() : 0;
 
                 /* Inform the sampler about the block to be rendered */
                 sampler->prepare(block);
 
                 /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
+                renderBlock(scene, camera, sampler.get(), block, outputs, pass);
+
+                if (Trace::isEnabled()) {
+                    Point2i offset = block.getOffset();
+                    Vector2i size = block.getSize();
+                    Trace::addEvent("Block", "block", start, Trace::now(),
+                        tfm::format("{\"x\": %i, \"y\": %i, \"width\": %i, \"height\": %i, \"samples\": %i, \"pass\": %i}",
+                                    offset.x(), offset.y(), size.x(), size.y(),
+                                    size.x() * size.y() * sampler->getSampleCount(), pass));
+                }
 
                 /* The image block has been processed. Now add it to
                    the "big" block that represents the entire image */
-                result.put(block);
+                if (checkpoint)
+                    checkpoint->put(block);
+                else
+                    result.put(block);
+
+                if (oddPasses && pass % 2 == 1)
+                    oddPasses->put(block);
             }
         };
 
-        /// Default: parallel rendering
-        tbb::parallel_for(range, map);
-
-        /// (equivalent to the following single-threaded call)
-        // map(range);
-
-        cout << "done. (took " << timer.elapsedString() << ")" << endl; });
-
-    if (!nogui)
-    {
-        /* Enter the application main loop */
-        nanogui::mainloop();
-
-        /* Shut down the user interface */
-        render_thread.join();
+        while (true) {
+            /// Default: parallel rendering (separately on each NUMA node)
+            executor.run([&](int node) {
+                tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount(node)),
+                    [&](const tbb::blocked_range<int>& range) { map(range, node); });
+            });
+
+            /// (equivalent to the following single-threaded call)
+            // map(range, 0);
+
+            if (!progressive || skippedBlocks > 0)
+                break;
+            ++pass;
+
+            /* The error estimate needs the same number of even and odd passes */
+            if (noiseTarget >= 0 && pass % 2 == 0) {
+                relativeError = estimateRelativeError(result, *oddPasses);
+                if (relativeError <= noiseTarget)
+                    break;
+            }
+            if (timeBudget >= 0 && timer.elapsed() >= timeBudget * 1000)
+                break;
 
-        if (screen)
-            delete screen;
+            blockGenerator.reset();
+            scene->getIntegrator()->preparePass(scene, pass);
+        }
 
-        nanogui::shutdown();
+        /* Add e.g. the contributions of light paths (the window might be showing the image) */
+        result.lock();
+        scene->getIntegrator()->endRender(result);
+        result.unlock();
+
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+        if (progressive) {
+            /* 'pass' is the number of completed passes; an interrupted one
+               added another pass worth of samples to some of the pixels */
+            uint32_t minSamples = pass * sampleCount,
+                     maxSamples = (pass + (skippedBlocks > 0 && skippedBlocks < (int)range.size() ? 1 : 0)) * sampleCount;
+            cout << "Rendered " << pass << " complete pass" << (pass == 1 ? "" : "es") << " of "
+                 << sampleCount << " samples per pixel (" << minSamples;
+            if (maxSamples != minSamples)
+                cout << "-" << maxSamples;
+            cout << " samples per pixel)";
+            if (relativeError >= 0)
+                cout << ", estimated relative error " << relativeError;
+            cout << endl;
+        }
+        cout << Statistics::toString();
     }
-    else
-        render_thread.join();
+
+    /* The window keeps showing a copy of the image until the next frame */
+    if (screen)
+        screen->setBlock(nullptr);
 
     /* Now turn the rendered image block into
        a properly normalized bitmap */
     std::unique_ptr<Bitmap> bitmap(result.toBitmap());
 
-    /* Determine the filename of the output bitmap */
-    int sampleCount = scene->getSampler()->getSampleCount();
-    std::string outputName = filename;
-    size_t lastdot = outputName.find_last_of(".");
-    if (lastdot != std::string::npos)
-        outputName.erase(lastdot, std::string::npos);
-
-    outputName += "_" + std::to_string(sampleCount);
-
     /* Save using the OpenEXR format */
     bitmap->saveEXR(outputName);
 
     /* Save tonemapped (sRGB) output using the PNG format */
     bitmap->savePNG(outputName);
+
+    if (partial)
+        result.savePartialEXR(outputName + "_partial");
+
+    if (costs)
+        saveHeatmap(*costs, outputName + "_heatmap");
+
+    /* Beauty, AOVs and sample counts in a single multi-channel file */
+    if (aovs)
+        result.saveEXR(outputName + "_aovs");
+
+    if (features)
+    {
+        cout << "Denoising .. ";
+        cout.flush();
+        Timer timer;
+        std::unique_ptr<Bitmap> denoised;
+        {
+            TraceScope trace("Denoising");
+            denoised.reset(Denoiser().denoise(*bitmap, *features));
+        }
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+
+        denoised->saveEXR(outputName + "_denoised");
+        denoised->savePNG(outputName + "_denoised");
+    }
+
+    /* The render is complete, the checkpoint is no longer needed */
+    if (checkpoint)
+        checkpoint->remove();
+}
+
+/**
+ * Render all cameras and frames of a camera path in sequence, reusing the
+ * loaded meshes, textures, BVH and preprocessed integrator, as well as the
+ * worker threads and the window
+ */
+static void renderViews(Scene *scene, const std::string &sceneName, bool nogui, bool heatmap, bool denoise,
+                        bool aovs, bool resume)
+{
+    std::string baseName = sceneName;
+    size_t lastdot = baseName.find_last_of(".");
+    if (lastdot != std::string::npos)
+        baseName.erase(lastdot, std::string::npos);
+
+    /* On NUMA systems, every node renders using threads that are pinned
+       to its CPUs, and works with a local copy of the BVH */
+    NumaExecutor executor(threadCount, numa);
+    scene->getAccel()->distribute(executor);
+    if (executor.getNodeCount() > 1)
+    {
+        cout << "Rendering on " << executor.getNodeCount() << " NUMA nodes (";
+        for (int i = 0; i < executor.getNodeCount(); ++i)
+            cout << (i > 0 ? ", " : "") << executor.getThreadCount(i);
+        cout << " threads)" << endl;
+    }
+
+    NoriScreen *screen = nullptr;
+    auto renderFrames = [&]
+    {
+        size_t viewCount = scene->getCameraCount();
+        for (size_t i = 0; i < viewCount; ++i)
+        {
+            std::string frameName = baseName;
+            if (viewCount > 1)
+            {
+                cout << "Frame " << (i + 1) << "/" << viewCount << endl;
+                frameName += tfm::format("_frame%04i", i);
+            }
+            render(scene, scene->getCamera(i), frameName, executor, screen, heatmap, denoise, aovs, resume);
+        }
+    };
+
+    if (nogui)
+    {
+        renderFrames();
+        return;
+    }
+
+    /* Create a single window that shows the frames while they are rendered
+       in the background. The frames are saved as soon as they are done */
+    nanogui::init();
+    screen = new NoriScreen(scene->getCamera(0)->getOutputSize());
+    std::thread render_thread(renderFrames);
+
+    /* Enter the application main loop */
+    nanogui::mainloop();
+
+    /* Shut down the user interface */
+    render_thread.join();
+    delete screen;
+    nanogui::shutdown();
+}
+
+/**
+ * Show an interactive preview of the first camera, which can be moved
+ * around using the mouse and keyboard. Nothing is written to disk.
+ */
+static void preview(Scene *scene)
+{
+    cout << "Interactive preview: drag to orbit, right-drag to pan, scroll to zoom, "
+         << "W/A/S/D/Q/E to fly" << endl;
+
+    nanogui::init();
+    {
+        PreviewRenderer renderer(scene, scene->getCamera(), threadCount);
+        NoriScreen *screen = new NoriScreen(renderer);
+        nanogui::mainloop();
+        delete screen;
+    }
+    nanogui::shutdown();
 }
 
 int main(int argc, char **argv)
@@ -181,6 +524,14 @@ int main(int argc, char **argv)
 
     bool nogui = false;
     std::string sceneName = "";
+    std::string traceName = "";
+    bool heatmap = false;
+    bool denoise = false;
+    bool aovs = false;
+    bool resume = false;
+    bool interactive = false;
+    std::string mergeName = "";
+    std::vector<std::string> partials;
 
     for (int i = 1; i < argc; ++i)
     {
@@ -204,6 +555,101 @@ int main(int argc, char **argv)
         }
         else if (token == "--nogui" || token == "-b")
             nogui = true;
+        else if (token == "--no-numa")
+            numa = false;
+        else if (token == "--trace")
+        {
+            if (i + 1 >= argc)
+            {
+                cerr << "\"--trace\" argument expects a JSON filename following it." << endl;
+                return -1;
+            }
+            traceName = argv[++i];
+            Trace::enable();
+        }
+        else if (token == "--heatmap")
+            heatmap = true;
+        else if (token == "--denoise")
+            denoise = true;
+        else if (token == "--aovs")
+            aovs = true;
+        else if (token == "--checkpoint")
+        {
+            if (i + 1 >= argc || (checkpointInterval = (float)atof(argv[i + 1])) <= 0)
+            {
+                cerr << "\"--checkpoint\" argument expects a positive interval in seconds following it." << endl;
+                return -1;
+            }
+            i++;
+        }
+        else if (token == "--resume")
+            resume = true;
+        else if (token == "--interactive" || token == "-i")
+            interactive = true;
+        else if (token == "--time")
+        {
+            if (i + 1 >= argc || (timeBudget = (float)atof(argv[i + 1])) <= 0)
+            {
+                cerr << "\"--time\" argument expects a positive time budget in seconds following it." << endl;
+                return -1;
+            }
+            i++;
+        }
+        else if (token == "--noise")
+        {
+            if (i + 1 >= argc || (noiseTarget = (float)atof(argv[i + 1])) <= 0)
+            {
+                cerr << "\"--noise\" argument expects a positive relative error following it." << endl;
+                return -1;
+            }
+            i++;
+        }
+        else if (token == "--crop")
+        {
+            if (i + 4 >= argc)
+            {
+                cerr << "\"--crop\" argument expects the offset and size of the crop window (x y width height) following it." << endl;
+                return -1;
+            }
+            cropOffset = Point2i(atoi(argv[i + 1]), atoi(argv[i + 2]));
+            cropSize = Vector2i(atoi(argv[i + 3]), atoi(argv[i + 4]));
+            i += 4;
+            if ((cropOffset.array() < 0).any() || (cropSize.array() <= 0).any())
+            {
+                cerr << "\"--crop\" argument expects a non-negative offset and a positive size." << endl;
+                return -1;
+            }
+        }
+        else if (token == "--blocks")
+        {
+            if (i + 2 >= argc)
+            {
+                cerr << "\"--blocks\" argument expects the first and one past the last block index following it." << endl;
+                return -1;
+            }
+            firstBlock = atoi(argv[i + 1]);
+            lastBlock = atoi(argv[i + 2]);
+            i += 2;
+            if (firstBlock < 0 || lastBlock <= firstBlock)
+            {
+                cerr << "\"--blocks\" argument expects a non-empty range of block indices." << endl;
+                return -1;
+            }
+        }
+        else if (token == "--merge")
+        {
+            if (i + 1 >= argc)
+            {
+                cerr << "\"--merge\" argument expects the output filename following it." << endl;
+                return -1;
+            }
+            mergeName = argv[++i];
+        }
+        else if (!mergeName.empty())
+        {
+            /* All remaining arguments are partial results */
+            partials.push_back(token);
+        }
         else
         {
             filesystem::path path(argv[i]);
@@ -250,15 +696,65 @@ int main(int argc, char **argv)
         threadCount = tbb::task_scheduler_init::automatic;
     }
 
+    if (interactive && nogui)
+    {
+        cerr << "\"--interactive\" requires the user interface." << endl;
+        return -1;
+    }
+
+    if ((timeBudget >= 0 || noiseTarget >= 0) && (checkpointInterval >= 0 || resume))
+    {
+        cerr << "Checkpoints are not supported in combination with \"--time\" or \"--noise\"." << endl;
+        return -1;
+    }
+
+    if (!mergeName.empty())
+    {
+        if (partials.empty())
+        {
+            cerr << "\"--merge\" expects the partial results to be combined following the output filename." << endl;
+            return -1;
+        }
+
+        try
+        {
+            merge(partials, mergeName);
+        }
+        catch (const std::exception &e)
+        {
+            cerr << "[FATAL ERROR]: " << e.what() << endl;
+            return -1;
+        }
+        return 0;
+    }
+
     if (sceneName != "")
     {
         try
         {
-            std::unique_ptr<NoriObject> root(loadFromXML(argv[1]));
+            std::unique_ptr<NoriObject> root;
+            {
+                TraceScope trace("Scene loading");
+                root.reset(loadFromXML(sceneName));
+            }
 
             /* When the XML root object is a scene, start rendering it .. */
             if (root->getClassType() == NoriObject::EScene)
-                render(static_cast<Scene *>(root.get()), argv[1], nogui);
+            {
+                Scene *scene = static_cast<Scene *>(root.get());
+                {
+                    TraceScope trace("Integrator preprocess");
+                    scene->getIntegrator()->preprocess(scene);
+                }
+
+                if (interactive)
+                    preview(scene);
+                else
+                    renderViews(scene, sceneName, nogui, heatmap, denoise, aovs, resume);
+            }
+
+            if (!traceName.empty())
+                Trace::write(traceName);
         }
         catch (const std::exception &e)
         {
@@ -27,9 +27,14 @@
 #include <nori/texture.h>
 #include <nori/vector.h>
 #include <nori/reflectance.h>
+#include <nori/stats.h>
 
 NORI_NAMESPACE_BEGIN
 
+NORI_STAT_COUNTER(statsConductorSamples, "BSDF samples", "roughconductor");
+NORI_STAT_COUNTER(statsDielectricSamples, "BSDF samples", "roughdielectric");
+NORI_STAT_COUNTER(statsSubstrateSamples, "BSDF samples", "roughsubstrate");
+
 #define KS_THRES 0.
 
 class RoughConductor : public BSDF
@@ -58,9 +63,9 @@ public:
             return Color3f(0.0f);
 
         Vector3f wh = (bRec.wi + bRec.wo).normalized();
-        Color3f F = Reflectance::fresnel(wh.dot(bRec.wi), m_R0->eval(bRec.uv));
+        Color3f F = Reflectance::fresnel(wh.dot(bRec.wi), getR0(bRec));
 
-        float alpha = m_alpha->eval(bRec.uv).getLuminance();
+        float alpha = getAlpha(bRec);
         float G = Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha);
 
         float D = Reflectance::BeckmannNDF(wh, alpha);
@@ -76,15 +81,24 @@ public:
             return 0.0f;
 
         // Roughness
-        float alpha = m_alpha->eval(bRec.uv).getLuminance();
+        float alpha = getAlpha(bRec);
         Vector3f wh = (bRec.wi + bRec.wo).normalized();
 
-        return Warp::squareToBeckmannPdf(wh, alpha);
+        /* Density of the half vector, divided by the Jacobian of the reflection */
+        return Warp::squareToBeckmannPdf(wh, alpha) / (4.0f * std::abs(wh.dot(bRec.wo)));
+    }
+
+    /// Evaluate the BRDF and the sampling density of \ref sample()
+    Color3f evalWithPdf(const BSDFQueryRecord &bRec, float &pdf) const
+    {
+        return evalWithPdf(bRec, getAlpha(bRec), pdf);
     }
 
     /// Sample the BRDF
     Color3f sample(BSDFQueryRecord &bRec, const Point2f &_sample) const
     {
+        NORI_STAT_INC(statsConductorSamples);
+
         // Note: Once you have implemented the part that computes the scattered
         // direction, the last part of this function should simply return the
         // BRDF value divided by the solid angle density and multiplied by the
@@ -94,17 +108,18 @@ public:
             return Color3f(0.0f);
 
         bRec.measure = ESolidAngle;
+        bRec.lobe = EGlossyReflection;
 
-        float alpha = m_alpha->eval(bRec.uv).getLuminance();
+        float alpha = getAlpha(bRec);
 
         Vector3f wh = Warp::squareToBeckmann(_sample, alpha);
         bRec.wo = 2.0f * wh.dot(bRec.wi) * wh - bRec.wi;
 
-        float _pdf = pdf(bRec);
-        if (_pdf < Epsilon)
+        Color3f value = evalWithPdf(bRec, alpha, bRec.pdf);
+        if (bRec.pdf < Epsilon)
             return Color3f(0.0f);
 
-        return eval(bRec) * Frame::cosTheta(bRec.wi) / _pdf;
+        return value * Frame::cosTheta(bRec.wo) / bRec.pdf;
     }
 
     bool isDiffuse() const
@@ -140,6 +155,17 @@ public:
         }
     }
 
+    Color3f getAlbedo(const Point2f &uv) const
+    {
+        return m_R0->eval(uv);
+    }
+
+    void evalClosure(const Point2f &uv, BSDFClosure &closure) const
+    {
+        closure.color = m_R0->eval(uv);
+        closure.alpha = m_alpha->eval(uv).getLuminance();
+    }
+
     std::string toString() const
     {
         return tfm::format(
@@ -152,6 +178,36 @@ public:
     }
 
 private:
+    /// Return the roughness at the queried point (from the closure, if available)
+    float getAlpha(const BSDFQueryRecord &bRec) const
+    {
+        return bRec.closure ? bRec.closure->alpha : m_alpha->eval(bRec.uv).getLuminance();
+    }
+
+    /// Return the reflectance at normal incidence at the queried point
+    Color3f getR0(const BSDFQueryRecord &bRec) const
+    {
+        return bRec.closure ? bRec.closure->color : m_R0->eval(bRec.uv);
+    }
+
+    /// Evaluate the BRDF and its sampling density, sharing the microfacet distribution
+    Color3f evalWithPdf(const BSDFQueryRecord &bRec, float alpha, float &pdf) const
+    {
+        pdf = 0.0f;
+        if (bRec.measure != ESolidAngle || Frame::cosTheta(bRec.wi) <= 0 || Frame::cosTheta(bRec.wo) <= 0)
+            return Color3f(0.0f);
+
+        /* The sampling density of the half vector is D(wh) * cos(theta_h),
+           that of the reflected direction is smaller by 4 |wo . wh| */
+        Vector3f wh = (bRec.wi + bRec.wo).normalized();
+        float D = Reflectance::BeckmannNDF(wh, alpha);
+        pdf = D * Frame::cosTheta(wh) / (4.0f * std::abs(wh.dot(bRec.wo)));
+
+        Color3f F = Reflectance::fresnel(wh.dot(bRec.wi), getR0(bRec));
+        float G = Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha);
+        return D * F * G / (4.0f * Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo));
+    }
+
     Texture *m_alpha;
     Texture *m_R0;
 };
@@ -197,6 +253,8 @@ public:
     /// Sample the BRDF
     Color3f sample(BSDFQueryRecord &bRec, const Point2f &_sample) const
     {
+        NORI_STAT_INC(statsDielectricSamples);
+
         // Note: Once you have implemented the part that computes the scattered
         // direction, the last part of this function should simply return the
         // BRDF value divided by the solid angle density and multiplied by the
@@ -240,6 +298,11 @@ public:
         }
     }
 
+    Color3f getAlbedo(const Point2f &uv) const
+    {
+        return m_ka->eval(uv);
+    }
+
     std::string toString() const
     {
         return tfm::format(
@@ -289,7 +352,7 @@ public:
         if (bRec.measure != ESolidAngle || Frame::cosTheta(bRec.wi) <= 0 || Frame::cosTheta(bRec.wo) <= 0)
             return Color3f(0.0f);
 
-        float alpha = m_alpha->eval(bRec.uv).getLuminance();
+        float alpha = getAlpha(bRec);
         Vector3f wh = (bRec.wi + bRec.wo).normalized();
         float D = Reflectance::BeckmannNDF(wh, alpha);
         Color3f F = Reflectance::fresnel(wh.dot(bRec.wi), m_extIOR, m_intIOR);
@@ -298,7 +361,7 @@ public:
         Color3f specular = D * F * G /
                            (4.0f * Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo));
 
-        Color3f diffuse = 28.f * m_kd->eval(bRec.uv) / (23.f * M_PI) *
+        Color3f diffuse = 28.f * getKd(bRec) / (23.f * M_PI) *
                           (1 - powf((m_extIOR - m_intIOR) / (m_extIOR + m_intIOR), 2)) *
                           (1 - powf(1 - 0.5f * Frame::cosTheta(bRec.wi), 5)) *
                           (1 - powf(1 - 0.5f * Frame::cosTheta(bRec.wo), 5));
@@ -315,17 +378,26 @@ public:
             return 0.0f;
 
         // Roughness
-        float alpha = m_alpha->eval(bRec.uv).getLuminance();
+        float alpha = getAlpha(bRec);
         Vector3f wh = (bRec.wi + bRec.wo).normalized();
         float p_spec = Reflectance::fresnel(Frame::cosTheta(bRec.wi), m_extIOR, m_intIOR);
 
-        return p_spec * Warp::squareToBeckmannPdf(wh, alpha) +
+        return p_spec * Warp::squareToBeckmannPdf(wh, alpha) / (4.0f * std::abs(wh.dot(bRec.wo))) +
                (1 - p_spec) * Warp::squareToCosineHemispherePdf(bRec.wo);
     }
 
+    /// Evaluate the BRDF and the sampling density of \ref sample()
+    Color3f evalWithPdf(const BSDFQueryRecord &bRec, float &pdf) const
+    {
+        return evalWithPdf(bRec, getAlpha(bRec),
+                           Reflectance::fresnel(Frame::cosTheta(bRec.wi), m_extIOR, m_intIOR), pdf);
+    }
+
     /// Sample the BRDF
     Color3f sample(BSDFQueryRecord &bRec, const Point2f &_sample) const
     {
+        NORI_STAT_INC(statsSubstrateSamples);
+
         // Note: Once you have implemented the part that computes the scattered
         // direction, the last part of this function should simply return the
         // BRDF value divided by the solid angle density and multiplied by the
@@ -337,29 +409,35 @@ public:
         bRec.measure = ESolidAngle;
 
         float p_spec = Reflectance::fresnel(Frame::cosTheta(bRec.wi), m_extIOR, m_intIOR);
+        float alpha = getAlpha(bRec);
 
-        float russionRoulette = rand() / static_cast<float>(RAND_MAX);
-        if (russionRoulette < p_spec)
+        /* Choose the lobe with the first sample dimension and rescale it, so
+           that sampling stays deterministic and thread-safe */
+        Point2f sample(_sample);
+        if (sample.x() < p_spec)
         {
             // Sample specular
-            float alpha = m_alpha->eval(bRec.uv).getLuminance();
-            Vector3f wh = Warp::squareToBeckmann(_sample, alpha);
+            sample.x() /= p_spec;
+            Vector3f wh = Warp::squareToBeckmann(sample, alpha);
             bRec.wo = 2.0f * wh.dot(bRec.wi) * wh - bRec.wi;
+            bRec.lobe = EGlossyReflection;
         }
         else
         {
             // Sample diffuse
-            bRec.wo = Warp::squareToCosineHemisphere(_sample);
+            sample.x() = (sample.x() - p_spec) / (1.0f - p_spec);
+            bRec.wo = Warp::squareToCosineHemisphere(sample);
             bRec.eta = 1.0f;
+            bRec.lobe = EDiffuseReflection;
         }
 
-        float pdf_ = pdf(bRec);
-        if (abs(pdf_) < Epsilon)
+        Color3f value = evalWithPdf(bRec, alpha, p_spec, bRec.pdf);
+        if (abs(bRec.pdf) < Epsilon)
         {
             return Color3f(0.0f);
         }
 
-        return eval(bRec) * Frame::cosTheta(bRec.wo) / pdf_;
+        return value * Frame::cosTheta(bRec.wo) / bRec.pdf;
     }
 
     bool isDiffuse() const
@@ -395,6 +473,17 @@ public:
         }
     }
 
+    Color3f getAlbedo(const Point2f &uv) const
+    {
+        return m_kd->eval(uv);
+    }
+
+    void evalClosure(const Point2f &uv, BSDFClosure &closure) const
+    {
+        closure.color = m_kd->eval(uv);
+        closure.alpha = m_alpha->eval(uv).getLuminance();
+    }
+
     std::string toString() const
     {
         return tfm::format(
@@ -411,6 +500,46 @@ public:
     }
 
 private:
+    /// Return the roughness at the queried point (from the closure, if available)
+    float getAlpha(const BSDFQueryRecord &bRec) const
+    {
+        return bRec.closure ? bRec.closure->alpha : m_alpha->eval(bRec.uv).getLuminance();
+    }
+
+    /// Return the albedo of the diffuse base at the queried point
+    Color3f getKd(const BSDFQueryRecord &bRec) const
+    {
+        return bRec.closure ? bRec.closure->color : m_kd->eval(bRec.uv);
+    }
+
+    /// Evaluate the BRDF and its sampling density, sharing the microfacet distribution
+    Color3f evalWithPdf(const BSDFQueryRecord &bRec, float alpha, float p_spec, float &pdf) const
+    {
+        pdf = 0.0f;
+        if (bRec.measure != ESolidAngle || Frame::cosTheta(bRec.wi) <= 0 || Frame::cosTheta(bRec.wo) <= 0)
+            return Color3f(0.0f);
+
+        /* The sampling density of the half vector is D(wh) * cos(theta_h),
+           that of the reflected direction is smaller by 4 |wo . wh| */
+        Vector3f wh = (bRec.wi + bRec.wo).normalized();
+        float D = Reflectance::BeckmannNDF(wh, alpha);
+        pdf = p_spec * D * Frame::cosTheta(wh) / (4.0f * std::abs(wh.dot(bRec.wo))) +
+              (1 - p_spec) * Warp::squareToCosineHemispherePdf(bRec.wo);
+
+        Color3f F = Reflectance::fresnel(wh.dot(bRec.wi), m_extIOR, m_intIOR);
+        float G = Reflectance::G1(bRec.wi, wh, alpha) * Reflectance::G1(bRec.wo, wh, alpha);
+
+        Color3f specular = D * F * G /
+                           (4.0f * Frame::cosTheta(bRec.wi) * Frame::cosTheta(bRec.wo));
+
+        Color3f diffuse = 28.f * getKd(bRec) / (23.f * M_PI) *
+                          (1 - powf((m_extIOR - m_intIOR) / (m_extIOR + m_intIOR), 2)) *
+                          (1 - powf(1 - 0.5f * Frame::cosTheta(bRec.wi), 5)) *
+                          (1 - powf(1 - 0.5f * Frame::cosTheta(bRec.wo), 5));
+
+        return diffuse + specular;
+    }
+
     float m_intIOR, m_extIOR;
     Texture *m_alpha;
     Texture *m_kd;
@@ -18,9 +18,12 @@
 
 #include <nori/bsdf.h>
 #include <nori/frame.h>
+#include <nori/stats.h>
 
 NORI_NAMESPACE_BEGIN
 
+NORI_STAT_COUNTER(statsSamples, "BSDF samples", "mirror");
+
 /// Ideal mirror BRDF
 class Mirror : public BSDF
 {
@@ -41,6 +44,8 @@ public:
 
     Color3f sample(BSDFQueryRecord &bRec, const Point2f &) const
     {
+        NORI_STAT_INC(statsSamples);
+
         if (Frame::cosTheta(bRec.wi) <= 0)
             return Color3f(0.0f);
 
@@ -50,6 +55,10 @@ public:
             -bRec.wi.y(),
             bRec.wi.z());
         bRec.measure = EDiscrete;
+        bRec.lobe = EDeltaReflection;
+
+        /* Discrete BRDFs always have a zero density in Nori */
+        bRec.pdf = 0.0f;
 
         /* Relative index of refraction: no change */
         bRec.eta = 1.0f;
@@ -0,0 +1,499 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/parser.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/emitter.h>
+#include <nori/accel.h>
+#include <nori/timer.h>
+#include <nori/warp.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_init.h>
+#include <filesystem/resolver.h>
+#include <pcg32.h>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+/*
+ * noribench: a reproducible throughput benchmark for the BVH
+ *
+ * Loads a scene, then measures (for each requested thread count)
+ *  - the time needed to build the BVH, and the SAH cost of the result,
+ *    for each of the BVH builders
+ *  - the number of rays per second that Scene::rayIntersect() can trace
+ *    for a set of primary, shadow and diffuse bounce rays, both with the
+ *    closest-hit query and with the occlusion-only variant
+ *
+ * Rays are traced through the BVH of the builder selected by the scene. A
+ * separate instrumented pass counts the BVH nodes visited and triangles
+ * tested per ray. The results are written to a JSON file.
+ */
+
+using namespace nori;
+
+/// Number of rays that are handed to a TBB task at once
+#define RAY_CHUNK_SIZE 1024
+
+/// Result of tracing one batch of rays with a given thread count
+struct TraceRun {
+    int threads;
+    double time;
+};
+
+/// Build timings of one BVH builder, together with the quality of its result
+struct BuildResult {
+    Accel::EBuilder builder;
+    std::vector<TraceRun> runs;
+    float sahCost;
+    n_UINT nodeCount;
+};
+
+/// A set of rays of one kind, together with its measurements
+struct RayBatch {
+    std::string name;
+    std::vector<Ray3f> rays;
+    std::vector<TraceRun> closest, occlusion;
+    uint64_t hits = 0;
+    TraversalStatistics closestStats, occlusionStats;
+};
+
+static void printUsage(const char *name)
+{
+    cerr << "Syntax: " << name << " <scene.xml> [options]" << endl
+         << "Options:" << endl
+         << "  --threads 1,2,4  Comma-separated list of thread counts (default: powers of two)" << endl
+         << "  --builders LIST  Comma-separated list of BVH builders to time (default: sah,lbvh,hlbvh)" << endl
+         << "  --rays N         Number of rays per batch (default: 1000000)" << endl
+         << "  --repeat N       Keep the best of N timings (default: 3)" << endl
+         << "  --seed N         Seed of the ray generator (default: 0)" << endl
+         << "  --output FILE    Destination of the JSON report (default: <scene>_bench.json)" << endl;
+}
+
+/// Run \c func with exactly \c threads worker threads and return the best time over \c repeat runs
+template <typename Func> static double measure(int threads, int repeat, const Func &func)
+{
+    tbb::task_arena arena(threads);
+    double best = std::numeric_limits<double>::infinity();
+    for (int i = 0; i < repeat; ++i)
+    {
+        arena.execute([&]
+                      {
+            Timer timer;
+            func();
+            best = std::min(best, timer.elapsed()); });
+    }
+    return best;
+}
+
+/// Trace all rays of a batch and return the number of hits
+static uint64_t trace(const Scene *scene, const std::vector<Ray3f> &rays, bool shadowRay)
+{
+    std::atomic<uint64_t> hits(0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, rays.size(), RAY_CHUNK_SIZE),
+                      [&](const tbb::blocked_range<size_t> &range)
+                      {
+        uint64_t localHits = 0;
+        Intersection its;
+        for (size_t i = range.begin(); i < range.end(); ++i) {
+            if (shadowRay)
+                localHits += scene->rayIntersect(rays[i]) ? 1 : 0;
+            else
+                localHits += scene->rayIntersect(rays[i], its) ? 1 : 0;
+        }
+        hits += localHits; });
+    return hits;
+}
+
+/// Trace all rays of a batch once more using the instrumented traversal
+static TraversalStatistics traceInstrumented(const Accel *accel, const std::vector<Ray3f> &rays, bool shadowRay)
+{
+    return tbb::parallel_reduce(
+        tbb::blocked_range<size_t>(0, rays.size(), RAY_CHUNK_SIZE), TraversalStatistics(),
+        [&](const tbb::blocked_range<size_t> &range, TraversalStatistics stats)
+        {
+            Intersection its;
+            for (size_t i = range.begin(); i < range.end(); ++i)
+                accel->rayIntersect(rays[i], its, shadowRay, stats);
+            return stats;
+        },
+        [](TraversalStatistics a, const TraversalStatistics &b)
+        {
+            a.nodesVisited += b.nodesVisited;
+            a.trianglesTested += b.trianglesTested;
+            return a;
+        });
+}
+
+/**
+ * \brief Generate the primary, shadow and diffuse bounce ray batches
+ *
+ * Every ray is derived from its own pcg32 stream, hence the batches only
+ * depend on the scene and the seed and not on the thread count.
+ */
+static std::vector<RayBatch> generateRays(const Scene *scene, size_t rayCount, uint64_t seed)
+{
+    const Camera *camera = scene->getCamera();
+    Vector2i size = camera->getOutputSize();
+    size_t pixelCount = (size_t)size.x() * (size_t)size.y();
+
+    std::vector<RayBatch> batches(3);
+    batches[0].name = "primary";
+    batches[1].name = "shadow";
+    batches[2].name = "diffuse";
+
+    /* Primary rays sweep over the image in scanline order */
+    std::vector<Ray3f> &primary = batches[0].rays;
+    primary.resize(rayCount);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, rayCount, RAY_CHUNK_SIZE),
+                      [&](const tbb::blocked_range<size_t> &range)
+                      {
+        for (size_t i = range.begin(); i < range.end(); ++i) {
+            pcg32 random(seed, i);
+            size_t pixel = i % pixelCount;
+            Point2f pixelSample((float) (pixel % size.x()) + random.nextFloat(),
+                                (float) (pixel / size.x()) + random.nextFloat());
+            Point2f apertureSample(random.nextFloat(), random.nextFloat());
+            camera->sampleRay(primary[i], pixelSample, apertureSample);
+        } });
+
+    /* Shadow and diffuse bounce rays start at the primary hits */
+    std::vector<Ray3f> shadow(rayCount), diffuse(rayCount);
+    std::vector<char> valid(rayCount, 0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, rayCount, RAY_CHUNK_SIZE),
+                      [&](const tbb::blocked_range<size_t> &range)
+                      {
+        for (size_t i = range.begin(); i < range.end(); ++i) {
+            Intersection its;
+            if (!scene->rayIntersect(primary[i], its))
+                continue;
+
+            /* Use a second stream so that these rays are independent of the camera samples */
+            pcg32 random(seed, rayCount + i);
+
+            if (!scene->getLights().empty()) {
+                float pdf;
+                const Emitter *emitter = scene->sampleEmitter(random.nextFloat(), pdf);
+                EmitterQueryRecord lRec(its.p);
+                Point2f sample(random.nextFloat(), random.nextFloat());
+                emitter->sample(lRec, sample, random.nextFloat());
+                float maxt = std::isfinite(lRec.dist) ? lRec.dist * (1.f - Epsilon) : std::numeric_limits<float>::infinity();
+                shadow[i] = Ray3f(its.p, lRec.wi, Epsilon, maxt);
+            }
+
+            Point2f sample(random.nextFloat(), random.nextFloat());
+            diffuse[i] = Ray3f(its.p, its.shFrame.toWorld(Warp::squareToCosineHemisphere(sample)));
+            valid[i] = 1;
+        } });
+
+    for (size_t i = 0; i < rayCount; ++i)
+    {
+        if (!valid[i])
+            continue;
+        if (!scene->getLights().empty())
+            batches[1].rays.push_back(shadow[i]);
+        batches[2].rays.push_back(diffuse[i]);
+    }
+
+    return batches;
+}
+
+/// Throughput in millions of rays per second
+static double mrays(size_t rayCount, double time)
+{
+    return time > 0 ? rayCount / (time * 1000.0) : 0.0;
+}
+
+/// Parallel efficiency relative to the first (usually single-threaded) run
+static double efficiency(const TraceRun &base, const TraceRun &run)
+{
+    if (run.time <= 0)
+        return 0.0;
+    return (base.time * base.threads) / (run.time * run.threads);
+}
+
+static std::string escapeJSON(const std::string &str)
+{
+    std::string result;
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        result += c;
+    }
+    return result;
+}
+
+static void writeRuns(std::ostream &os, const std::vector<TraceRun> &runs, size_t rayCount)
+{
+    os << "[";
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        os << (i > 0 ? ", " : "")
+           << tfm::format("{ \"threads\": %i, \"ms\": %.4f, \"mrays_per_sec\": %.4f, \"efficiency\": %.4f }",
+                          runs[i].threads, runs[i].time, mrays(rayCount, runs[i].time), efficiency(runs[0], runs[i]));
+    }
+    os << "]";
+}
+
+static void writeStats(std::ostream &os, const TraversalStatistics &stats, size_t rayCount)
+{
+    double n = (double)std::max(rayCount, (size_t)1);
+    os << tfm::format("{ \"nodes_per_ray\": %.4f, \"triangles_per_ray\": %.4f }",
+                      stats.nodesVisited / n, stats.trianglesTested / n);
+}
+
+int main(int argc, char **argv)
+{
+    std::string sceneName, outputName;
+    std::vector<int> threadCounts;
+    std::vector<Accel::EBuilder> builders;
+    size_t rayCount = 1000000;
+    int repeat = 3;
+    uint64_t seed = 0;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string token(argv[i]);
+        bool hasValue = i + 1 < argc;
+
+        if (token == "-t" || token == "--threads")
+        {
+            if (!hasValue)
+            {
+                printUsage(argv[0]);
+                return -1;
+            }
+            std::istringstream is(argv[++i]);
+            std::string item;
+            while (std::getline(is, item, ','))
+            {
+                int threads = atoi(item.c_str());
+                if (threads <= 0)
+                {
+                    cerr << "\"--threads\" argument expects a list of positive integers." << endl;
+                    return -1;
+                }
+                threadCounts.push_back(threads);
+            }
+        }
+        else if (token == "--builders" && hasValue)
+        {
+            std::istringstream is(argv[++i]);
+            std::string item;
+            try
+            {
+                while (std::getline(is, item, ','))
+                    builders.push_back(Accel::parseBuilder(item));
+            }
+            catch (const NoriException &e)
+            {
+                cerr << e.what() << endl;
+                return -1;
+            }
+        }
+        else if (token == "--rays" && hasValue)
+            rayCount = (size_t)std::max(atoll(argv[++i]), 1LL);
+        else if (token == "--repeat" && hasValue)
+            repeat = std::max(atoi(argv[++i]), 1);
+        else if (token == "--seed" && hasValue)
+            seed = (uint64_t)atoll(argv[++i]);
+        else if ((token == "-o" || token == "--output") && hasValue)
+            outputName = argv[++i];
+        else if (sceneName.empty() && filesystem::path(token).extension() == "xml")
+            sceneName = token;
+        else
+        {
+            printUsage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (sceneName.empty())
+    {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    if (threadCounts.empty())
+    {
+        int maxThreads = tbb::task_scheduler_init::default_num_threads();
+        for (int threads = 1; threads < maxThreads; threads *= 2)
+            threadCounts.push_back(threads);
+        threadCounts.push_back(maxThreads);
+    }
+
+    if (builders.empty())
+        builders = {Accel::ESAH, Accel::ELBVH, Accel::EHLBVH};
+
+    if (outputName.empty())
+    {
+        outputName = sceneName;
+        size_t lastdot = outputName.find_last_of(".");
+        if (lastdot != std::string::npos)
+            outputName.erase(lastdot, std::string::npos);
+        outputName += "_bench.json";
+    }
+
+    try
+    {
+        /* Add the parent directory of the scene file to the
+           file resolver, see main.cpp */
+        getFileResolver()->prepend(filesystem::path(sceneName).parent_path());
+
+        std::unique_ptr<NoriObject> root(loadFromXML(sceneName));
+        if (root->getClassType() != NoriObject::EScene)
+            throw NoriException("\"%s\" does not describe a scene!", sceneName);
+        Scene *scene = static_cast<Scene *>(root.get());
+        Accel *accel = scene->getAccel();
+        accel->setCompareFormats(false);
+
+        /* BVH construction with each builder */
+        Accel::EBuilder sceneBuilder = accel->getBuilder();
+        std::vector<BuildResult> buildResults;
+        for (Accel::EBuilder builder : builders)
+        {
+            BuildResult result{builder, {}, 0.f, 0};
+            accel->setBuilder(builder);
+            for (int threads : threadCounts)
+                result.runs.push_back({threads, measure(threads, repeat, [&]
+                                                        { accel->build(); })});
+            result.sahCost = accel->getSAHCost();
+            result.nodeCount = accel->getNodeCount();
+            buildResults.push_back(result);
+        }
+
+        for (const BuildResult &result : buildResults)
+            cout << tfm::format("BVH builder \"%s\": %.2f ms using %i thread(s), SAH cost = %.4f",
+                                Accel::getBuilderName(result.builder), result.runs.back().time,
+                                result.runs.back().threads, result.sahCost)
+                 << endl;
+
+        /* Rays are traced through the BVH requested by the scene, which is
+           also compared against the binary node format (not timed) */
+        accel->setBuilder(sceneBuilder);
+        accel->setCompareFormats(true);
+        accel->build();
+
+        cout << "Generating rays .. ";
+        cout.flush();
+        Timer timer;
+        std::vector<RayBatch> batches = generateRays(scene, rayCount, seed);
+        cout << "done. (took " << timer.elapsedString() << ")" << endl;
+
+        /* Ray traversal */
+        for (RayBatch &batch : batches)
+        {
+            if (batch.rays.empty())
+                continue;
+
+            for (int threads : threadCounts)
+            {
+                cout << "Tracing " << batch.rays.size() << " " << batch.name
+                     << " rays using " << threads << " thread(s) .. ";
+                cout.flush();
+
+                uint64_t hits = 0;
+                TraceRun closest{threads, measure(threads, repeat, [&]
+                                                  { hits = trace(scene, batch.rays, false); })};
+                TraceRun occlusion{threads, measure(threads, repeat, [&]
+                                                    { trace(scene, batch.rays, true); })};
+                batch.closest.push_back(closest);
+                batch.occlusion.push_back(occlusion);
+                batch.hits = hits;
+
+                cout << tfm::format("%.2f / %.2f Mrays/s (closest / occlusion)",
+                                    mrays(batch.rays.size(), closest.time),
+                                    mrays(batch.rays.size(), occlusion.time))
+                     << endl;
+            }
+
+            batch.closestStats = traceInstrumented(accel, batch.rays, false);
+            batch.occlusionStats = traceInstrumented(accel, batch.rays, true);
+        }
+
+        /* Write the JSON report */
+        std::ofstream os(outputName);
+        if (!os)
+            throw NoriException("Unable to open \"%s\" for writing!", outputName);
+
+        os << "{" << endl;
+        os << "  \"scene\": \"" << escapeJSON(sceneName) << "\"," << endl;
+        os << "  \"triangles\": " << accel->getTriangleCount() << "," << endl;
+        os << "  \"builder\": \"" << Accel::getBuilderName(sceneBuilder) << "\"," << endl;
+        os << "  \"bvh_nodes\": " << accel->getNodeCount() << "," << endl;
+        os << "  \"seed\": " << seed << "," << endl;
+        os << "  \"repeat\": " << repeat << "," << endl;
+        os << "  \"build\": [";
+        for (size_t j = 0; j < buildResults.size(); ++j)
+        {
+            const BuildResult &result = buildResults[j];
+            os << (j > 0 ? "," : "") << endl
+               << tfm::format("    { \"builder\": \"%s\", \"sah_cost\": %.4f, \"bvh_nodes\": %i, \"runs\": [",
+                              Accel::getBuilderName(result.builder), result.sahCost, result.nodeCount);
+            for (size_t i = 0; i < result.runs.size(); ++i)
+            {
+                os << (i > 0 ? ", " : "")
+                   << tfm::format("{ \"threads\": %i, \"ms\": %.4f, \"efficiency\": %.4f }",
+                                  result.runs[i].threads, result.runs[i].time, efficiency(result.runs[0], result.runs[i]));
+            }
+            os << "] }";
+        }
+        os << endl
+           << "  ]," << endl;
+        os << "  \"rays\": {" << endl;
+        bool first = true;
+        for (const RayBatch &batch : batches)
+        {
+            if (batch.rays.empty())
+                continue;
+            size_t n = batch.rays.size();
+            os << (first ? "" : ",\n") << "    \"" << batch.name << "\": {" << endl;
+            os << "      \"count\": " << n << "," << endl;
+            os << tfm::format("      \"hit_rate\": %.4f,", batch.hits / (double)n) << endl;
+            os << "      \"closest\": { \"stats\": ";
+            writeStats(os, batch.closestStats, n);
+            os << ", \"runs\": ";
+            writeRuns(os, batch.closest, n);
+            os << " }," << endl;
+            os << "      \"occlusion\": { \"stats\": ";
+            writeStats(os, batch.occlusionStats, n);
+            os << ", \"runs\": ";
+            writeRuns(os, batch.occlusion, n);
+            os << " }" << endl;
+            os << "    }";
+            first = false;
+        }
+        os << endl
+           << "  }" << endl;
+        os << "}" << endl;
+
+        cout << "Wrote benchmark results to \"" << outputName << "\"" << endl;
+    }
+    catch (const std::exception &e)
+    {
+        cerr << "[FATAL ERROR]: " << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
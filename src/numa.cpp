@@ -0,0 +1,204 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <nori/numa.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <tbb/task_scheduler_observer.h>
+#include <fstream>
+#include <sstream>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+NORI_NAMESPACE_BEGIN
+
+thread_local int NumaExecutor::s_currentNode = 0;
+
+/// Arena, thread pinning and pending work of a single node
+struct NumaExecutor::Node
+{
+    /// Pins the worker threads to the node's CPUs while they work in its arena
+    class Observer : public tbb::task_scheduler_observer
+    {
+    public:
+        Observer(tbb::task_arena &arena, int index, const std::vector<int> &cpus)
+            : tbb::task_scheduler_observer(arena), m_index(index)
+        {
+#if defined(__linux__)
+            CPU_ZERO(&m_cpus);
+            for (int cpu : cpus)
+                CPU_SET(cpu, &m_cpus);
+            if (sched_getaffinity(0, sizeof(cpu_set_t), &m_original) != 0)
+                m_original = m_cpus;
+#endif
+            observe(true);
+        }
+
+        ~Observer() { observe(false); }
+
+        void on_scheduler_entry(bool isWorker) override
+        {
+            s_currentNode = m_index;
+#if defined(__linux__)
+            if (isWorker)
+                sched_setaffinity(0, sizeof(cpu_set_t), &m_cpus);
+#endif
+        }
+
+        void on_scheduler_exit(bool isWorker) override
+        {
+            /* Workers may join other arenas afterwards: undo the pinning */
+            s_currentNode = 0;
+#if defined(__linux__)
+            if (isWorker)
+                sched_setaffinity(0, sizeof(cpu_set_t), &m_original);
+#endif
+        }
+
+    private:
+        int m_index;
+#if defined(__linux__)
+        cpu_set_t m_cpus, m_original;
+#endif
+    };
+
+    Node(int index, int threadCount, unsigned reservedForMasters, const std::vector<int> &cpus)
+        : arena(threadCount, reservedForMasters), threadCount(threadCount)
+    {
+        if (!cpus.empty())
+            observer.reset(new Observer(arena, index, cpus));
+    }
+
+    tbb::task_arena arena;
+    std::unique_ptr<Observer> observer;
+    tbb::task_group group;
+    int threadCount;
+};
+
+std::vector<std::vector<int>> NumaExecutor::getTopology()
+{
+    std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+    cpu_set_t usable;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &usable) != 0)
+        return nodes;
+
+    for (int node = 0; node < 1024; ++node)
+    {
+        std::ifstream is(tfm::format("/sys/devices/system/node/node%i/cpulist", node));
+        if (!is)
+        {
+            /* Node numbers may have gaps, but not beyond the first few missing ones */
+            if (node >= 64)
+                break;
+            continue;
+        }
+
+        /* Parse a list of CPU ranges, e.g. "0-15,32-47" */
+        std::vector<int> cpus;
+        std::string range;
+        while (std::getline(is, range, ','))
+        {
+            int first = 0, last = -1;
+            char dash;
+            std::istringstream rs(range);
+            if (!(rs >> first))
+                continue;
+            if (!(rs >> dash >> last))
+                last = first;
+            for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+                if (CPU_ISSET(cpu, &usable))
+                    cpus.push_back(cpu);
+        }
+
+        /* Skip nodes without (usable) CPUs, e.g. memory-only nodes */
+        if (!cpus.empty())
+            nodes.push_back(cpus);
+    }
+#endif
+    return nodes;
+}
+
+NumaExecutor::NumaExecutor(int threadCount, bool enable)
+{
+    std::vector<std::vector<int>> topology;
+    if (enable)
+        topology = getTopology();
+
+    int cpuCount = 0;
+    for (const auto &cpus : topology)
+        cpuCount += (int)cpus.size();
+    if (threadCount < 0)
+        threadCount = cpuCount;
+
+    if (topology.size() < 2 || threadCount < (int)topology.size())
+    {
+        m_nodes.emplace_back(new Node(0, threadCount > 0 ? threadCount : tbb::task_arena::automatic,
+                                      1, std::vector<int>()));
+        return;
+    }
+
+    /* Distribute the threads in proportion to the number of CPUs per node */
+    std::vector<int> threads(topology.size(), 1);
+    for (int i = (int)topology.size(); i < threadCount; ++i)
+    {
+        size_t best = 0;
+        for (size_t j = 1; j < topology.size(); ++j)
+            if (threads[j] * topology[best].size() < threads[best] * topology[j].size())
+                best = j;
+        threads[best]++;
+    }
+
+    /* The calling thread participates in the arena of the first node */
+    for (size_t i = 0; i < topology.size(); ++i)
+        m_nodes.emplace_back(new Node((int)i, threads[i], i == 0 ? 1 : 0, topology[i]));
+}
+
+NumaExecutor::~NumaExecutor() {}
+
+int NumaExecutor::getThreadCount(int node) const
+{
+    return m_nodes[node]->threadCount;
+}
+
+void NumaExecutor::run(const std::function<void(int)> &func)
+{
+    if (m_nodes.size() == 1)
+    {
+        m_nodes[0]->arena.execute([&] { func(0); });
+        return;
+    }
+
+    /* Start the work on all nodes, then wait (and help with node 0) */
+    for (size_t i = 0; i < m_nodes.size(); ++i)
+    {
+        Node *node = m_nodes[i].get();
+        node->arena.execute([&] { node->group.run([&func, i] { func((int)i); }); });
+    }
+
+    for (auto &node : m_nodes)
+    {
+        Node *n = node.get();
+        n->arena.execute([n] { n->group.wait(); });
+    }
+}
+
+NORI_NAMESPACE_END
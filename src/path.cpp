@@ -3,9 +3,14 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/stats.h>
 #include <nori/scene.h>
 
 NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+NORI_STAT_COUNTER(statsRouletteTerminations, "Integrator", "Russian roulette terminations");
+
 class PathTracing : public Integrator
 {
 public:
@@ -53,8 +58,11 @@ public:
             Vector3f wi = its.toWorld(bsdfRecord.wo);
             Ray3f sampledRay(its.p, wi);
             Intersection shadowIts;
+            NORI_STAT_INC(statsSecondaryRays);
             Lo += Li(scene, sampler, sampledRay) * fr / q;
         }
+        else
+            NORI_STAT_INC(statsRouletteTerminations);
 
         return Lo;
     }
@@ -0,0 +1,337 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/emitter.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/sdtree.h>
+#include <nori/stats.h>
+#include <nori/timer.h>
+
+/* Vertices of a training path whose incident radiance is recorded */
+#define NORI_GUIDING_MAX_VERTICES 32
+
+/* Maximum depth of the directional quadtrees */
+#define NORI_DTREE_MAX_DEPTH 20
+
+NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+NORI_STAT_COUNTER(statsRouletteTerminations, "Integrator", "Russian roulette terminations");
+NORI_STAT_COUNTER(statsGuidedSamples, "Path guiding", "Guided directions");
+NORI_STAT_COUNTER(statsTrainingPaths, "Path guiding", "Training paths");
+
+/**
+ * \brief Path tracer that learns where light comes from (practical path guiding)
+ *
+ * The passes of a progressive render (see \ref preparePass()) are grouped
+ * into training iterations of 1, 2, 4, .. passes. Every iteration records
+ * the incident radiance at the path vertices in an \ref SDTree, whose
+ * distributions then guide the directions that are sampled in the next
+ * iteration. Worker threads record into the tree concurrently using
+ * atomic additions only, and the tree is refined between the iterations.
+ * Directions are sampled from a mixture of the BSDF and the learned
+ * distribution, combined with next event estimation using MIS.
+ *
+ * The images of the training iterations are unbiased as well and remain
+ * part of the result (discarding them would only pay off if guiding more
+ * than halved the variance). A render that consists of a single pass
+ * (i.e. that is not progressive) is therefore not guided at all.
+ */
+class PathGuiding : public Integrator
+{
+public:
+    PathGuiding(const PropertyList &props)
+    {
+        /* Number of training iterations, after which the tree is kept fixed (the last one renders 2^(n-1) passes) */
+        m_iterations = props.getInteger("iterations", 8);
+
+        /* Probability of sampling the BSDF instead of the learned distribution */
+        m_bsdfFraction = clamp(props.getFloat("bsdf_fraction", 0.5f), 0.0f, 1.0f);
+
+        /* Samples after which a spatial region is split (times the square root of the samples per pixel) */
+        m_spatialThreshold = props.getInteger("spatial_threshold", 4000);
+
+        /* Fraction of the energy of a region above which a directional quadrant is subdivided */
+        m_directionalThreshold = props.getFloat("directional_threshold", 0.01f);
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        m_tree.reset(new SDTree(scene->getBoundingBox()));
+        m_training = m_iterations > 0;
+    }
+
+    void beginRender(const Scene *scene, const Camera *camera)
+    {
+        /* Every view (e.g. the frames of a camera path) learns its own tree from scratch */
+        preprocess(scene);
+        m_pass = 0;
+        m_timer.reset();
+    }
+
+    void preparePass(const Scene *scene, uint32_t pass)
+    {
+        m_pass = pass;
+
+        /* Iteration i consists of the passes 2^i - 1 .. 2^(i+1) - 2 */
+        if (!m_training || (pass & (pass + 1)) != 0)
+            return;
+        int iteration = 0;
+        while ((2u << iteration) <= pass)
+            ++iteration;
+        uint32_t sampleCount = ((pass + 1) / 2) * scene->getSampler()->getSampleCount();
+
+        /* Sample from the radiance recorded in this iteration from now on */
+        m_tree->build();
+        if (iteration + 1 < m_iterations)
+            m_tree->refine((uint32_t)(m_spatialThreshold * std::sqrt((float)sampleCount)),
+                           m_directionalThreshold, NORI_DTREE_MAX_DEPTH);
+        else
+            m_training = false;
+
+        cout << tfm::format("Path guiding: training iteration %i (%i spp) took %s, "
+                            "%i regions, %i directional nodes",
+                            iteration + 1, sampleCount, m_timer.elapsedString(),
+                            m_tree->getLeafCount(), m_tree->getDirectionalNodeCount())
+             << endl;
+        m_timer.reset();
+    }
+
+    void endRender(ImageBlock &result)
+    {
+        if (m_iterations > 0 && m_pass == 0)
+            cout << "Path guiding: warning: the render consisted of a single pass, which "
+                    "is not guided (render progressively, e.g. using --time)" << endl;
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+    {
+        if (m_training)
+            NORI_STAT_INC(statsTrainingPaths);
+        return trace(scene, sampler, ray, m_training);
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PathGuiding[\n"
+            "  iterations = %i,\n"
+            "  bsdf_fraction = %f,\n"
+            "  spatial_threshold = %i,\n"
+            "  directional_threshold = %f\n"
+            "]",
+            m_iterations, m_bsdfFraction, m_spatialThreshold, m_directionalThreshold);
+    }
+
+private:
+    /// A vertex of a training path, which receives the radiance found by the rest of the path
+    struct GuidingVertex
+    {
+        DTreeWrapper *region;
+        Vector3f wo;
+        float pdf;
+        Color3f throughput;
+        Color3f radiance;
+
+        /// Add a contribution to the image, which is converted to radiance incident at this vertex
+        void add(const Color3f &contribution)
+        {
+            for (int i = 0; i < 3; ++i)
+            {
+                if (throughput[i] > 0)
+                    radiance[i] += contribution[i] / throughput[i];
+            }
+        }
+    };
+
+    /**
+     * Trace a path. During training (\c train == true), the radiance found
+     * along the path is recorded in the SD-tree at each of its vertices.
+     */
+    Color3f trace(const Scene *scene, Sampler *sampler, Ray3f ray, bool train) const
+    {
+        GuidingVertex vertices[NORI_GUIDING_MAX_VERTICES];
+        int vertexCount = 0;
+
+        Color3f Li(0.0f), throughput(1.0f);
+        float pdfPrevious = 0.0f;
+        bool specular = true;
+
+        /* Emission found by sampling a direction. The vertices only learn its MIS-weighted
+           share, i.e. the light that next event estimation does not already handle well */
+        auto addEmission = [&](const Color3f &Le, float weight)
+        {
+            Color3f contribution = weight * throughput * Le;
+            Li += contribution;
+            if (train)
+                for (int i = 0; i < vertexCount; ++i)
+                    vertices[i].add(contribution);
+        };
+
+        for (int depth = 0;; ++depth)
+        {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+            {
+                Color3f Le = scene->getBackground(ray);
+                const Emitter *environment = scene->getEnvironmentalEmitter();
+                if (!Le.isZero())
+                {
+                    float weight = 1.0f;
+                    if (!specular)
+                    {
+                        EmitterQueryRecord lRec(environment, ray.o, ray.o + ray.d, Normal3f(0, 0, 1), Vector2f());
+                        weight = misWeight(pdfPrevious, scene->pdfEmitter(environment) * environment->pdf(lRec));
+                    }
+                    addEmission(Le, weight);
+                }
+                break;
+            }
+
+            if (its.mesh->isEmitter())
+            {
+                const Emitter *emitter = its.mesh->getEmitter();
+                EmitterQueryRecord lRec(emitter, ray.o, its.p, its.shFrame.n, its.uv);
+                float weight = specular ? 1.0f : misWeight(pdfPrevious, scene->pdfEmitter(emitter) * emitter->pdf(lRec));
+                addEmission(emitter->eval(lRec), weight);
+                break;
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            if (!bsdf)
+                break;
+
+            /* Look up the textures of the BSDF once for all queries below */
+            BSDFClosure closure;
+            bsdf->evalClosure(its.uv, closure);
+            Vector3f wi = its.toLocal(-ray.d);
+
+            DTreeWrapper *region = m_tree->lookup(its.p);
+            float bsdfFraction = region->sampling.getSum() > 0 ? m_bsdfFraction : 1.0f;
+
+            /* Next event estimation, contributes to the radiance of the previous vertices */
+            if (!scene->getLights().empty())
+            {
+                float pdfSelect;
+                const Emitter *emitter = scene->sampleEmitter(sampler->next1D(), pdfSelect);
+                EmitterQueryRecord lRec(its.p);
+                Color3f Le = emitter->sample(lRec, sampler->next2D(), 0.0f);
+                float pdfLight = pdfSelect * emitter->pdf(lRec);
+                if (!Le.isZero() && pdfLight > 0)
+                {
+                    float maxt = std::isfinite(lRec.dist) ? lRec.dist * (1.0f - Epsilon) : std::numeric_limits<float>::infinity();
+                    NORI_STAT_INC(statsShadowRays);
+                    if (!scene->rayIntersect(Ray3f(its.p, lRec.wi, Epsilon, maxt)))
+                    {
+                        BSDFQueryRecord bRec(wi, its.toLocal(lRec.wi), its.uv, ESolidAngle, &closure);
+                        float pdfBsdf;
+                        Color3f f = bsdf->evalWithPdf(bRec, pdfBsdf);
+                        if (!f.isZero())
+                        {
+                            float pdfDirection = bsdfFraction * pdfBsdf;
+                            if (bsdfFraction < 1.0f)
+                                pdfDirection += (1.0f - bsdfFraction) * region->sampling.pdf(lRec.wi);
+                            float weight = emitter->getEmitterType() == EmitterType::EMITTER_POINT
+                                               ? 1.0f : misWeight(pdfLight, pdfDirection);
+                            Color3f contribution = throughput * f * std::abs(Frame::cosTheta(bRec.wo)) * Le * (weight / pdfLight);
+                            Li += contribution;
+                            if (train)
+                                for (int i = 0; i < vertexCount; ++i)
+                                    vertices[i].add(contribution);
+                        }
+                    }
+                }
+            }
+
+            /* Sample the BSDF first, which also reveals delta lobes that cannot be guided */
+            BSDFQueryRecord bRec(wi, its.uv, &closure);
+            bRec.measure = ESolidAngle;
+            Color3f weight = bsdf->sample(bRec, sampler->next2D());
+
+            if (bRec.lobe & EDelta)
+            {
+                if (weight.isZero())
+                    break;
+                specular = true;
+            }
+            else
+            {
+                Color3f fCos = weight * bRec.pdf;
+                float pdfBsdf = bRec.pdf, pdfGuided = 0.0f;
+                if (bsdfFraction < 1.0f)
+                {
+                    if (sampler->next1D() >= bsdfFraction)
+                    {
+                        /* Replace the direction with one from the learned distribution */
+                        NORI_STAT_INC(statsGuidedSamples);
+                        Vector3f d = region->sampling.sample(sampler->next2D(), pdfGuided);
+                        bRec = BSDFQueryRecord(wi, its.toLocal(d), its.uv, ESolidAngle, &closure);
+                        fCos = bsdf->evalWithPdf(bRec, pdfBsdf) * std::abs(Frame::cosTheta(bRec.wo));
+                    }
+                    else
+                    {
+                        pdfGuided = region->sampling.pdf(its.toWorld(bRec.wo));
+                    }
+                }
+
+                float pdf = bsdfFraction * pdfBsdf + (1.0f - bsdfFraction) * pdfGuided;
+                if (fCos.isZero() || !(pdf > 0))
+                    break;
+
+                weight = fCos / pdf;
+                pdfPrevious = pdf;
+                specular = false;
+            }
+
+            throughput *= weight;
+            Vector3f wo = its.toWorld(bRec.wo);
+
+            if (train && !specular && vertexCount < NORI_GUIDING_MAX_VERTICES)
+                vertices[vertexCount++] = {region, wo, pdfPrevious, throughput, Color3f(0.0f)};
+
+            /* Russian roulette */
+            if (depth >= 3)
+            {
+                float q = std::min(throughput.maxCoeff(), 0.95f);
+                if (sampler->next1D() >= q)
+                {
+                    NORI_STAT_INC(statsRouletteTerminations);
+                    break;
+                }
+                throughput /= q;
+            }
+
+            NORI_STAT_INC(statsSecondaryRays);
+            ray = Ray3f(its.p, wo);
+        }
+
+        /* Record the incident radiance at each vertex as an estimate of its integral over directions */
+        for (int i = 0; i < vertexCount; ++i)
+        {
+            const GuidingVertex &vertex = vertices[i];
+            vertex.region->record(vertex.wo, vertex.radiance.getLuminance() / vertex.pdf);
+        }
+
+        return Li;
+    }
+
+    /// Balance heuristic
+    static float misWeight(float pdfA, float pdfB)
+    {
+        return pdfA / (pdfA + pdfB);
+    }
+
+    int m_iterations;
+    float m_bsdfFraction;
+    int m_spatialThreshold;
+    float m_directionalThreshold;
+    std::unique_ptr<SDTree> m_tree;
+    bool m_training = false;
+    uint32_t m_pass = 0;
+    Timer m_timer;
+};
+
+NORI_REGISTER_CLASS(PathGuiding, "path_guided");
+NORI_NAMESPACE_END
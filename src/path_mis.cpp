@@ -3,9 +3,15 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/stats.h>
 #include <nori/scene.h>
 
 NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+NORI_STAT_COUNTER(statsRouletteTerminations, "Integrator", "Russian roulette terminations");
+
 class PathTracingMIS : public Integrator
 {
 public:
@@ -54,7 +60,11 @@ public:
         // bsdf sampling
         const BSDF *bsdf = its.mesh->getBSDF();
 
-        BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d), its.uv);
+        // Look up the textures of the BSDF once for all queries below
+        BSDFClosure closure;
+        bsdf->evalClosure(its.uv, closure);
+
+        BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d), its.uv, &closure);
         bsdfRecord.measure = ESolidAngle;
 
         Color3f frMats = bsdf->sample(bsdfRecord, sampler->next2D());
@@ -62,12 +72,15 @@ public:
         {
             return Lo;
         }
-        float p_matW_mat = bsdf->pdf(bsdfRecord);
+        float p_matW_mat = bsdfRecord.pdf;
 
         // Russian Roulette
         float q = std::max(0.05f, 1 - frMats.getLuminance());
         if (sampler->next1D() <= q)
+        {
+            NORI_STAT_INC(statsRouletteTerminations);
             return Lo;
+        }
 
         // Here perform a visibility query, to check whether the light
         // source "em" is visible from the intersection point.
@@ -76,13 +89,14 @@ public:
         // V function in equation term
         Ray3f shadowRay(its.p, emitterRecord.wi);
         Intersection shadowItsEms;
+        NORI_STAT_INC(statsShadowRays);
         if (!(scene->rayIntersect(shadowRay, shadowItsEms) && shadowItsEms.t <= emitterRecord.dist))
         {
             BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d),
-                                       its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
+                                       its.toLocal(emitterRecord.wi), its.uv, ESolidAngle, &closure);
             float cosTheta = its.shFrame.n.dot(emitterRecord.wi);
-            float p_mat_Wem = bsdf->pdf(bsdfRecord);
-            Color3f frEms = bsdf->eval(bsdfRecord);
+            float p_mat_Wem;
+            Color3f frEms = bsdf->evalWithPdf(bsdfRecord, p_mat_Wem);
             // calculating the cosin term
             float wem = p_emW_em / (p_emW_em + p_mat_Wem);
 
@@ -96,6 +110,7 @@ public:
         Vector3f wi = its.toWorld(bsdfRecord.wo);
         Ray3f sampledRay(its.p, wi);
         Intersection shadowItsMats;
+        NORI_STAT_INC(statsSecondaryRays);
         if (scene->rayIntersect(sampledRay, shadowItsMats))
         {
             if (shadowItsMats.mesh->isEmitter())
@@ -117,6 +132,7 @@ public:
             Color3f LiMat = scene->getBackground(sampledRay);
             Lo += LiMat * frMats;
         }
+        NORI_STAT_INC(statsSecondaryRays);
         Lo += frMats * Li(scene, sampler, sampledRay);
 
         return Lo;
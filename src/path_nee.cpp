@@ -3,9 +3,15 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/stats.h>
 #include <nori/scene.h>
 
 NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+NORI_STAT_COUNTER(statsRouletteTerminations, "Integrator", "Russian roulette terminations");
+
 class PathTracingNEE : public Integrator
 {
 public:
@@ -38,7 +44,11 @@ public:
         // sampling from intersection point
         const BSDF *bsdf = its.mesh->getBSDF();
 
-        BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d), its.uv);
+        // Look up the textures of the BSDF once for all queries below
+        BSDFClosure closure;
+        bsdf->evalClosure(its.uv, closure);
+
+        BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d), its.uv, &closure);
         bsdfRecord.measure = ESolidAngle;
 
         Color3f fr = bsdf->sample(bsdfRecord, sampler->next2D());
@@ -50,6 +60,7 @@ public:
         // keep going
         if (sampler->next1D() > q)
         {
+            NORI_STAT_INC(statsRouletteTerminations);
             return Lo;
         }
 
@@ -64,6 +75,7 @@ public:
         Color3f Le = em->sample(emitterRecord, sampler->next2D(), 0.0f);
         Ray3f shadowRay(its.p, emitterRecord.wi);
         Intersection shadowIts;
+        NORI_STAT_INC(statsShadowRays);
         if (!(scene->rayIntersect(shadowRay, shadowIts) && shadowIts.t <= emitterRecord.dist) && bsdfRecord.measure == EDiscrete)
         {
             // Finally, we evaluate the BSDF. For that, we need to build
@@ -74,9 +86,9 @@ public:
             // of reference; and b) that both the incoming and outgoing
             // directions are assumed to start from the intersection point.
             BSDFQueryRecord bsdfRecord(its.toLocal(-ray.d),
-                                       its.toLocal(emitterRecord.wi), its.uv, ESolidAngle);
+                                       its.toLocal(emitterRecord.wi), its.uv, ESolidAngle, &closure);
 
-            Color3f fr = its.mesh->getBSDF()->eval(bsdfRecord);
+            Color3f fr = bsdf->eval(bsdfRecord);
 
             // pΩ(x, x(k) l ) is the product of the pdf of choosing the light source and the pdf of x(k) at the light source.
             float pOmega = pdfEmitter * em->pdf(emitterRecord);
@@ -88,6 +100,7 @@ public:
 
         Vector3f wi = its.toWorld(bsdfRecord.wo);
         Ray3f sampledRay(its.p, wi);
+        NORI_STAT_INC(statsSecondaryRays);
         Lo += Li(scene, sampler, sampledRay) * fr;
 
         return Lo;
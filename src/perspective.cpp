@@ -28,6 +28,11 @@ NORI_NAMESPACE_BEGIN
  *
  * This class implements a simple perspective camera model. It uses an
  * infinitesimally small aperture, creating an infinite depth of field.
+ *
+ * The camera can also follow a path: further keyframes "toWorld1",
+ * "toWorld2", .. are evenly spaced over "frames" frames (default: one
+ * per keyframe). Between two keyframes, the translation and scale are
+ * interpolated linearly and the rotation spherically.
  */
 class PerspectiveCamera : public Camera
 {
@@ -42,6 +47,16 @@ public:
         /* Specifies an optional camera-to-world transformation. Default: none */
         m_cameraToWorld = propList.getTransform("toWorld", Transform());
 
+        /* Optional further keyframes of a camera path */
+        m_keyframes.push_back(m_cameraToWorld);
+        for (int i = 1; propList.has(tfm::format("toWorld%i", i)); ++i)
+            m_keyframes.push_back(propList.getTransform(tfm::format("toWorld%i", i)));
+
+        /* Number of frames to be rendered along the path */
+        m_frameCount = propList.getInteger("frames", (int)m_keyframes.size());
+        if (m_frameCount < 1)
+            throw NoriException("PerspectiveCamera: the number of frames must be positive!");
+
         /* Horizontal field of view in degrees */
         m_fov = propList.getFloat("fov", 30.0f);
 
@@ -82,6 +97,11 @@ public:
                                Eigen::Translation<float, 3>(-1.0f, -1.0f / aspect, 0.0f) * perspective)
                                .inverse();
 
+        /* Area of the film when it is projected onto the plane at z=1 */
+        Point3f min = m_sampleToCamera * Point3f(0.0f, 0.0f, 0.0f),
+                max = m_sampleToCamera * Point3f(1.0f, 1.0f, 0.0f);
+        m_filmArea = std::abs((max.x() / max.z() - min.x() / min.z()) * (max.y() / max.z() - min.y() / min.z()));
+
         /* If no reconstruction filter was assigned, instantiate a Gaussian filter */
         if (!m_rfilter)
             m_rfilter = static_cast<ReconstructionFilter *>(
@@ -112,6 +132,68 @@ public:
         return Color3f(1.0f);
     }
 
+    float project(const Point3f &p, Point3f &position, Point2f &pixel) const
+    {
+        position = m_cameraToWorld * Point3f(0, 0, 0);
+
+        /* Respect the clipping planes, which sampleRay() applies along the z axis */
+        Point3f local = m_cameraToWorld.inverse() * p;
+        if (local.z() <= m_nearClip || local.z() >= m_farClip)
+            return 0.0f;
+
+        Point3f sample = m_sampleToCamera.inverse() * local;
+        pixel = Point2f(sample.x() * m_outputSize.x(), sample.y() * m_outputSize.y());
+        if (pixel.x() < 0 || pixel.y() < 0 || pixel.x() >= m_outputSize.x() || pixel.y() >= m_outputSize.y())
+            return 0.0f;
+
+        /* The film area that is seen per unit solid angle grows with 1 / cos^3(theta) */
+        float cosTheta = local.z() / local.norm();
+        return 1.0f / (m_filmArea * cosTheta * cosTheta * cosTheta);
+    }
+
+    int getFrameCount() const { return m_frameCount; }
+
+    Camera *createFrame(int frame) const
+    {
+        PerspectiveCamera *camera = new PerspectiveCamera(*this);
+        camera->m_cameraToWorld = interpolate(frame);
+        camera->m_keyframes.assign(1, camera->m_cameraToWorld);
+        camera->m_frameCount = 1;
+        return camera;
+    }
+
+    Camera *createTransformed(const Transform &trafo) const
+    {
+        PerspectiveCamera *camera = new PerspectiveCamera(*this);
+        camera->m_cameraToWorld = trafo * m_cameraToWorld;
+        camera->m_keyframes.assign(1, camera->m_cameraToWorld);
+        camera->m_frameCount = 1;
+        return camera;
+    }
+
+    /// Return the camera-to-world transformation at frame \c frame of the path
+    Transform interpolate(int frame) const
+    {
+        if (m_keyframes.size() == 1 || m_frameCount == 1)
+            return m_keyframes[0];
+
+        float t = frame * (m_keyframes.size() - 1) / (float)(m_frameCount - 1);
+        int i = std::min((int)t, (int)m_keyframes.size() - 2);
+        float alpha = t - i;
+
+        Eigen::Matrix3f rotationA, scaleA, rotationB, scaleB;
+        decompose(m_keyframes[i], rotationA, scaleA);
+        decompose(m_keyframes[i + 1], rotationB, scaleB);
+
+        Eigen::Quaternionf rotation = Eigen::Quaternionf(rotationA).slerp(alpha, Eigen::Quaternionf(rotationB));
+
+        Eigen::Matrix4f result = Eigen::Matrix4f::Identity();
+        result.topLeftCorner<3, 3>() = rotation.toRotationMatrix() * ((1 - alpha) * scaleA + alpha * scaleB);
+        result.topRightCorner<3, 1>() = (1 - alpha) * m_keyframes[i].getMatrix().topRightCorner<3, 1>() +
+                                        alpha * m_keyframes[i + 1].getMatrix().topRightCorner<3, 1>();
+        return Transform(result);
+    }
+
     void addChild(NoriObject *obj, const std::string &name = "none")
     {
         switch (obj->getClassType())
@@ -137,6 +219,8 @@ public:
             "  outputSize = %s,\n"
             "  fov = %f,\n"
             "  clip = [%f, %f],\n"
+            "  keyframes = %i,\n"
+            "  frames = %i,\n"
             "  rfilter = %s\n"
             "]",
             indent(m_cameraToWorld.toString(), 18),
@@ -144,13 +228,37 @@ public:
             m_fov,
             m_nearClip,
             m_farClip,
+            m_keyframes.size(),
+            m_frameCount,
             indent(m_rfilter->toString()));
     }
 
 private:
+    /**
+     * Split the linear part of a transformation into a rotation and a
+     * scale. A mirroring (e.g. the common <tt>scale -1,1,1</tt>) is
+     * assigned to the x axis: the polar decomposition alone would attribute
+     * it to an arbitrary axis, which breaks the interpolation.
+     */
+    static void decompose(const Transform &trafo, Eigen::Matrix3f &rotation, Eigen::Matrix3f &scale)
+    {
+        Eigen::Matrix3f linear = trafo.getMatrix().topLeftCorner<3, 3>();
+        bool mirror = linear.determinant() < 0;
+        if (mirror)
+            linear.col(0) *= -1;
+        Eigen::Affine3f affine = Eigen::Affine3f::Identity();
+        affine.linear() = linear;
+        affine.computeRotationScaling(&rotation, &scale);
+        if (mirror)
+            scale.col(0) *= -1;
+    }
+
     Vector2f m_invOutputSize;
+    float m_filmArea;
     Transform m_sampleToCamera;
     Transform m_cameraToWorld;
+    std::vector<Transform> m_keyframes;
+    int m_frameCount;
     float m_fov;
     float m_nearClip;
     float m_farClip;
@@ -0,0 +1,67 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/photonmap.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+
+NORI_NAMESPACE_BEGIN
+
+void PhotonGrid::build(std::vector<Photon> &&photons, float radius)
+{
+    /* Release the previous photons first to reduce the peak memory usage */
+    clear();
+
+    size_t photonCount = photons.size();
+    uint32_t bucketCount = 1;
+    while (bucketCount < photonCount)
+        bucketCount *= 2;
+
+    m_radius = radius;
+    m_invCellSize = 0.5f / radius;
+    m_bucketMask = bucketCount - 1;
+
+    /* Sort by bucket, and by the original index within a bucket */
+    std::vector<uint64_t> keys(photonCount);
+    tbb::parallel_for(size_t(0), photonCount, [&](size_t i)
+                      { keys[i] = ((uint64_t)hash(cell(photons[i].p)) << 32) | i; });
+    tbb::parallel_sort(keys.begin(), keys.end());
+
+    m_photons.resize(photonCount);
+    m_bucketStart.assign(bucketCount + 1, (uint32_t)photonCount);
+    tbb::parallel_for(size_t(0), photonCount, [&](size_t i)
+                      {
+        uint32_t bucket = (uint32_t)(keys[i] >> 32);
+        m_photons[i] = photons[(uint32_t)keys[i]];
+        if (i == 0 || (uint32_t)(keys[i - 1] >> 32) != bucket)
+            m_bucketStart[bucket] = (uint32_t)i; });
+
+    /* Empty buckets start (and end) where the next nonempty one starts */
+    for (uint32_t i = bucketCount; i-- > 0;)
+        m_bucketStart[i] = std::min(m_bucketStart[i], m_bucketStart[i + 1]);
+
+    std::vector<Photon>().swap(photons);
+}
+
+void PhotonGrid::clear()
+{
+    std::vector<Photon>().swap(m_photons);
+    std::vector<uint32_t>().swap(m_bucketStart);
+}
+
+NORI_NAMESPACE_END
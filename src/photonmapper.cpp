@@ -0,0 +1,293 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/emitter.h>
+#include <nori/mesh.h>
+#include <nori/warp.h>
+#include <nori/bsdf.h>
+#include <nori/sampler.h>
+#include <nori/photonmap.h>
+#include <nori/stats.h>
+#include <nori/timer.h>
+#include <tbb/parallel_for.h>
+#include <pcg32.h>
+
+/* Number of photons that are emitted by one task */
+#define NORI_PHOTON_CHUNK 4096
+
+NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+NORI_STAT_COUNTER(statsDensityEstimates, "Photon mapping", "Density estimates");
+NORI_STAT_COUNTER(statsPhotonsFound, "Photon mapping", "Photons found");
+
+/**
+ * \brief Progressive photon mapping
+ *
+ * Camera paths are traced through specular surfaces until they reach a
+ * diffuse one (see \ref BSDF::isDiffuse()). There, direct illumination is
+ * computed using next event estimation, and indirect illumination (which
+ * includes caustics) by a fixed-radius density estimate of the photons.
+ *
+ * Every pass of the render uses a new set of \c photon_count photons, and
+ * a radius that shrinks according to "Progressive Photon Mapping: A
+ * Probabilistic Approach" by Claude Knaus and Matthias Zwicker (2011). The
+ * average of the passes thus converges to the correct solution (e.g. with
+ * the time or noise budgets of the renderer), while the memory usage is
+ * bounded by the photons of a single pass.
+ */
+class PhotonMapper : public Integrator
+{
+public:
+    PhotonMapper(const PropertyList &props)
+    {
+        /* Number of photons emitted per pass */
+        m_photonCount = props.getInteger("photon_count", 1000000);
+
+        /* Lookup radius of the first pass (0: 1/200 of the scene diagonal) */
+        m_initialRadius = props.getFloat("photon_radius", 0.0f);
+
+        /* Controls how quickly the radius shrinks in subsequent passes (0 < alpha < 1) */
+        m_alpha = props.getFloat("alpha", 2.0f / 3.0f);
+
+        /* Maximum number of bounces of photons and camera paths */
+        m_maxDepth = props.getInteger("max_depth", 16);
+    }
+
+    void preprocess(const Scene *scene)
+    {
+        if (m_initialRadius <= 0)
+            m_initialRadius = scene->getBoundingBox().getExtents().norm() / 200.0f;
+
+        Timer timer;
+        preparePass(scene, 0);
+        cout << tfm::format("Photon mapping: stored %i photons (radius %g, took %s)",
+                            m_grid.size(), m_grid.getRadius(), timer.elapsedString())
+             << endl;
+    }
+
+    void preparePass(const Scene *scene, uint32_t pass)
+    {
+        m_pass = pass;
+        if (scene->getLights().empty())
+            return;
+
+        float radius2 = m_initialRadius * m_initialRadius;
+        for (uint32_t i = 1; i <= pass; ++i)
+            radius2 *= (i + m_alpha) / (i + 1);
+
+        /* Trace the photons in fixed chunks with their own random numbers,
+           so that the result does not depend on the scheduling */
+        size_t chunkCount = (m_photonCount + NORI_PHOTON_CHUNK - 1) / NORI_PHOTON_CHUNK;
+        std::vector<std::vector<Photon>> chunks(chunkCount);
+        tbb::parallel_for(size_t(0), chunkCount, [&](size_t chunk)
+                          {
+            pcg32 random;
+            random.seed(chunk, pass);
+            size_t end = std::min((chunk + 1) * NORI_PHOTON_CHUNK, (size_t)m_photonCount);
+            for (size_t i = chunk * NORI_PHOTON_CHUNK; i < end; ++i)
+                tracePhoton(scene, random, chunks[chunk]); });
+
+        size_t photonCount = 0;
+        for (const auto &chunk : chunks)
+            photonCount += chunk.size();
+        std::vector<Photon> photons;
+        photons.reserve(photonCount);
+        for (auto &chunk : chunks)
+        {
+            photons.insert(photons.end(), chunk.begin(), chunk.end());
+            std::vector<Photon>().swap(chunk);
+        }
+
+        m_grid.build(std::move(photons), std::sqrt(radius2));
+    }
+
+    void beginRender(const Scene *scene, const Camera *camera)
+    {
+        /* Every view (e.g. the frames of a camera path) starts over with
+           the photons and the radius of the first pass */
+        if (m_pass != 0)
+            preparePass(scene, 0);
+    }
+
+    Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+    {
+        return trace(scene, sampler, ray);
+    }
+
+    std::string toString() const
+    {
+        return tfm::format(
+            "PhotonMapper[\n"
+            "  photon_count = %i,\n"
+            "  photon_radius = %g,\n"
+            "  alpha = %g,\n"
+            "  max_depth = %i\n"
+            "]",
+            m_photonCount, m_initialRadius, m_alpha, m_maxDepth);
+    }
+
+private:
+    /// Emit a photon and store it at the diffuse surfaces it hits after the first bounce
+    void tracePhoton(const Scene *scene, pcg32 &random, std::vector<Photon> &photons) const
+    {
+        float pdfEmitter;
+        const Emitter *emitter = scene->sampleEmitter(random.nextFloat(), pdfEmitter);
+        const Mesh *mesh = emitter->getMesh();
+        Point2f positionSample(random.nextFloat(), random.nextFloat());
+        Point2f directionSample(random.nextFloat(), random.nextFloat());
+
+        Ray3f ray;
+        Color3f power;
+        if (mesh)
+        {
+            /* Area emitter: cosine-weighted directions cancel with the cosine of the emission */
+            Point3f p;
+            Normal3f n;
+            Point2f uv;
+            mesh->samplePosition(positionSample, p, n, uv);
+            Vector3f d = Frame(n).toWorld(Warp::squareToCosineHemisphere(directionSample));
+            EmitterQueryRecord lRec(emitter, p + d, p, n, uv);
+            power = emitter->eval(lRec) * M_PI / (mesh->pdf(p) * pdfEmitter);
+            ray = Ray3f(p, d);
+        }
+        else if (emitter->getEmitterType() == EmitterType::EMITTER_POINT)
+        {
+            EmitterQueryRecord lRec(Point3f(0.0f));
+            emitter->sample(lRec, positionSample, 0.0f);
+            power = emitter->radiance() * (4 * M_PI) / pdfEmitter;
+            ray = Ray3f(lRec.p, Warp::squareToUniformSphere(directionSample));
+        }
+        else
+        {
+            /* Environment maps don't emit photons */
+            return;
+        }
+
+        for (int depth = 0; depth < m_maxDepth && !power.isZero(); ++depth)
+        {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its) || its.mesh->isEmitter())
+                break;
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            if (!bsdf)
+                break;
+
+            /* Direct illumination is computed using next event estimation instead */
+            if (depth > 0 && bsdf->isDiffuse())
+                photons.push_back({its.p, -ray.d, power});
+
+            BSDFQueryRecord bRec(its.toLocal(-ray.d), its.uv);
+            bRec.measure = ESolidAngle;
+            Color3f weight = bsdf->sample(bRec, Point2f(random.nextFloat(), random.nextFloat()));
+
+            /* Russian roulette based on the change of the power */
+            Color3f scattered = power * weight;
+            float q = std::min(1.0f, scattered.maxCoeff() / power.maxCoeff());
+            if (random.nextFloat() >= q)
+                break;
+            power = scattered / q;
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+    }
+
+    Color3f trace(const Scene *scene, Sampler *sampler, Ray3f ray) const
+    {
+        Color3f throughput(1.0f);
+
+        for (int depth = 0; depth <= m_maxDepth; ++depth)
+        {
+            Intersection its;
+            if (!scene->rayIntersect(ray, its))
+                return throughput * scene->getBackground(ray);
+
+            if (its.mesh->isEmitter())
+            {
+                const Emitter *emitter = its.mesh->getEmitter();
+                EmitterQueryRecord lRec(emitter, ray.o, its.p, its.shFrame.n, its.uv);
+                return throughput * emitter->eval(lRec);
+            }
+
+            const BSDF *bsdf = its.mesh->getBSDF();
+            if (!bsdf)
+                break;
+
+            /* Look up the textures of the BSDF once for all queries below */
+            BSDFClosure closure;
+            bsdf->evalClosure(its.uv, closure);
+            Vector3f wi = its.toLocal(-ray.d);
+
+            if (bsdf->isDiffuse())
+                return throughput * (directLighting(scene, sampler, its, wi, bsdf, closure) +
+                                     indirectLighting(its, wi, bsdf, closure));
+
+            /* Follow specular reflection and refraction */
+            BSDFQueryRecord bRec(wi, its.uv, &closure);
+            bRec.measure = ESolidAngle;
+            Color3f weight = bsdf->sample(bRec, sampler->next2D());
+            if (weight.isZero())
+                break;
+            throughput *= weight;
+
+            NORI_STAT_INC(statsSecondaryRays);
+            ray = Ray3f(its.p, its.toWorld(bRec.wo));
+        }
+
+        return Color3f(0.0f);
+    }
+
+    Color3f directLighting(const Scene *scene, Sampler *sampler, const Intersection &its,
+                           const Vector3f &wi, const BSDF *bsdf, const BSDFClosure &closure) const
+    {
+        if (scene->getLights().empty())
+            return Color3f(0.0f);
+
+        float pdfEmitter;
+        const Emitter *emitter = scene->sampleEmitter(sampler->next1D(), pdfEmitter);
+        EmitterQueryRecord lRec(its.p);
+        Color3f Le = emitter->sample(lRec, sampler->next2D(), 0.0f);
+        float pdf = pdfEmitter * emitter->pdf(lRec);
+        if (Le.isZero() || !(pdf > 0))
+            return Color3f(0.0f);
+
+        float maxt = std::isfinite(lRec.dist) ? lRec.dist * (1.0f - Epsilon) : std::numeric_limits<float>::infinity();
+        NORI_STAT_INC(statsShadowRays);
+        if (scene->rayIntersect(Ray3f(its.p, lRec.wi, Epsilon, maxt)))
+            return Color3f(0.0f);
+
+        BSDFQueryRecord bRec(wi, its.toLocal(lRec.wi), its.uv, ESolidAngle, &closure);
+        return bsdf->eval(bRec) * std::abs(Frame::cosTheta(bRec.wo)) * Le / pdf;
+    }
+
+    Color3f indirectLighting(const Intersection &its, const Vector3f &wi,
+                             const BSDF *bsdf, const BSDFClosure &closure) const
+    {
+        NORI_STAT_INC(statsDensityEstimates);
+        Color3f result(0.0f);
+        float side = Frame::cosTheta(wi);
+
+        m_grid.query(its.p, [&](const Photon &photon)
+                     {
+            /* Skip photons on the other side of the surface */
+            Vector3f photonWi = its.toLocal(photon.wi);
+            if (Frame::cosTheta(photonWi) * side <= 0)
+                return;
+            NORI_STAT_INC(statsPhotonsFound);
+            BSDFQueryRecord bRec(wi, photonWi, its.uv, ESolidAngle, &closure);
+            result += bsdf->eval(bRec) * photon.power; });
+
+        float radius = m_grid.getRadius();
+        return result / (M_PI * radius * radius * m_photonCount);
+    }
+
+    int m_photonCount;
+    float m_initialRadius;
+    float m_alpha;
+    int m_maxDepth;
+    PhotonGrid m_grid;
+    uint32_t m_pass = 0;
+};
+
+NORI_REGISTER_CLASS(PhotonMapper, "photonmapper");
+NORI_NAMESPACE_END
@@ -0,0 +1,292 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/preview.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/bitmap.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/// Rotation (in radians) per pixel of mouse movement
+#define ORBIT_SPEED 0.005f
+
+PreviewRenderer::PreviewRenderer(const Scene *scene, const Camera *camera, int threadCount)
+    : m_scene(scene), m_baseCamera(camera), m_threadCount(threadCount),
+      m_size(camera->getOutputSize()), m_flyStep(0.02f * scene->getBoundingBox().getExtents().norm()),
+      m_accum(camera->getOutputSize(), camera->getReconstructionFilter()),
+      m_display(camera->getOutputSize(), nullptr), m_camera(camera->createTransformed(Transform())),
+      m_generation(1), m_shutdown(false)
+{
+    m_accum.clear();
+    m_display.clear();
+
+    /* Orbit around the surface at the center of the view, or the center of the scene */
+    View view = getView();
+    Intersection its;
+    if (m_scene->rayIntersect(Ray3f(view.origin, view.forward), its))
+        m_focusDistance = its.t;
+    else
+        m_focusDistance = (m_scene->getBoundingBox().getCenter() - view.origin).norm();
+
+    m_thread = std::thread([this]
+                           { run(); });
+}
+
+PreviewRenderer::~PreviewRenderer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_cond.notify_all();
+    m_thread.join();
+}
+
+PreviewRenderer::View PreviewRenderer::getView() const
+{
+    std::shared_ptr<const Camera> camera;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        camera = m_camera;
+    }
+
+    /* Rays through the center of the image, and one pixel to the right and below */
+    Point2f center = 0.5f * m_size.cast<float>();
+    Ray3f ray, rayX, rayY;
+    camera->sampleRay(ray, center, Point2f(0.5f));
+    camera->sampleRay(rayX, center + Vector2f(1.f, 0.f), Point2f(0.5f));
+    camera->sampleRay(rayY, center + Vector2f(0.f, 1.f), Point2f(0.5f));
+
+    View view;
+    view.origin = ray.o;
+    view.forward = ray.d.normalized();
+    view.right = rayX.d.normalized() - view.forward;
+    view.pixelAngle = view.right.norm();
+    view.right /= view.pixelAngle;
+    view.down = (rayY.d.normalized() - view.forward).normalized();
+    return view;
+}
+
+void PreviewRenderer::orbit(const Vector2f &delta)
+{
+    View view = getView();
+    Point3f target = view.origin + m_focusDistance * view.forward;
+    Vector3f offset = view.origin - target, up(0.f, 1.f, 0.f);
+
+    /* Move the camera opposite to the mouse, as if dragging the scene */
+    float yaw = -delta.x() * ORBIT_SPEED, pitch = -delta.y() * ORBIT_SPEED;
+    if (up.cross(offset).dot(view.right) < 0)
+        yaw = -yaw;
+    if (view.right.cross(offset).dot(view.down) < 0)
+        pitch = -pitch;
+
+    Eigen::Affine3f trafo = Eigen::Translation<float, 3>(target) *
+                            Eigen::AngleAxis<float>(yaw, up) *
+                            Eigen::AngleAxis<float>(pitch, view.right) *
+                            Eigen::Translation<float, 3>(-target);
+    move(Transform(trafo.matrix()));
+}
+
+void PreviewRenderer::pan(const Vector2f &delta)
+{
+    View view = getView();
+    float scale = m_focusDistance * view.pixelAngle;
+    Vector3f shift = -(delta.x() * view.right + delta.y() * view.down) * scale;
+    move(Transform(Eigen::Affine3f(Eigen::Translation<float, 3>(shift)).matrix()));
+}
+
+void PreviewRenderer::dolly(float amount)
+{
+    View view = getView();
+    float distance = m_focusDistance * (1.f - std::pow(0.9f, amount));
+    m_focusDistance -= distance;
+    move(Transform(Eigen::Affine3f(Eigen::Translation<float, 3>(distance * view.forward)).matrix()));
+}
+
+void PreviewRenderer::fly(const Vector3f &direction)
+{
+    View view = getView();
+    Vector3f shift = (direction.x() * view.right - direction.y() * view.down +
+                      direction.z() * view.forward) * m_flyStep;
+    move(Transform(Eigen::Affine3f(Eigen::Translation<float, 3>(shift)).matrix()));
+}
+
+void PreviewRenderer::move(const Transform &trafo)
+{
+    m_navigation = trafo * m_navigation;
+    std::shared_ptr<const Camera> camera(m_baseCamera->createTransformed(m_navigation));
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_camera = camera;
+        ++m_generation;
+    }
+    m_cond.notify_all();
+}
+
+void PreviewRenderer::run()
+{
+    tbb::task_arena arena(m_threadCount > 0 ? m_threadCount : (int)tbb::task_arena::automatic);
+    uint32_t generation = 0;
+
+    while (true)
+    {
+        std::shared_ptr<const Camera> camera;
+        {
+            /* Wait until the camera was moved */
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [&]
+                        { return m_shutdown || m_generation != generation; });
+            if (m_shutdown)
+                return;
+            generation = m_generation;
+            camera = m_camera;
+        }
+
+        arena.execute([&]
+                      { render(camera.get(), generation); });
+    }
+}
+
+void PreviewRenderer::render(const Camera *camera, uint32_t generation)
+{
+    for (int factor = NORI_PREVIEW_COARSE; factor > 1; factor /= 2)
+        if (!renderCoarse(camera, factor, generation))
+            return;
+
+    m_accum.lock();
+    m_accum.clear();
+    m_accum.unlock();
+
+    uint32_t passCount = (uint32_t)m_scene->getSampler()->getSampleCount();
+    for (uint32_t pass = 0; pass < passCount; ++pass)
+        if (!renderPass(camera, pass, generation))
+            return;
+}
+
+Color3f PreviewRenderer::sample(const Camera *camera, Sampler *sampler, const Point2i &pixel,
+                                uint32_t pass, Point2f &position) const
+{
+    sampler->prepare(pixel, pass);
+    position = pixel.cast<float>() + sampler->next2D();
+    Point2f apertureSample = sampler->next2D();
+
+    Ray3f ray;
+    Color3f value = camera->sampleRay(ray, position, apertureSample);
+    return value * m_scene->getIntegrator()->Li(m_scene, sampler, ray);
+}
+
+bool PreviewRenderer::renderCoarse(const Camera *camera, int factor, uint32_t generation)
+{
+    Bitmap image(m_size);
+    Vector2i cells((m_size.x() + factor - 1) / factor, (m_size.y() + factor - 1) / factor);
+    tbb::task_group_context context;
+
+    tbb::parallel_for(tbb::blocked_range<int>(0, cells.y()), [&](const tbb::blocked_range<int> &range)
+                      {
+        std::unique_ptr<Sampler> sampler(m_scene->getSampler()->clone());
+
+        for (int cy = range.begin(); cy < range.end(); ++cy) {
+            if (cancelled(generation)) {
+                context.cancel_group_execution();
+                return;
+            }
+            for (int cx = 0; cx < cells.x(); ++cx) {
+                /* Sample the center pixel, and replicate the result over the cell */
+                Point2i pixel(std::min(cx * factor + factor / 2, m_size.x() - 1),
+                              std::min(cy * factor + factor / 2, m_size.y() - 1));
+                Point2f position;
+                Color3f value = sample(camera, sampler.get(), pixel, 0, position);
+                if (!value.isValid())
+                    value = Color3f(0.f);
+
+                for (int y = cy * factor; y < std::min((cy + 1) * factor, m_size.y()); ++y)
+                    for (int x = cx * factor; x < std::min((cx + 1) * factor, m_size.x()); ++x)
+                        image(y, x) = value;
+            }
+        } }, context);
+
+    if (cancelled(generation))
+        return false;
+
+    m_display.lock();
+    m_display.fromBitmap(image);
+    m_display.unlock();
+    return true;
+}
+
+bool PreviewRenderer::renderPass(const Camera *camera, uint32_t pass, uint32_t generation)
+{
+    BlockGenerator blockGenerator(m_size, NORI_PREVIEW_BLOCK_SIZE);
+    tbb::task_group_context context;
+
+    tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount()), [&](const tbb::blocked_range<int> &range)
+                      {
+        ImageBlock block(Vector2i(NORI_PREVIEW_BLOCK_SIZE), camera->getReconstructionFilter());
+        std::unique_ptr<Sampler> sampler(m_scene->getSampler()->clone());
+
+        for (int i = range.begin(); i < range.end(); ++i) {
+            if (cancelled(generation)) {
+                context.cancel_group_execution();
+                return;
+            }
+
+            blockGenerator.next(block);
+            block.clear();
+            Point2i offset = block.getOffset();
+            Vector2i size = block.getSize();
+
+            for (int y = 0; y < size.y(); ++y) {
+                for (int x = 0; x < size.x(); ++x) {
+                    Point2f position;
+                    Color3f value = sample(camera, sampler.get(), Point2i(x + offset.x(), y + offset.y()),
+                                           pass, position);
+                    block.put(position, value);
+                }
+            }
+
+            /* Discard the block if the camera was moved in the meantime */
+            if (cancelled(generation))
+                continue;
+            m_accum.put(block);
+            updateDisplay(offset, size);
+        } }, context);
+
+    return !cancelled(generation);
+}
+
+void PreviewRenderer::updateDisplay(const Point2i &offset, const Vector2i &size)
+{
+    int border = m_accum.getBorderSize();
+
+    m_accum.lock();
+    m_display.lock();
+    for (int y = offset.y(); y < offset.y() + size.y(); ++y)
+        for (int x = offset.x(); x < offset.x() + size.x(); ++x)
+            m_display.coeffRef(y, x) << m_accum.coeff(y + border, x + border).divideByFilterWeight(), 1;
+    m_display.unlock();
+    m_accum.unlock();
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,182 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/render.h>
+#include <nori/accel.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/bitmap.h>
+#include <nori/sampler.h>
+#include <nori/integrator.h>
+#include <nori/bsdf.h>
+#include <nori/denoiser.h>
+#include <nori/stats.h>
+#include <nori/trace.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#include <tbb/task_arena.h>
+
+NORI_NAMESPACE_BEGIN
+
+NORI_STAT_COUNTER(statsCameraRays, "Rays", "Camera rays");
+
+std::vector<ImageChannel> aovChannels()
+{
+    return {
+        ImageChannel("albedo.R"), ImageChannel("albedo.G"), ImageChannel("albedo.B"),
+        ImageChannel("normal.X"), ImageChannel("normal.Y"), ImageChannel("normal.Z"),
+        ImageChannel("Z"), ImageChannel("meshID", true)};
+}
+
+void renderBlock(const Scene *scene, const Camera *camera, Sampler *sampler, ImageBlock &block,
+                 const RenderOutputs &outputs, uint32_t pass)
+{
+    Bitmap *heatmap = outputs.heatmap;
+    FeatureBuffer *features = outputs.features;
+    bool captureHit = outputs.needsPrimaryHit();
+    const Integrator *integrator = scene->getIntegrator();
+
+    Point2i offset = block.getOffset();
+    Vector2i size = block.getSize();
+
+    /* Clear the block contents */
+    block.clear();
+
+    TraversalStatistics pixelStats;
+    if (heatmap)
+        Accel::setThreadStatistics(&pixelStats);
+
+    /* For each pixel and pixel sample sample */
+    for (int y = 0; y < size.y(); ++y)
+    {
+        for (int x = 0; x < size.x(); ++x)
+        {
+            double pixelStart = heatmap ? Trace::now() : 0;
+            pixelStats = TraversalStatistics();
+
+            /* Seed the sampler based on the pixel position, so that
+               the result does not depend on the block layout */
+            sampler->prepare(Point2i(x + offset.x(), y + offset.y()), pass);
+
+            for (uint32_t i = 0; i < sampler->getSampleCount(); ++i)
+            {
+                Point2f pixelSample = Point2f((float)(x + offset.x()), (float)(y + offset.y())) + sampler->next2D();
+                Point2f apertureSample = sampler->next2D();
+
+                /* Sample a ray from the camera */
+                Ray3f ray;
+                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+                NORI_STAT_INC(statsCameraRays);
+
+                /* Compute the incident radiance */
+                Intersection its;
+                if (captureHit)
+                    Accel::captureNextHit(&its);
+                value *= integrator->Li(scene, sampler, ray);
+                if (captureHit)
+                    Accel::captureNextHit(nullptr);
+
+                /* Store in the image block */
+                block.put(pixelSample, value);
+
+                /* mesh == nullptr: the ray escaped, or the integrator
+                   never traced it (e.g. a zero-valued camera sample) */
+                const Intersection *primary = its.mesh ? &its : nullptr;
+
+                if (features)
+                    features->put(Point2i(x + offset.x(), y + offset.y()), value, primary);
+
+                if (outputs.aovs)
+                {
+                    float aov[8] = {0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, -1.f};
+                    if (primary)
+                    {
+                        const BSDF *bsdf = primary->mesh->getBSDF();
+                        Color3f albedo = (primary->mesh->isEmitter() || !bsdf)
+                                             ? Color3f(1.0f) : bsdf->getAlbedo(primary->uv);
+                        const Normal3f &n = primary->shFrame.n;
+                        auto it = outputs.meshIDs.find(primary->mesh);
+                        float values[8] = {albedo.r(), albedo.g(), albedo.b(),
+                                           n.x(), n.y(), n.z(), primary->t,
+                                           it != outputs.meshIDs.end() ? (float)it->second : -1.f};
+                        std::copy(values, values + 8, aov);
+                    }
+                    block.putChannels(pixelSample, aov);
+                }
+            }
+
+            if (heatmap)
+                heatmap->coeffRef(y + offset.y(), x + offset.x()) =
+                    Color3f((float)(Trace::now() - pixelStart),
+                            (float)pixelStats.nodesVisited,
+                            (float)pixelStats.trianglesTested);
+        }
+    }
+
+    if (heatmap)
+        Accel::setThreadStatistics(nullptr);
+}
+
+void renderImage(Scene *scene, float *rgb, int threadCount, size_t view)
+{
+    const Camera *camera = scene->getCamera(view);
+    Vector2i outputSize = camera->getOutputSize();
+
+    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+    ImageBlock result(outputSize, camera->getReconstructionFilter());
+    result.clear();
+
+    auto map = [&](const tbb::blocked_range<int> &range)
+    {
+        ImageBlock block(Vector2i(NORI_BLOCK_SIZE), camera->getReconstructionFilter());
+        std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+
+        for (int i = range.begin(); i < range.end(); ++i)
+        {
+            blockGenerator.next(block);
+            sampler->prepare(block);
+            renderBlock(scene, camera, sampler.get(), block);
+            result.put(block);
+        }
+    };
+
+    /* Use a separate arena, so that the thread limit only applies to this call.
+       It also covers the preprocessing, which is parallel for some integrators */
+    tbb::task_arena arena(threadCount > 0 ? threadCount : (int)tbb::task_arena::automatic);
+    arena.execute([&]
+                  {
+        scene->getIntegrator()->preprocess(scene);
+        scene->getIntegrator()->beginRender(scene, camera);
+        tbb::parallel_for(tbb::blocked_range<int>(0, blockGenerator.getBlockCount()), map);
+        scene->getIntegrator()->endRender(result); });
+
+    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
+    for (int y = 0; y < outputSize.y(); ++y)
+    {
+        for (int x = 0; x < outputSize.x(); ++x)
+        {
+            const Color3f &value = bitmap->coeff(y, x);
+            float *dst = rgb + 3 * ((size_t)y * outputSize.x() + x);
+            dst[0] = value.r();
+            dst[1] = value.g();
+            dst[2] = value.b();
+        }
+    }
+}
+
+NORI_NAMESPACE_END
@@ -28,9 +28,15 @@
 
 NORI_NAMESPACE_BEGIN
 
-Scene::Scene(const PropertyList &)
+Scene::Scene(const PropertyList &props)
 {
     m_accel = new Accel();
+
+    /* BVH construction algorithm ("sah", "lbvh" or "hlbvh") */
+    m_accel->setBuilder(Accel::parseBuilder(props.getString("bvh", "sah")));
+
+    /* Report the traversal performance of the compressed BVH after building it */
+    m_accel->setCompareFormats(props.getBoolean("bvh_compare", false));
     m_enviromentalEmitter = 0;
 }
 
@@ -38,7 +44,8 @@ Scene::~Scene()
 {
     delete m_accel;
     delete m_sampler;
-    delete m_camera;
+    for (Camera *camera : m_cameras)
+        delete camera;
     delete m_integrator;
 }
 
@@ -55,9 +62,24 @@ void Scene::activate()
 
     if (!m_integrator)
         throw NoriException("No integrator was specified!");
-    if (!m_camera)
+    if (m_cameras.empty())
         throw NoriException("No camera was specified!");
 
+    /* Replace animated cameras by one static camera per frame */
+    std::vector<Camera *> cameras;
+    for (Camera *camera : m_cameras)
+    {
+        if (camera->getFrameCount() == 1)
+        {
+            cameras.push_back(camera);
+            continue;
+        }
+        for (int frame = 0; frame < camera->getFrameCount(); ++frame)
+            cameras.push_back(camera->createFrame(frame));
+        delete camera;
+    }
+    m_cameras = cameras;
+
     if (!m_sampler)
     {
         /* Create a default (independent) sampler */
@@ -94,7 +116,8 @@ float Scene::pdfEmitter(const Emitter *em) const
     // return 1. / float(m_emitters.size());
 
     // IMPORTANCE SAMPLING
-    return 1. / em->radiance().getLuminance();
+    auto it = std::find(m_emitters.begin(), m_emitters.end(), em);
+    return it != m_emitters.end() ? m_emitter_pdf[it - m_emitters.begin()] : 0.0f;
 }
 
 void Scene::addChild(NoriObject *obj, const std::string &name)
@@ -130,9 +153,7 @@ void Scene::addChild(NoriObject *obj, const std::string &name)
         break;
 
     case ECamera:
-        if (m_camera)
-            throw NoriException("There can only be one camera per scene!");
-        m_camera = static_cast<Camera *>(obj);
+        m_cameras.push_back(static_cast<Camera *>(obj));
         break;
 
     case EIntegrator:
@@ -181,6 +202,7 @@ std::string Scene::toString() const
         "  integrator = %s,\n"
         "  sampler = %s\n"
         "  camera = %s,\n"
+        "  views = %i,\n"
         "  meshes = {\n"
         "  %s  }\n"
         "  emitters = {\n"
@@ -188,7 +210,8 @@ std::string Scene::toString() const
         "]",
         indent(m_integrator->toString()),
         indent(m_sampler->toString()),
-        indent(m_camera->toString()),
+        indent(m_cameras[0]->toString()),
+        m_cameras.size(),
         indent(meshes, 2),
         indent(lights, 2));
 }
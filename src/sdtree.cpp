@@ -0,0 +1,319 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/sdtree.h>
+#include <tbb/parallel_for.h>
+
+NORI_NAMESPACE_BEGIN
+
+/// Map a direction to the unit square (equal-area cylindrical mapping)
+static Point2f dirToCanonical(const Vector3f &d)
+{
+    float cosTheta = clamp(d.z(), -1.0f, 1.0f);
+    float phi = std::atan2(d.y(), d.x());
+    if (phi < 0)
+        phi += 2 * M_PI;
+    return Point2f(clamp((cosTheta + 1) * 0.5f, 0.0f, 1.0f), clamp(phi * INV_TWOPI, 0.0f, 1.0f));
+}
+
+/// Inverse of \ref dirToCanonical()
+static Vector3f canonicalToDir(const Point2f &p)
+{
+    float cosTheta = 2 * p.x() - 1;
+    float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta * cosTheta));
+    float phi = 2 * M_PI * p.y();
+    return Vector3f(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+}
+
+DTree::Node::Node()
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        sum[i].store(0.0f, std::memory_order_relaxed);
+        child[i] = 0;
+    }
+}
+
+DTree::Node &DTree::Node::operator=(const Node &other)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        sum[i].store(other.sum[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        child[i] = other.child[i];
+    }
+    return *this;
+}
+
+int DTree::Node::quadrant(Point2f &p)
+{
+    int index = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        if (p[i] < 0.5f)
+        {
+            p[i] *= 2;
+        }
+        else
+        {
+            p[i] = p[i] * 2 - 1;
+            index |= 1 << i;
+        }
+    }
+    return index;
+}
+
+float DTree::Node::getSum() const
+{
+    float result = 0.0f;
+    for (int i = 0; i < 4; ++i)
+        result += sum[i].load(std::memory_order_relaxed);
+    return result;
+}
+
+DTree::DTree() : m_nodes(1) {}
+
+DTree &DTree::operator=(const DTree &other)
+{
+    m_nodes = other.m_nodes;
+    return *this;
+}
+
+void DTree::record(const Vector3f &d, float value)
+{
+    if (!(value > 0) || !std::isfinite(value))
+        return;
+
+    Point2f p = dirToCanonical(d);
+    uint32_t index = 0;
+    while (true)
+    {
+        Node &node = m_nodes[index];
+        int q = Node::quadrant(p);
+        atomicAdd(node.sum[q], value);
+        if (!node.child[q])
+            break;
+        index = node.child[q];
+    }
+}
+
+float DTree::getSum() const
+{
+    return m_nodes[0].getSum();
+}
+
+Vector3f DTree::sample(Point2f sample, float &pdf) const
+{
+    Point2f origin(0.0f, 0.0f);
+    float size = 1.0f;
+    pdf = INV_FOURPI;
+    uint32_t index = 0;
+
+    while (true)
+    {
+        const Node &node = m_nodes[index];
+        float sums[4];
+        for (int i = 0; i < 4; ++i)
+            sums[i] = node.sum[i].load(std::memory_order_relaxed);
+        float total = sums[0] + sums[1] + sums[2] + sums[3];
+        if (!(total > 0))
+            break;
+
+        /* Choose the column (x) and then the row (y) of the quadrant, and reuse the sample */
+        int q = 0;
+        float pLeft = (sums[0] + sums[2]) / total;
+        if (sample.x() < pLeft)
+        {
+            sample.x() /= pLeft;
+        }
+        else
+        {
+            sample.x() = (sample.x() - pLeft) / (1 - pLeft);
+            q |= 1;
+        }
+
+        float pBottom = sums[q] / (sums[q] + sums[q | 2]);
+        if (sample.y() < pBottom)
+        {
+            sample.y() /= pBottom;
+        }
+        else
+        {
+            sample.y() = (sample.y() - pBottom) / (1 - pBottom);
+            q |= 2;
+        }
+        sample = sample.cwiseMin(1 - Epsilon);
+        pdf *= 4 * sums[q] / total;
+
+        size *= 0.5f;
+        origin += Vector2f((q & 1) ? size : 0.0f, (q & 2) ? size : 0.0f);
+        if (!node.child[q])
+            break;
+        index = node.child[q];
+    }
+
+    return canonicalToDir(origin + size * sample);
+}
+
+float DTree::pdf(const Vector3f &d) const
+{
+    Point2f p = dirToCanonical(d);
+    float density = INV_FOURPI;
+    uint32_t index = 0;
+
+    while (true)
+    {
+        const Node &node = m_nodes[index];
+        float total = node.getSum();
+        if (!(total > 0))
+            return 0.0f;
+        int q = Node::quadrant(p);
+        density *= 4 * node.sum[q].load(std::memory_order_relaxed) / total;
+        if (!node.child[q])
+            return density;
+        index = node.child[q];
+    }
+}
+
+void DTree::refine(float threshold, int maxDepth)
+{
+    struct Entry
+    {
+        uint32_t index, oldIndex;
+        int depth;
+    };
+
+    std::vector<Node> nodes(1);
+    float total = getSum();
+
+    if (total > 0)
+    {
+        std::vector<Entry> stack = {{0, 0, 1}};
+        while (!stack.empty())
+        {
+            Entry entry = stack.back();
+            stack.pop_back();
+            const Node &old = m_nodes[entry.oldIndex];
+
+            for (int q = 0; q < 4; ++q)
+            {
+                if (entry.depth >= maxDepth ||
+                    old.sum[q].load(std::memory_order_relaxed) <= threshold * total)
+                    continue;
+
+                /* Keep (or create) the node of this quadrant. New nodes are only
+                   refined further in the next iteration, once they have data */
+                uint32_t index = (uint32_t)nodes.size();
+                nodes.emplace_back();
+                nodes[entry.index].child[q] = index;
+                if (old.child[q])
+                    stack.push_back({index, old.child[q], entry.depth + 1});
+            }
+        }
+    }
+
+    m_nodes = std::move(nodes);
+}
+
+SDTree::SDTree(const BoundingBox3f &bbox)
+{
+    /* Use a cube, so that the regions have similar extents along all axes */
+    m_extent = std::max(bbox.getExtents().maxCoeff(), Epsilon) * (1 + Epsilon);
+    m_min = bbox.getCenter() - Vector3f(0.5f * m_extent);
+    m_nodes.push_back({0, {0, 0}, 0});
+    m_leaves.emplace_back(new DTreeWrapper());
+}
+
+DTreeWrapper *SDTree::lookup(const Point3f &p) const
+{
+    Vector3f x = ((p - m_min) / m_extent).cwiseMax(0.0f).cwiseMin(1.0f);
+    uint32_t index = 0;
+
+    while (m_nodes[index].leaf < 0)
+    {
+        const Node &node = m_nodes[index];
+        float &value = x[node.axis];
+        if (value < 0.5f)
+        {
+            value *= 2;
+            index = node.child[0];
+        }
+        else
+        {
+            value = value * 2 - 1;
+            index = node.child[1];
+        }
+    }
+
+    return m_leaves[m_nodes[index].leaf].get();
+}
+
+void SDTree::build()
+{
+    tbb::parallel_for(size_t(0), m_leaves.size(), [&](size_t i)
+                      { m_leaves[i]->sampling = m_leaves[i]->building; });
+}
+
+void SDTree::refine(uint32_t spatialThreshold, float directionalThreshold, int maxDepth)
+{
+    uint32_t nodeCount = (uint32_t)m_nodes.size();
+    for (uint32_t i = 0; i < nodeCount; ++i)
+    {
+        if (m_nodes[i].leaf >= 0)
+            split(i, spatialThreshold);
+    }
+
+    tbb::parallel_for(size_t(0), m_leaves.size(), [&](size_t i)
+                      {
+        DTreeWrapper &leaf = *m_leaves[i];
+        leaf.building.refine(directionalThreshold, maxDepth);
+        leaf.sampleCount.store(0); });
+}
+
+void SDTree::split(uint32_t index, uint32_t threshold)
+{
+    DTreeWrapper *leaf = m_leaves[m_nodes[index].leaf].get();
+    uint32_t sampleCount = leaf->sampleCount.load();
+    if (sampleCount <= threshold)
+        return;
+
+    /* Both halves start out with the distributions of the parent,
+       and are assumed to have received half of its samples */
+    leaf->sampleCount.store(sampleCount / 2);
+    m_leaves.emplace_back(new DTreeWrapper(*leaf));
+
+    int axis = (m_nodes[index].axis + 1) % 3;
+    uint32_t child = (uint32_t)m_nodes.size();
+    m_nodes.push_back({axis, {0, 0}, m_nodes[index].leaf});
+    m_nodes.push_back({axis, {0, 0}, (int)m_leaves.size() - 1});
+    m_nodes[index].child[0] = child;
+    m_nodes[index].child[1] = child + 1;
+    m_nodes[index].leaf = -1;
+
+    split(child, threshold);
+    split(child + 1, threshold);
+}
+
+size_t SDTree::getDirectionalNodeCount() const
+{
+    size_t result = 0;
+    for (const auto &leaf : m_leaves)
+        result += leaf->building.getNodeCount();
+    return result;
+}
+
+NORI_NAMESPACE_END
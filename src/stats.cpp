@@ -0,0 +1,113 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/stats.h>
+
+#if defined(NORI_ENABLE_STATS)
+
+#include <tbb/mutex.h>
+#include <memory>
+#include <map>
+
+NORI_NAMESPACE_BEGIN
+
+namespace
+{
+    struct CounterInfo
+    {
+        std::string category;
+        std::string name;
+    };
+
+    struct Registry
+    {
+        tbb::mutex mutex;
+        std::vector<CounterInfo> counters;
+        std::vector<std::unique_ptr<uint64_t[]>> threads;
+    };
+
+    /* Counters register themselves during static initialization, hence
+       the registry must be constructed on first use */
+    Registry &registry()
+    {
+        static Registry registry;
+        return registry;
+    }
+}
+
+int Statistics::registerCounter(const std::string &category, const std::string &name)
+{
+    Registry &r = registry();
+    tbb::mutex::scoped_lock lock(r.mutex);
+    if (r.counters.size() >= NORI_STATS_MAX_COUNTERS)
+        throw NoriException("Statistics::registerCounter(): too many counters, increase NORI_STATS_MAX_COUNTERS!");
+    r.counters.push_back(CounterInfo{category, name});
+    return (int)r.counters.size() - 1;
+}
+
+uint64_t *Statistics::registerThread()
+{
+    Registry &r = registry();
+    tbb::mutex::scoped_lock lock(r.mutex);
+
+    /* The values outlive the thread so that they are still
+       included in the summary after it has exited */
+    r.threads.emplace_back(new uint64_t[NORI_STATS_MAX_COUNTERS]());
+    return r.threads.back().get();
+}
+
+void Statistics::reset()
+{
+    Registry &r = registry();
+    tbb::mutex::scoped_lock lock(r.mutex);
+    for (auto &values : r.threads)
+        std::fill(values.get(), values.get() + NORI_STATS_MAX_COUNTERS, 0);
+}
+
+std::string Statistics::toString()
+{
+    Registry &r = registry();
+    tbb::mutex::scoped_lock lock(r.mutex);
+
+    /* Merge the values of all threads, sorted by category and name */
+    std::map<std::string, std::map<std::string, uint64_t>> merged;
+    for (size_t i = 0; i < r.counters.size(); ++i)
+    {
+        uint64_t sum = 0;
+        for (auto &values : r.threads)
+            sum += values[i];
+        if (sum > 0)
+            merged[r.counters[i].category][r.counters[i].name] += sum;
+    }
+
+    if (merged.empty())
+        return "";
+
+    std::string result = "Render statistics:\n";
+    for (auto const &category : merged)
+    {
+        result += "  " + category.first + "\n";
+        for (auto const &counter : category.second)
+            result += tfm::format("    %-32s %15llu\n", counter.first, (unsigned long long)counter.second);
+    }
+    return result;
+}
+
+NORI_NAMESPACE_END
+
+#endif
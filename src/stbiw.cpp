@@ -0,0 +1,23 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Implementation of the PNG writer used by Bitmap::savePNG(). It needs
+   a separate translation unit, since it cannot be combined with the
+   implementation of the image loader in bitmap.cpp */
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include <stb_image_write.h>
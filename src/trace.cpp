@@ -0,0 +1,107 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/trace.h>
+#include <tbb/mutex.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+
+NORI_NAMESPACE_BEGIN
+
+bool Trace::s_enabled = false;
+
+namespace
+{
+    struct Event
+    {
+        std::string name, category, args;
+        double start, end;
+        int thread;
+    };
+
+    tbb::mutex eventMutex;
+    std::vector<Event> events;
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    /// Small integer that identifies the calling thread in the trace
+    int threadIndex()
+    {
+        static std::atomic<int> threadCount(0);
+        static thread_local int index = threadCount++;
+        return index;
+    }
+}
+
+double Trace::now()
+{
+    std::chrono::duration<double, std::micro> duration =
+        std::chrono::steady_clock::now() - startTime;
+    return duration.count();
+}
+
+void Trace::addEvent(const std::string &name, const std::string &category,
+                     double start, double end, const std::string &args)
+{
+    if (!s_enabled)
+        return;
+    int thread = threadIndex();
+    tbb::mutex::scoped_lock lock(eventMutex);
+    events.push_back(Event{name, category, args, start, end, thread});
+}
+
+void Trace::write(const std::string &filename)
+{
+    if (!s_enabled)
+        return;
+
+    std::ofstream os(filename);
+    if (!os)
+        throw NoriException("Unable to open trace file \"%s\" for writing!", filename);
+
+    tbb::mutex::scoped_lock lock(eventMutex);
+    int threadCount = 0;
+    for (const Event &event : events)
+        threadCount = std::max(threadCount, event.thread + 1);
+
+    os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+    os << "  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"nori\"}}";
+    for (int i = 0; i < threadCount; ++i)
+        os << "," << endl
+           << tfm::format("  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %i, "
+                          "\"args\": {\"name\": \"Thread %i\"}}",
+                          i, i);
+
+    for (const Event &event : events)
+    {
+        os << "," << endl
+           << tfm::format("  {\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %i, "
+                          "\"ts\": %.3f, \"dur\": %.3f",
+                          event.name, event.category, event.thread, event.start, event.end - event.start);
+        if (!event.args.empty())
+            os << ", \"args\": " << event.args;
+        os << "}";
+    }
+    os << endl
+       << "]}" << endl;
+
+    cout << "Wrote " << events.size() << " trace events to \"" << filename << "\"" << endl;
+}
+
+NORI_NAMESPACE_END
@@ -21,8 +21,12 @@
 #include <nori/camera.h>
 #include <nori/integrator.h>
 #include <nori/sampler.h>
+#include <nori/block.h>
 #include <hypothesis.h>
 #include <pcg32.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_reduce.h>
+#include <tbb/blocked_range.h>
 
 /*
  * =======================================================================
@@ -108,7 +112,7 @@ public:
     void activate()
     {
         int total = 0, passed = 0;
-        pcg32 random;
+        std::vector<TestCase> tests;
 
         if (!m_bsdfs.empty())
         {
@@ -123,35 +127,11 @@ public:
             {
                 for (size_t i = 0; i < m_references.size(); ++i)
                 {
-                    float angle = m_angles[i], reference = m_references[ctr++];
-
-                    cout << "------------------------------------------------------" << endl;
-                    cout << "Testing (angle=" << angle << "): " << bsdf->toString() << endl;
-                    ++total;
-
-                    BSDFQueryRecord bRec(sphericalDirection(degToRad(angle), 0));
-
-                    cout << "Drawing " << m_sampleCount << " samples .. " << endl;
-                    double mean = 0, variance = 0;
-                    for (int k = 0; k < m_sampleCount; ++k)
-                    {
-                        Point2f sample(random.nextFloat(), random.nextFloat());
-                        double result = (double)bsdf->sample(bRec, sample).getLuminance();
-
-                        /* Numerically robust online variance estimation using an
-                           algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
-                        double delta = result - mean;
-                        mean += delta / (double)(k + 1);
-                        variance += delta * (result - mean);
-                    }
-                    variance /= m_sampleCount - 1;
-                    std::pair<bool, std::string>
-                        result = hypothesis::students_t_test(mean, variance, reference,
-                                                             m_sampleCount, m_significanceLevel, (int)m_references.size());
-
-                    if (result.first)
-                        ++passed;
-                    cout << result.second << endl;
+                    TestCase test;
+                    test.bsdf = bsdf;
+                    test.angle = m_angles[i];
+                    test.reference = m_references[ctr++];
+                    tests.push_back(test);
                 }
             }
         }
@@ -160,50 +140,44 @@ public:
             if (m_references.size() != m_scenes.size())
                 throw NoriException("Specified a different number of scenes and reference values!");
 
-            Sampler *sampler = static_cast<Sampler *>(
-                NoriObjectFactory::createInstance("independent", PropertyList()));
-
             int ctr = 0;
             for (auto scene : m_scenes)
             {
-                const Integrator *integrator = scene->getIntegrator();
-                const Camera *camera = scene->getCamera();
-                float reference = m_references[ctr++];
-
-                cout << "------------------------------------------------------" << endl;
-                cout << "Testing scene: " << scene->toString() << endl;
-                ++total;
-
-                cout << "Generating " << m_sampleCount << " paths.. " << endl;
+                TestCase test;
+                test.scene = scene;
+                test.reference = m_references[ctr++];
+                tests.push_back(test);
+            }
+        }
 
-                double mean = 0, variance = 0;
-                for (int k = 0; k < m_sampleCount; ++k)
-                {
-                    /* Sample a ray from the camera */
-                    Ray3f ray;
-                    Point2f pixelSample = (sampler->next2D().array() * camera->getOutputSize().cast<float>().array()).matrix();
-                    Color3f value = camera->sampleRay(ray, pixelSample, sampler->next2D());
-
-                    /* Compute the incident radiance */
-                    value *= integrator->Li(scene, sampler, ray);
-
-                    /* Numerically robust online variance estimation using an
-                       algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
-                    double result = (double)value.getLuminance();
-                    double delta = result - mean;
-                    mean += delta / (double)(k + 1);
-                    variance += delta * (result - mean);
-                }
-                variance /= m_sampleCount - 1;
+        cout << "Running " << tests.size() << " tests with " << m_sampleCount
+             << (m_bsdfs.empty() ? " paths" : " samples") << " each .. " << endl;
 
-                std::pair<bool, std::string>
-                    result = hypothesis::students_t_test(mean, variance, reference,
-                                                         m_sampleCount, m_significanceLevel, (int)m_references.size());
+        /* All tests are independent and run concurrently */
+        tbb::parallel_for(tbb::blocked_range<size_t>(0, tests.size(), 1),
+                          [&](const tbb::blocked_range<size_t> &range)
+                          {
+                              for (size_t t = range.begin(); t != range.end(); ++t)
+                                  runTest(tests[t], (uint64_t)t);
+                          });
 
-                if (result.first)
-                    ++passed;
-                cout << result.second << endl;
-            }
+        /* Report the results in the order in which the tests were declared */
+        for (const TestCase &test : tests)
+        {
+            cout << "------------------------------------------------------" << endl;
+            if (test.bsdf)
+                cout << "Testing (angle=" << test.angle << "): " << test.bsdf->toString() << endl;
+            else
+                cout << "Testing scene: " << test.scene->toString() << endl;
+            ++total;
+
+            std::pair<bool, std::string>
+                result = hypothesis::students_t_test(test.stats.mean, test.stats.variance(), test.reference,
+                                                     m_sampleCount, m_significanceLevel, (int)m_references.size());
+
+            if (result.first)
+                ++passed;
+            cout << result.second << endl;
         }
         cout << "Passed " << passed << "/" << total << " tests." << endl;
         if (passed < total)
@@ -224,6 +198,127 @@ public:
     EClassType getClassType() const { return ETest; }
 
 private:
+    /**
+     * Numerically robust online variance estimation using an algorithm
+     * proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232). Partial
+     * estimates are combined with the pairwise update by Chan et al.
+     */
+    struct Statistics
+    {
+        double count = 0, mean = 0, m2 = 0;
+
+        void put(double value)
+        {
+            count += 1;
+            double delta = value - mean;
+            mean += delta / count;
+            m2 += delta * (value - mean);
+        }
+
+        void merge(const Statistics &other)
+        {
+            if (other.count == 0)
+                return;
+            double n = count + other.count, delta = other.mean - mean;
+            mean += delta * other.count / n;
+            m2 += other.m2 + delta * delta * count * other.count / n;
+            count = n;
+        }
+
+        double variance() const { return m2 / (count - 1); }
+    };
+
+    /// Input and output data of a single t-test
+    struct TestCase
+    {
+        const BSDF *bsdf = nullptr;
+        const Scene *scene = nullptr;
+        float angle = 0;
+        float reference = 0;
+        Statistics stats;
+    };
+
+    /// Draw all samples of a single test (thread-safe)
+    void runTest(TestCase &test, uint64_t testIndex) const
+    {
+        int chunkCount = (m_sampleCount + SAMPLE_CHUNK_SIZE - 1) / SAMPLE_CHUNK_SIZE;
+
+        /* Every chunk of samples draws from its own random number stream,
+           which only depends on the test and chunk index. The splitting of
+           the deterministic reduction is fixed as well, hence the estimate
+           does not depend on the thread count. */
+        test.stats = tbb::parallel_deterministic_reduce(
+            tbb::blocked_range<int>(0, chunkCount, 1),
+            Statistics(),
+            [&](const tbb::blocked_range<int> &range, Statistics stats)
+            {
+                for (int chunk = range.begin(); chunk != range.end(); ++chunk)
+                {
+                    int start = chunk * SAMPLE_CHUNK_SIZE,
+                        end = std::min(start + SAMPLE_CHUNK_SIZE, m_sampleCount);
+                    if (test.bsdf)
+                        stats.merge(sampleBSDF(test, (uint64_t)chunk, testIndex, end - start));
+                    else
+                        stats.merge(sampleScene(test, (uint64_t)chunk, testIndex, end - start));
+                }
+                return stats;
+            },
+            [](Statistics s1, const Statistics &s2)
+            {
+                s1.merge(s2);
+                return s1;
+            });
+    }
+
+    /// Estimate the scattered illumination of a BSDF under uniform lighting
+    Statistics sampleBSDF(const TestCase &test, uint64_t chunk, uint64_t testIndex, int count) const
+    {
+        pcg32 random(chunk, testIndex);
+        BSDFQueryRecord bRec(sphericalDirection(degToRad(test.angle), 0));
+
+        Statistics stats;
+        for (int k = 0; k < count; ++k)
+        {
+            Point2f sample(random.nextFloat(), random.nextFloat());
+            stats.put((double)test.bsdf->sample(bRec, sample).getLuminance());
+        }
+        return stats;
+    }
+
+    /// Estimate the average radiance received by the camera of a scene
+    Statistics sampleScene(const TestCase &test, uint64_t chunk, uint64_t testIndex, int count) const
+    {
+        const Scene *scene = test.scene;
+        const Integrator *integrator = scene->getIntegrator();
+        const Camera *camera = scene->getCamera();
+
+        /* Independent sampler with a stream that is unique to this chunk */
+        PropertyList props;
+        props.setInteger("seed", (int)(chunk * m_scenes.size() + testIndex));
+        std::unique_ptr<Sampler> sampler(static_cast<Sampler *>(
+            NoriObjectFactory::createInstance("independent", props)));
+        ImageBlock block(Vector2i(0, 0), nullptr);
+        sampler->prepare(block);
+
+        Statistics stats;
+        for (int k = 0; k < count; ++k)
+        {
+            /* Sample a ray from the camera */
+            Ray3f ray;
+            Point2f pixelSample = (sampler->next2D().array() * camera->getOutputSize().cast<float>().array()).matrix();
+            Color3f value = camera->sampleRay(ray, pixelSample, sampler->next2D());
+
+            /* Compute the incident radiance */
+            value *= integrator->Li(scene, sampler.get(), ray);
+
+            stats.put((double)value.getLuminance());
+        }
+        return stats;
+    }
+
+    /// Number of samples that share one random number stream
+    static const int SAMPLE_CHUNK_SIZE = 8192;
+
     std::vector<BSDF *> m_bsdfs;
     std::vector<Scene *> m_scenes;
     std::vector<float> m_angles;
@@ -2,6 +2,7 @@
 #include <nori/scene.h>
 #include <nori/emitter.h>
 #include <nori/bsdf.h>
+#include <nori/stats.h>
 #include <nori/vpl.h>
 #include <nori/sampler.h>
 #include <nori/warp.h>
@@ -9,6 +10,10 @@
 
 NORI_NAMESPACE_BEGIN
 
+NORI_STAT_COUNTER(statsShadowRays, "Rays", "Shadow rays");
+NORI_STAT_COUNTER(statsSecondaryRays, "Rays", "Secondary rays");
+NORI_STAT_COUNTER(statsRouletteTerminations, "Integrator", "Russian roulette terminations");
+
 class VPLIntegrator : public Integrator
 {
 public:
@@ -37,6 +42,11 @@ public:
             return its.mesh->getEmitter()->eval(emitterRecord);
         }
 
+        // Look up the textures of the BSDF once for all VPLs
+        const BSDF *bsdf = its.mesh->getBSDF();
+        BSDFClosure closure;
+        bsdf->evalClosure(its.uv, closure);
+
         // Iterate over all VPLs to compute their contribution
         for (const VPL &vpl : m_vpls)
         {
@@ -47,6 +57,7 @@ public:
             // Check visibility (shadow ray)
             Ray3f shadowRay(its.p, lightDir);
             Intersection shadowIts;
+            NORI_STAT_INC(statsShadowRays);
             if (scene->rayIntersect(shadowRay, shadowIts) && shadowIts.t * shadowIts.t <= (distanceSquared - (Epsilon * Epsilon)))
                 continue; // Skip if the VPL is occluded
 
@@ -57,8 +68,8 @@ public:
             }
 
             // Compute the BRDF at the shading point
-            BSDFQueryRecord bsdfRec(its.toLocal(-ray.d), its.toLocal(lightDir), its.uv, ESolidAngle);
-            Color3f bsdfValue = its.mesh->getBSDF()->eval(bsdfRec);
+            BSDFQueryRecord bsdfRec(its.toLocal(-ray.d), its.toLocal(lightDir), its.uv, ESolidAngle, &closure);
+            Color3f bsdfValue = bsdf->eval(bsdfRec);
 
             // Compute the geometric term
             float cosTheta = std::max(0.0f, its.shFrame.n.dot(lightDir));
@@ -136,6 +147,7 @@ private:
         while (depth++ < m_maxDepth && !weight.isZero())
         {
             Intersection its;
+            NORI_STAT_INC(statsSecondaryRays);
             if (!scene->rayIntersect(ray, its))
                 break;
 
@@ -163,7 +175,10 @@ private:
             // Russian roulette termination
             float rrProbability = std::min(weight.maxCoeff(), 1.0f);
             if (sampler->next1D() > rrProbability)
+            {
+                NORI_STAT_INC(statsRouletteTerminations);
                 break; // Terminate the path
+            }
 
             // Scale weight to account for Russian roulette termination
             weight /= rrProbability;
@@ -173,4 +173,90 @@ float Warp::squareToBeckmannPdf(const Vector3f &m, float alpha)
     return D * cosTheta;
 }
 
+namespace {
+    typedef Eigen::Array<float, NORI_WARP_BATCH_SIZE, 1> FloatBlock;
+
+    /**
+     * Hands the samples to \c func in SoA blocks of NORI_WARP_BATCH_SIZE.
+     * The tail of the last block is padded with dummy samples so that
+     * every lane stays inside the domain of the warping function.
+     */
+    template <typename Func>
+    void forEachBlock(const Point2f *samples, size_t count, const Func &func)
+    {
+        for (size_t offset = 0; offset < count; offset += NORI_WARP_BATCH_SIZE)
+        {
+            size_t size = std::min(count - offset, (size_t)NORI_WARP_BATCH_SIZE);
+            FloatBlock u = FloatBlock::Constant(0.5f), v = FloatBlock::Constant(0.5f);
+            for (size_t i = 0; i < size; ++i)
+            {
+                u[i] = samples[offset + i].x();
+                v[i] = samples[offset + i].y();
+            }
+            func(u, v, offset, size);
+        }
+    }
+
+    /**
+     * Stores the first \c size directions of a block given the cosine and
+     * sine of their elevation and their azimuth. The callers recover the
+     * sine algebraically, which avoids the acos()/atan() calls of the
+     * scalar code (neither has a SIMD version in Eigen).
+     */
+    inline void storeSpherical(Vector3f *result, size_t size, const FloatBlock &cosTheta,
+                               const FloatBlock &sinTheta, const FloatBlock &phi)
+    {
+        FloatBlock x = sinTheta * phi.cos(), y = sinTheta * phi.sin();
+        for (size_t i = 0; i < size; ++i)
+            result[i] = Vector3f(x[i], y[i], cosTheta[i]);
+    }
+}
+
+void Warp::squareToUniformDisk(const Point2f *samples, Point2f *result, size_t count)
+{
+    forEachBlock(samples, count, [&](const FloatBlock &u, const FloatBlock &v, size_t offset, size_t size) {
+        FloatBlock r = u.sqrt(), theta = (2.0f * M_PI) * v;
+        FloatBlock x = r * theta.cos(), y = r * theta.sin();
+        for (size_t i = 0; i < size; ++i)
+            result[offset + i] = Point2f(x[i], y[i]);
+    });
+}
+
+void Warp::squareToUniformSphere(const Point2f *samples, Vector3f *result, size_t count)
+{
+    forEachBlock(samples, count, [&](const FloatBlock &u, const FloatBlock &v, size_t offset, size_t size) {
+        FloatBlock cosTheta = 1.0f - 2.0f * v;
+        FloatBlock sinTheta = (1.0f - cosTheta.square()).max(0.0f).sqrt();
+        storeSpherical(result + offset, size, cosTheta, sinTheta, (2.0f * M_PI) * u);
+    });
+}
+
+void Warp::squareToUniformHemisphere(const Point2f *samples, Vector3f *result, size_t count)
+{
+    forEachBlock(samples, count, [&](const FloatBlock &u, const FloatBlock &v, size_t offset, size_t size) {
+        FloatBlock cosTheta = 1.0f - v;
+        FloatBlock sinTheta = (1.0f - cosTheta.square()).max(0.0f).sqrt();
+        storeSpherical(result + offset, size, cosTheta, sinTheta, (2.0f * M_PI) * u);
+    });
+}
+
+void Warp::squareToCosineHemisphere(const Point2f *samples, Vector3f *result, size_t count)
+{
+    forEachBlock(samples, count, [&](const FloatBlock &u, const FloatBlock &v, size_t offset, size_t size) {
+        storeSpherical(result + offset, size, (1.0f - u).sqrt(), u.sqrt(), (2.0f * M_PI) * v);
+    });
+}
+
+void Warp::squareToBeckmann(const Point2f *samples, Vector3f *result, size_t count, float alpha)
+{
+    float alpha2 = alpha * alpha;
+    forEachBlock(samples, count, [&](const FloatBlock &u, const FloatBlock &v, size_t offset, size_t size) {
+        /* tan^2(theta) = -alpha^2 log(u), clamped so that u = 0 maps to theta = pi/2 rather than NaN */
+        FloatBlock tan2Theta = (-alpha2 * u.log()).min(std::numeric_limits<float>::max());
+        FloatBlock cos2Theta = 1.0f / (1.0f + tan2Theta);
+        storeSpherical(result + offset, size, cos2Theta.sqrt(), (tan2Theta * cos2Theta).sqrt(),
+                       (2.0f * M_PI) * v);
+    });
+}
+
 NORI_NAMESPACE_END
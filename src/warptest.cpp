@@ -238,9 +238,38 @@ struct WarpTest
         const int minExpFrequency = 5;
         const float significanceLevel = 0.01f;
 
-        return hypothesis::chi2_test(yres * xres, obsFrequencies.get(),
-                                     expFrequencies.get(), sampleCount,
-                                     minExpFrequency, significanceLevel, 1);
+        auto result = hypothesis::chi2_test(yres * xres, obsFrequencies.get(),
+                                            expFrequencies.get(), sampleCount,
+                                            minExpFrequency, significanceLevel, 1);
+
+        /* The batch warps are only checked against the (tested) scalar ones */
+        if (result.first)
+        {
+            auto batchResult = compareBatch();
+            if (!batchResult.first)
+                return batchResult;
+        }
+        return result;
+    }
+
+    /// Check that the batch warping functions agree with the scalar ones point by point
+    std::pair<bool, std::string> compareBatch()
+    {
+        int pointCount = 100000;
+        MatrixXf positions, weights, batchPositions, batchWeights;
+        generatePoints(pointCount, Independent, positions, weights);
+        generatePoints(pointCount, Independent, batchPositions, batchWeights, true);
+
+        const float tolerance = 1e-5f;
+        for (int i = 0; i < pointCount; ++i)
+        {
+            float error = (positions.col(i) - batchPositions.col(i)).cwiseAbs().maxCoeff();
+            if (!(error <= tolerance) || weights(0, i) != batchWeights(0, i))
+                return std::make_pair(false, tfm::format(
+                    "The batch warp differs from the scalar one for point %i: [%s] vs. [%s]",
+                    i, positions.col(i).transpose(), batchPositions.col(i).transpose()));
+        }
+        return std::make_pair(true, std::string("The batch warp agrees with the scalar one."));
     }
 
     std::pair<Point3f, float> warpPoint(const Point2f &sample)
@@ -288,8 +317,9 @@ struct WarpTest
         return std::make_pair(result, 1.f);
     }
 
+    /// Warps the points one by one, or using the batch warping functions (\c batch)
     void generatePoints(int &pointCount, PointType pointType,
-                        MatrixXf &positions, MatrixXf &weights)
+                        MatrixXf &positions, MatrixXf &weights, bool batch = false)
     {
         /* Determine the number of points that should be sampled */
         int sqrtVal = (int)(std::sqrt((float)pointCount) + 0.5f);
@@ -298,8 +328,7 @@ struct WarpTest
             pointCount = sqrtVal * sqrtVal;
 
         pcg32 rng;
-        positions.resize(3, pointCount);
-        weights.resize(1, pointCount);
+        std::vector<Point2f> samples(pointCount);
 
         for (int i = 0; i < pointCount; ++i)
         {
@@ -322,12 +351,69 @@ struct WarpTest
                 break;
             }
 
-            auto result = warpPoint(sample);
+            samples[i] = sample;
+        }
+
+        if (batch)
+        {
+            warpPoints(samples, positions, weights);
+            return;
+        }
+
+        positions.resize(3, pointCount);
+        weights.resize(1, pointCount);
+        for (int i = 0; i < pointCount; ++i)
+        {
+            auto result = warpPoint(samples[i]);
             positions.col(i) = result.first;
             weights(0, i) = result.second;
         }
     }
 
+    /// Warps many points at once, using the batch warping functions where available
+    void warpPoints(const std::vector<Point2f> &samples, MatrixXf &positions, MatrixXf &weights)
+    {
+        size_t count = samples.size();
+        positions.resize(3, count);
+        weights.setOnes(1, count);
+
+        std::vector<nori::Vector3f> directions(count);
+        switch (warpType)
+        {
+        case Disk:
+        {
+            std::vector<Point2f> points(count);
+            Warp::squareToUniformDisk(samples.data(), points.data(), count);
+            for (size_t i = 0; i < count; ++i)
+                positions.col(i) << points[i], 0;
+            return;
+        }
+        case UniformSphere:
+            Warp::squareToUniformSphere(samples.data(), directions.data(), count);
+            break;
+        case UniformHemisphere:
+            Warp::squareToUniformHemisphere(samples.data(), directions.data(), count);
+            break;
+        case CosineHemisphere:
+            Warp::squareToCosineHemisphere(samples.data(), directions.data(), count);
+            break;
+        case Beckmann:
+            Warp::squareToBeckmann(samples.data(), directions.data(), count, parameterValue);
+            break;
+        default:
+            for (size_t i = 0; i < count; ++i)
+            {
+                auto result = warpPoint(samples[i]);
+                positions.col(i) = result.first;
+                weights(0, i) = result.second;
+            }
+            return;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            positions.col(i) = directions[i];
+    }
+
     static std::pair<BSDF *, BSDFQueryRecord>
     create_microfacet_bsdf(float alpha, float kd, float bsdfAngle)
     {